@@ -0,0 +1,125 @@
+#include "CpuDispatch.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef RASTAMAN_CPU_DISPATCH
+#include <cpuid.h>
+#endif
+
+// Kernel tables of CpuKernels.cpp, which is compiled once per instruction
+// set
+const CpuKernels& GetBaselineKernels();
+#ifdef RASTAMAN_CPU_DISPATCH
+const CpuKernels& GetSse42Kernels();
+const CpuKernels& GetAvx2Kernels();
+const CpuKernels& GetAvx512Kernels();
+#endif
+
+namespace {
+const char* const kIsaNames[ISA_COUNT] = {
+  "baseline",
+  "sse4.2",
+  "avx2",
+  "avx512"
+};
+
+#ifdef RASTAMAN_CPU_DISPATCH
+// Register state the operating system saves on context switches
+uint64_t GetEnabledXsaveFeatures() {
+  uint32_t low, high;
+  __asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+  return static_cast<uint64_t>(high) << 32 | low;
+}
+
+CpuIsa DetectIsa() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return ISA_BASELINE;
+  }
+  const bool sse42 = ecx & bit_SSE4_2;
+  const bool fma = ecx & bit_FMA;
+  const bool avx = (ecx & bit_AVX) && (ecx & bit_OSXSAVE);
+  if (!sse42) {
+    return ISA_BASELINE;
+  }
+  // XMM and YMM state, and additionally opmask and ZMM state
+  const uint64_t xcr0 = avx ? GetEnabledXsaveFeatures() : 0;
+  if ((xcr0 & 0x06) != 0x06 || !fma
+      || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)
+      || !(ebx & bit_AVX2)) {
+    return ISA_SSE42;
+  }
+  const unsigned int avx512 =
+    bit_AVX512F | bit_AVX512DQ | bit_AVX512BW | bit_AVX512VL;
+  if ((xcr0 & 0xe6) != 0xe6 || (ebx & avx512) != avx512) {
+    return ISA_AVX2;
+  }
+  return ISA_AVX512;
+}
+#endif
+
+const CpuKernels& GetKernels(CpuIsa isa) {
+  switch (isa) {
+#ifdef RASTAMAN_CPU_DISPATCH
+    case ISA_SSE42:
+      return GetSse42Kernels();
+    case ISA_AVX2:
+      return GetAvx2Kernels();
+    case ISA_AVX512:
+      return GetAvx512Kernels();
+#endif
+    default:
+      return GetBaselineKernels();
+  }
+}
+
+std::atomic<const CpuKernels*>& GetSelectedKernels() {
+  static std::atomic<const CpuKernels*> kernels([] {
+    CpuIsa isa = GetSupportedIsa();
+    CpuIsa forced;
+    const char* name = std::getenv("RASTAMAN_ISA");
+    if (name && ParseIsa(name, &forced) && forced <= isa) {
+      isa = forced;
+    }
+    return &GetKernels(isa);
+  }());
+  return kernels;
+}
+}
+
+CpuIsa GetSupportedIsa() {
+#ifdef RASTAMAN_CPU_DISPATCH
+  static const CpuIsa isa = DetectIsa();
+  return isa;
+#else
+  return ISA_BASELINE;
+#endif
+}
+
+const CpuKernels& GetCpuKernels() {
+  return *GetSelectedKernels().load(std::memory_order_relaxed);
+}
+
+bool SetCpuIsa(CpuIsa isa) {
+  if (isa > GetSupportedIsa()) {
+    return false;
+  }
+  GetSelectedKernels().store(&GetKernels(isa), std::memory_order_relaxed);
+  return true;
+}
+
+const char* GetIsaName(CpuIsa isa) {
+  return kIsaNames[isa];
+}
+
+bool ParseIsa(const char* name, CpuIsa* isa) {
+  for (int i = 0; i < ISA_COUNT; ++i) {
+    if (!std::strcmp(name, kIsaNames[i])) {
+      *isa = static_cast<CpuIsa>(i);
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,128 @@
+#ifndef CPUDISPATCH_HPP
+#define CPUDISPATCH_HPP
+
+#include <cstdint>
+
+// Instruction sets the hot kernels are compiled for, in increasing order.
+// Each includes the ones before it.
+enum CpuIsa {
+  // Whatever the compiler targets by default, SSE2 on x86-64
+  ISA_BASELINE,
+  ISA_SSE42,
+  // AVX2 with FMA
+  ISA_AVX2,
+  // AVX-512 F, BW, DQ and VL
+  ISA_AVX512,
+  ISA_COUNT
+};
+
+// Vertex transform of RastaManRenderer::TransformVertices
+struct VertexTransform {
+  // Model-view-projection matrix, row-major
+  float matrix[4][4];
+  // Frustum planes and then the user clip planes, one out code bit each
+  float planes[11][4];
+  float viewportScale[3];
+  float viewportBias[3];
+  // Scale to raw fixed point values, 2^FP::frac_bits
+  float fixedScale;
+};
+
+// Where transformed vertices are written: the components of the first
+// vertex and the bytes between those of consecutive vertices, so that the
+// kernel can write records of any layout.  Fixed point coordinates are raw
+// int32_t values with FP::frac_bits fractional bits.
+struct TransformedVertexOutput {
+  void* screen[3];
+  void* fixed[2];
+  void* outCode;
+  void* invW;
+  int stride;
+};
+
+// Block flags
+enum {
+  // Block is inside all edges, which need no tests
+  BLOCK_INSIDE = 1,
+  BLOCK_DEPTH_TEST = 2,
+  BLOCK_DEPTH_WRITE = 4
+};
+
+// Edge functions and depth of a triangle, whose pixels are tested in 8x8
+// blocks, see RastaManRenderer::RasterizeTriangle
+struct TriangleRaster {
+  // Raw fixed point increments of the edge functions per pixel and per row
+  int32_t pixelInc[3];
+  int32_t rowInc[3];
+  // A pixel is covered if all edge functions are at least their bias
+  int32_t bias[3];
+  // Depth is z[0] + w1*toFloat*z[1] + w2*toFloat*z[2]
+  float z[3];
+  float toFloat;
+  // Floats between the rows of the depth buffer
+  int depthStride;
+};
+
+// One block of a triangle.  Pixel (x, y) of the block is bit y*8 + x of the
+// masks.
+struct BlockRaster {
+  // Raw fixed point edge function values at the top left pixel
+  int32_t edge[3];
+  int flags;
+  // Pixels to test
+  uint64_t mask;
+  // Top left pixel of the block.  All 8x8 pixels must be readable.
+  float* depth;
+};
+
+struct BlockCoverage {
+  // Pixels inside the triangle
+  uint64_t covered;
+  // Covered pixels with a depth within [0, 1]
+  uint64_t tested;
+  // Tested pixels that pass the depth test
+  uint64_t passed;
+};
+
+// Kernels compiled for one instruction set.  All of them give bit-identical
+// results on every instruction set.
+struct CpuKernels {
+  CpuIsa isa;
+  // Transforms count positions of three floats each
+  void (*transformVertices)(const VertexTransform& transform,
+                            const float* positions, int count,
+                            const TransformedVertexOutput& vertices);
+  // Tests the pixels of blocks of a triangle and writes the depth of the
+  // passed ones.  Called once per triangle and tile, as calls per block
+  // would cost more than small triangles.
+  void (*rasterizeBlocks)(const TriangleRaster& triangle,
+                          const BlockRaster* blocks, int count,
+                          BlockCoverage* coverages);
+  // Fills count pixels of pixelSize bytes with a value
+  void (*fill)(void* pixels, const void* value, int pixelSize, int count);
+  // Converts between RGBA floats and 8-bit unsigned normalized RGBA
+  void (*encodeRgba8)(const float* values, uint8_t* pixels, int count);
+  void (*decodeRgba8)(const uint8_t* pixels, float* values, int count);
+};
+
+// Best instruction set the CPU and the operating system support, from
+// CPUID.  Always ISA_BASELINE on other architectures and compilers, which
+// only build the baseline kernels.
+CpuIsa GetSupportedIsa();
+
+// Kernels in use.  Selected on the first call: the best supported
+// instruction set, or the one in the RASTAMAN_ISA environment variable if
+// it is supported.
+const CpuKernels& GetCpuKernels();
+
+// Forces the kernels of an instruction set, e.g. from the command line.
+// Returns false and keeps the current kernels if the CPU doesn't support it.
+// Not thread-safe, call before rendering.
+bool SetCpuIsa(CpuIsa isa);
+
+// Lower case name, as accepted by ParseIsa: "baseline", "sse4.2", "avx2" or
+// "avx512"
+const char* GetIsaName(CpuIsa isa);
+bool ParseIsa(const char* name, CpuIsa* isa);
+
+#endif
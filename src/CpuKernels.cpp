@@ -0,0 +1,345 @@
+// Hot kernels of the renderer and the render surfaces, compiled once per
+// instruction set with the compiler flags of CMakeLists.txt.  Everything but
+// the kernel table is local to the translation unit, and only Simd.hpp and
+// C headers are included, so that no inline function compiled for one
+// instruction set is shared with code compiled for another.
+//
+// Floating point operations are never contracted (-ffp-contract=off), so
+// every instruction set computes the same bits as the baseline.
+
+#include "CpuDispatch.hpp"
+#include "Simd.hpp"
+
+#include <cstring>
+
+#ifndef CPU_KERNELS_ISA
+#define CPU_KERNELS_ISA ISA_BASELINE
+#define CPU_KERNELS_GETTER GetBaselineKernels
+#endif
+
+namespace {
+// Same as RastaManRenderer::kBlockSize
+const int kBlockSize = 8;
+const int kBlockPixels = kBlockSize * kBlockSize;
+// Rows of a block covered by a group of lanes
+const int kGroupRows = kSimdWidth > kBlockSize ? kSimdWidth / kBlockSize : 1;
+// Columns of a block covered by a group of lanes
+const int kGroupColumns = kSimdWidth < kBlockSize ? kSimdWidth : kBlockSize;
+
+// Fill pattern and the most bytes stored at once
+const int kPatternSize = 64;
+
+// Steps a raw fixed point value n times, wrapping around like the SIMD
+// additions
+int32_t Step(int32_t value, int32_t inc, int n) {
+  return static_cast<int32_t>(static_cast<uint32_t>(value)
+    + static_cast<uint32_t>(inc) * static_cast<uint32_t>(n));
+}
+
+// Writes a component of a record, whatever the type of the record
+template<typename T>
+void Store(void* component, std::size_t offset, T value) {
+  std::memcpy(static_cast<unsigned char*>(component) + offset, &value,
+              sizeof(value));
+}
+
+void TransformVertices(const VertexTransform& transform,
+                       const float* positions, int count,
+                       const TransformedVertexOutput& vertices) {
+  SimdFloat row[4][4];
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      row[i][j] = SimdSet(transform.matrix[i][j]);
+    }
+  }
+  SimdFloat planes[11][4];
+  for (int i = 0; i < 11; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      planes[i][j] = SimdSet(transform.planes[i][j]);
+    }
+  }
+  const SimdFloat zero = SimdSet(0.0f);
+  const SimdFloat one = SimdSet(1.0f);
+  const SimdFloat half = SimdSet(0.5f);
+  const SimdFloat minusHalf = SimdSet(-0.5f);
+  const SimdFloat fixedScale = SimdSet(transform.fixedScale);
+  const SimdInt noBits = SimdSet(0);
+  SimdFloat scale[3], bias[3];
+  for (int i = 0; i < 3; ++i) {
+    scale[i] = SimdSet(transform.viewportScale[i]);
+    bias[i] = SimdSet(transform.viewportBias[i]);
+  }
+
+  // Transforms the lanes of a group from the first position on.  Inlined
+  // once for full groups, where the number of lanes is a constant.
+  const auto transformGroup = [&](int first, int lanes) {
+    // Gather the positions into one register per coordinate.  Lanes past
+    // the last position transform the origin, and are never stored.
+    float in[3][kSimdWidth] = {};
+    for (int lane = 0; lane < lanes; ++lane) {
+      for (int i = 0; i < 3; ++i) {
+        in[i][lane] = positions[(first + lane)*3 + i];
+      }
+    }
+    const SimdFloat x = SimdLoad(in[0]);
+    const SimdFloat y = SimdLoad(in[1]);
+    const SimdFloat z = SimdLoad(in[2]);
+
+    // Same order of operations as the matrix-vector product in
+    // RastaManRenderer::ProcessVertex
+    SimdFloat clip[4];
+    for (int i = 0; i < 4; ++i) {
+      clip[i] = row[i][0]*x + row[i][1]*y + row[i][2]*z + row[i][3];
+    }
+
+    SimdInt outCode = noBits;
+    for (int i = 0; i < 11; ++i) {
+      const SimdFloat distance = planes[i][0]*clip[0] + planes[i][1]*clip[1]
+        + planes[i][2]*clip[2] + planes[i][3]*clip[3];
+      outCode = outCode | SimdSelect(distance < zero, SimdSet(1 << i), noBits);
+    }
+
+    // Dehomogenization, viewport transform and conversion to fixed point
+    // with the rounding of FP.  Lanes outside the guard band get garbage
+    // that is never read.
+    float screen[3][kSimdWidth];
+    int32_t fixed[2][kSimdWidth];
+    for (int i = 0; i < 3; ++i) {
+      const SimdFloat s = clip[i] / clip[3] * scale[i] + bias[i];
+      SimdStore(screen[i], s);
+      if (i < 2) {
+        const SimdFloat f = (s - half) * fixedScale;
+        SimdStore(fixed[i],
+                  SimdTruncate(f + SimdSelect(f >= zero, half, minusHalf)));
+      }
+    }
+    float invW[kSimdWidth];
+    SimdStore(invW, one / clip[3]);
+    int32_t outCodes[kSimdWidth];
+    SimdStore(outCodes, outCode);
+
+    for (int lane = 0; lane < lanes; ++lane) {
+      const std::size_t offset =
+        static_cast<std::size_t>(first + lane) * vertices.stride;
+      for (int i = 0; i < 3; ++i) {
+        Store(vertices.screen[i], offset, screen[i][lane]);
+      }
+      for (int i = 0; i < 2; ++i) {
+        Store(vertices.fixed[i], offset, fixed[i][lane]);
+      }
+      Store(vertices.outCode, offset, outCodes[lane]);
+      Store(vertices.invW, offset, invW[lane]);
+    }
+  };
+
+  int first = 0;
+  for (; first + kSimdWidth <= count; first += kSimdWidth) {
+    transformGroup(first, kSimdWidth);
+  }
+  if (first < count) {
+    transformGroup(first, count - first);
+  }
+}
+
+// Groups span at most two rows, loaded and stored as halves
+static_assert(kGroupRows <= 2, "Groups of more than two rows");
+
+// Depth of the pixels of a group, starting at the given pixel of a row
+SimdFloat LoadDepth(const float* depth, int stride) {
+  if (kGroupRows == 1) {
+    return SimdLoad(depth);
+  }
+  return SimdLoadHalves(depth, depth + stride);
+}
+
+// Writes the depth of the lanes of a group in a mask
+void StoreDepth(float* depth, int stride, SimdFloat z, SimdMask mask) {
+  if (kGroupRows == 1) {
+    SimdStore(depth, z, mask);
+  } else {
+    SimdStoreHalves(depth, depth + stride, z, mask);
+  }
+}
+
+void RasterizeBlocks(const TriangleRaster& triangle,
+                     const BlockRaster* blocks, int count,
+                     BlockCoverage* coverages) {
+  // The blocks are walked in groups of kSimdWidth pixels in row-major
+  // order.  Lane i of a group holds pixel i % 8 of row i / 8 relative to the
+  // first pixel of the group.  The edge functions of the groups are stepped
+  // incrementally, as in RastaManRenderer::RasterizeTriangle.
+  SimdInt laneOffset[3];
+  SimdInt laneBias[3];
+  SimdInt columnStep[3];
+  SimdInt rowStep[3];
+  for (int i = 0; i < 3; ++i) {
+    int32_t offsets[kSimdWidth];
+    offsets[0] = 0;
+    for (int lane = 1; lane < kSimdWidth; ++lane) {
+      offsets[lane] = lane % kBlockSize
+        ? Step(offsets[lane - 1], triangle.pixelInc[i], 1)
+        : Step(offsets[lane - kBlockSize], triangle.rowInc[i], 1);
+    }
+    laneOffset[i] = SimdLoad(offsets);
+    laneBias[i] = SimdSet(triangle.bias[i]);
+    columnStep[i] = SimdSet(Step(0, triangle.pixelInc[i], kGroupColumns));
+    rowStep[i] = SimdSet(Step(0, triangle.rowInc[i], kGroupRows));
+  }
+  const SimdFloat toFloat = SimdSet(triangle.toFloat);
+  const SimdFloat z0 = SimdSet(triangle.z[0]);
+  const SimdFloat z1 = SimdSet(triangle.z[1]);
+  const SimdFloat z2 = SimdSet(triangle.z[2]);
+  const SimdFloat zero = SimdSet(0.0f);
+  const SimdFloat one = SimdSet(1.0f);
+  const int stride = triangle.depthStride;
+  const uint32_t laneMask = (1u << kSimdWidth) - 1;
+  const uint32_t rowMask = (1u << kGroupRows*kBlockSize) - 1;
+
+  for (int b = 0; b < count; ++b) {
+    const BlockRaster& block = blocks[b];
+    const bool inside = (block.flags & BLOCK_INSIDE) != 0;
+    const bool depthTest = (block.flags & BLOCK_DEPTH_TEST) != 0;
+    const bool depthWrite = (block.flags & BLOCK_DEPTH_WRITE) != 0;
+
+    uint64_t covered = 0;
+    uint64_t tested = 0;
+    uint64_t passed = 0;
+    SimdInt row[3];
+    for (int i = 0; i < 3; ++i) {
+      row[i] = SimdSet(block.edge[i]) + laneOffset[i];
+    }
+    for (int y = 0; y < kBlockSize; y += kGroupRows) {
+      const int rowFirst = y*kBlockSize;
+      const uint32_t rowLanes =
+        static_cast<uint32_t>(block.mask >> rowFirst) & rowMask;
+      SimdInt w[3] = { row[0], row[1], row[2] };
+      for (int i = 0; i < 3; ++i) {
+        row[i] = row[i] + rowStep[i];
+      }
+      for (int x = 0; x < kBlockSize && rowLanes >> x; x += kGroupColumns) {
+        const uint32_t lanes = rowLanes >> x & laneMask;
+        const int first = rowFirst + x;
+        const uint32_t groupCovered = !lanes || inside ? lanes : lanes
+          & SimdBits((w[0] >= laneBias[0]) & (w[1] >= laneBias[1])
+                     & (w[2] >= laneBias[2]));
+        if (groupCovered) {
+          const SimdFloat z = z0 + SimdToFloat(w[1])*toFloat*z1
+            + SimdToFloat(w[2])*toFloat*z2;
+          const uint32_t groupTested =
+            groupCovered & SimdBits((z >= zero) & (one >= z));
+          float* groupDepth = block.depth + y*stride + x;
+          uint32_t groupPassed = groupTested;
+          if (depthTest && groupTested) {
+            groupPassed &= SimdBits(z < LoadDepth(groupDepth, stride));
+          }
+          if (depthWrite && groupPassed) {
+            StoreDepth(groupDepth, stride, z, SimdLanes(groupPassed));
+          }
+
+          covered |= static_cast<uint64_t>(groupCovered) << first;
+          tested |= static_cast<uint64_t>(groupTested) << first;
+          passed |= static_cast<uint64_t>(groupPassed) << first;
+        }
+        for (int i = 0; i < 3; ++i) {
+          w[i] = w[i] + columnStep[i];
+        }
+      }
+    }
+
+    coverages[b].covered = covered;
+    coverages[b].tested = tested;
+    coverages[b].passed = passed;
+  }
+}
+
+template<int PixelSize>
+void FillPattern(unsigned char* pattern, const void* value) {
+  for (int i = 0; i < kPatternSize; i += PixelSize) {
+    std::memcpy(pattern + i, value, PixelSize);
+  }
+}
+
+void Fill(void* pixels, const void* value, int pixelSize, int count) {
+  unsigned char* dst = static_cast<unsigned char*>(pixels);
+  unsigned char pattern[kPatternSize];
+  switch (pixelSize) {
+    case 2:
+      FillPattern<2>(pattern, value);
+      break;
+    case 4:
+      FillPattern<4>(pattern, value);
+      break;
+    case 8:
+      FillPattern<8>(pattern, value);
+      break;
+    case 16:
+      FillPattern<16>(pattern, value);
+      break;
+    default:
+      for (int i = 0; i < count; ++i) {
+        std::memcpy(dst + i*pixelSize, value, pixelSize);
+      }
+      return;
+  }
+
+  // The pattern starts with a whole pixel, so the remainder is a prefix of
+  // it
+  std::size_t size = static_cast<std::size_t>(pixelSize) * count;
+  for (; size >= kPatternSize; size -= kPatternSize) {
+    std::memcpy(dst, pattern, kPatternSize);
+    dst += kPatternSize;
+  }
+  std::memcpy(dst, pattern, size);
+}
+
+// Same as PixelTraits<PixelRGBA8>::Encode
+uint8_t EncodeUnorm8(float f) {
+  const float saturated = f > 0.0f ? (1.0f < f ? 1.0f : f) : 0.0f;
+  return static_cast<uint8_t>(
+    static_cast<int32_t>(saturated * 255.0f + 0.5f));
+}
+
+void EncodeRgba8(const float* values, uint8_t* pixels, int count) {
+  const SimdFloat zero = SimdSet(0.0f);
+  const SimdFloat one = SimdSet(1.0f);
+  const SimdFloat half = SimdSet(0.5f);
+  const SimdFloat scale = SimdSet(255.0f);
+  const int size = count * 4;
+  int i = 0;
+  for (; i + kSimdWidth <= size; i += kSimdWidth) {
+    const SimdFloat f = SimdLoad(values + i);
+    // Saturation, which maps NaN to 0 as well
+    const SimdFloat saturated =
+      SimdSelect(zero < f, SimdSelect(one < f, one, f), zero);
+    SimdStoreBytes(pixels + i, SimdTruncate(saturated * scale + half));
+  }
+  for (; i < size; ++i) {
+    pixels[i] = EncodeUnorm8(values[i]);
+  }
+}
+
+void DecodeRgba8(const uint8_t* pixels, float* values, int count) {
+  const SimdFloat scale = SimdSet(255.0f);
+  const int size = count * 4;
+  int i = 0;
+  for (; i + kSimdWidth <= size; i += kSimdWidth) {
+    SimdStore(values + i, SimdToFloat(SimdLoadBytes(pixels + i)) / scale);
+  }
+  for (; i < size; ++i) {
+    values[i] = pixels[i] / 255.0f;
+  }
+}
+
+const CpuKernels kKernels = {
+  CPU_KERNELS_ISA,
+  TransformVertices,
+  RasterizeBlocks,
+  Fill,
+  EncodeRgba8,
+  DecodeRgba8
+};
+}
+
+const CpuKernels& CPU_KERNELS_GETTER() {
+  return kKernels;
+}
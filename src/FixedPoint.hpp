@@ -72,6 +72,15 @@ class FixedPoint
     return value_ / kOne;
   }
 
+  // Access to the underlying integer representation, e.g. for SIMD code
+  static type FromRaw(BaseType value) {
+    return type(value, 0);
+  }
+
+  BaseType GetRaw() const {
+    return value_;
+  }
+
   template<typename T>
   operator T() const {
     return GetAs<T>();
@@ -3,6 +3,17 @@
 
 #include "Eigen/Core"
 
+// Optional per-vertex attribute streams, indexed like the positions.  Streams
+// that are not given are null.
+struct VertexAttributes {
+  VertexAttributes() : normals(nullptr), texCoords(nullptr), colors(nullptr) {
+  }
+
+  const float* normals;    // 3 floats per vertex
+  const float* texCoords;  // 2 floats per vertex
+  const float* colors;     // 4 floats per vertex
+};
+
 class IRenderer {
  public:
   virtual ~IRenderer() {}
@@ -17,6 +28,10 @@ class IRenderer {
   virtual void DrawTriangles(const Eigen::Vector3f* vertices,
                              const int* indices,
                              int count) = 0;
+  virtual void DrawTriangles(const Eigen::Vector3f* vertices,
+                             const VertexAttributes& attributes,
+                             const int* indices,
+                             int count) = 0;
 };
 
 #endif
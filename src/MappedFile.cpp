@@ -0,0 +1,82 @@
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+    : data_(nullptr), size_(0), mapped_(false) {
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+bool MappedFile::Open(const char* filename) {
+  Close();
+
+#ifndef _WIN32
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return false;
+  }
+  size_ = static_cast<std::size_t>(info.st_size);
+  if (size_ > 0) {
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      size_ = 0;
+      return false;
+    }
+    data_ = static_cast<const char*>(data);
+    mapped_ = true;
+  }
+  // The mapping stays valid after closing the descriptor
+  close(fd);
+  return true;
+#else
+  std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+  if (!ifs) {
+    return false;
+  }
+  buffer_.resize(static_cast<std::size_t>(ifs.tellg()));
+  ifs.seekg(0);
+  if (!buffer_.empty() && !ifs.read(&buffer_[0], buffer_.size())) {
+    buffer_.clear();
+    return false;
+  }
+  data_ = buffer_.empty() ? nullptr : &buffer_[0];
+  size_ = buffer_.size();
+  return true;
+#endif
+}
+
+void MappedFile::Close() {
+#ifndef _WIN32
+  if (mapped_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+#endif
+  buffer_.clear();
+  data_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+}
+
+const char* MappedFile::GetData() const {
+  return data_;
+}
+
+std::size_t MappedFile::GetSize() const {
+  return size_;
+}
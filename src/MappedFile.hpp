@@ -0,0 +1,30 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include "boost/noncopyable.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// Read-only view of a whole file.  The file is memory-mapped where the
+// platform supports it and read into memory otherwise.
+class MappedFile : public boost::noncopyable {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // Returns false if the file cannot be opened or mapped
+  bool Open(const char* filename);
+  void Close();
+
+  const char* GetData() const;
+  std::size_t GetSize() const;
+
+ private:
+  const char* data_;
+  std::size_t size_;
+  bool mapped_;
+  std::vector<char> buffer_;
+};
+
+#endif
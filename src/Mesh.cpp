@@ -0,0 +1,314 @@
+#include "Mesh.hpp"
+
+#include "ObjLoader.hpp"
+
+#include "Eigen/Geometry"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace Eigen;
+
+namespace {
+const char kCacheMagic[4] = { 'R', 'M', 'S', 'H' };
+const uint32_t kCacheVersion = 2;
+const char kCacheExtension[] = ".rmesh";
+
+// Arrays in the cache start at cache line boundaries
+const uint64_t kCacheAlignment = 64;
+
+const int kAttributeComponents[kMeshAttributeCount] = { 3, 2, 4 };
+
+uint64_t AlignOffset(uint64_t offset) {
+  return (offset + kCacheAlignment - 1) / kCacheAlignment * kCacheAlignment;
+}
+
+void WritePadding(std::ofstream& ofs, uint64_t offset) {
+  static const char zeros[kCacheAlignment] = {};
+  ofs.write(zeros, AlignOffset(offset) - offset);
+}
+
+// Whether count elements of elementSize bytes at offset lie within a cache
+// of size bytes.  Offsets are read from the file and may be anything.
+bool FitsInCache(uint64_t offset, uint64_t count, uint64_t elementSize,
+                 uint64_t size) {
+  return offset <= size && count * elementSize <= size - offset;
+}
+
+// Name next to name that no other process or thread writes at the same time
+std::string GetTempName(const std::string& name) {
+  static std::atomic<int> counter(0);
+#ifdef _WIN32
+  const int pid = _getpid();
+#else
+  const int pid = static_cast<int>(getpid());
+#endif
+  std::ostringstream tempName;
+  tempName << name << '.' << pid << '.' << counter++ << ".tmp";
+  return tempName.str();
+}
+
+// Sums of the unnormalized face normals, which weights faces by their area
+std::vector<Vector3f> ComputeNormals(const std::vector<Vector3f>& vertices,
+                                     const std::vector<int>& indices) {
+  std::vector<Vector3f> normals(vertices.size(), Vector3f::Zero());
+  const int vertexCount = static_cast<int>(vertices.size());
+  for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const int* face = &indices[i];
+    if (std::any_of(face, face + 3, [vertexCount] (int index) {
+          return index < 0 || index >= vertexCount;
+        })) {
+      continue;
+    }
+    const Vector3f normal = (vertices[face[1]] - vertices[face[0]])
+      .cross(vertices[face[2]] - vertices[face[0]]);
+    for (int j = 0; j < 3; ++j) {
+      normals[face[j]] += normal;
+    }
+  }
+  for (auto& normal : normals) {
+    normal.normalize();
+  }
+  return normals;
+}
+}
+
+// All fields are in native byte order.  Array offsets are relative to the
+// start of the file; attributes that are absent have offset 0.
+struct Mesh::CacheHeader {
+  char magic[4];
+  uint32_t version;
+  // Size and modification time of the OBJ file the cache was built from
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  float min[3];
+  float max[3];
+  uint64_t vertexOffset;
+  uint64_t indexOffset;
+  uint64_t attributeOffsets[kMeshAttributeCount];
+};
+
+Mesh::Mesh() {
+  Clear();
+}
+
+Mesh::~Mesh() {
+}
+
+bool Mesh::Load(const char* filename) {
+  Clear();
+
+  std::error_code error;
+  CacheHeader source = {};
+  source.sourceSize = std::filesystem::file_size(filename, error);
+  if (error) {
+    return false;
+  }
+  source.sourceTime = std::filesystem::last_write_time(filename, error)
+    .time_since_epoch().count();
+
+  const std::string cacheName = std::string(filename) + kCacheExtension;
+  if (!error && LoadCache(cacheName, source)) {
+    return true;
+  }
+
+  // A model that cannot be read must not leave an empty cache behind
+  if (!LoadSimpleObj(filename, parsedVertices_, parsedIndices_, min_, max_)) {
+    return false;
+  }
+  if (parsedVertices_.empty()) {
+    min_ = max_ = Vector3f::Zero();
+  }
+  vertices_ = parsedVertices_.empty() ? nullptr : &parsedVertices_[0];
+  indices_ = parsedIndices_.empty() ? nullptr : &parsedIndices_[0];
+  vertexCount_ = static_cast<int>(parsedVertices_.size());
+  indexCount_ = static_cast<int>(parsedIndices_.size());
+  // Normals in the OBJ file are not read, as faces index them separately
+  // from the positions.  Smooth normals are computed instead.
+  parsedNormals_ = ComputeNormals(parsedVertices_, parsedIndices_);
+  if (!parsedNormals_.empty()) {
+    attributes_[MESH_NORMAL] = parsedNormals_[0].data();
+  }
+  if (!error) {
+    WriteCache(cacheName, source);
+  }
+  return true;
+}
+
+int Mesh::GetVertexCount() const {
+  return vertexCount_;
+}
+
+int Mesh::GetIndexCount() const {
+  return indexCount_;
+}
+
+const Vector3f* Mesh::GetVertices() const {
+  return vertices_;
+}
+
+const int* Mesh::GetIndices() const {
+  return indices_;
+}
+
+const float* Mesh::GetAttribute(MeshAttribute attribute) const {
+  return attributes_[attribute];
+}
+
+const Vector3f& Mesh::GetMin() const {
+  return min_;
+}
+
+const Vector3f& Mesh::GetMax() const {
+  return max_;
+}
+
+bool Mesh::LoadCache(const std::string& cacheName,
+                     const CacheHeader& source) {
+  if (!cache_.Open(cacheName.c_str())) {
+    return false;
+  }
+
+  const uint64_t size = cache_.GetSize();
+  CacheHeader header;
+  if (size < sizeof(header)) {
+    cache_.Close();
+    return false;
+  }
+  std::memcpy(&header, cache_.GetData(), sizeof(header));
+
+  // Reject caches of other versions, of a modified model and truncated ones
+  bool valid = !std::memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic))
+    && header.version == kCacheVersion
+    && header.sourceSize == source.sourceSize
+    && header.sourceTime == source.sourceTime
+    && header.vertexCount <= INT_MAX && header.indexCount <= INT_MAX
+    && header.vertexOffset % kCacheAlignment == 0
+    && header.indexOffset % kCacheAlignment == 0
+    && FitsInCache(header.vertexOffset, header.vertexCount,
+                   sizeof(Vector3f), size)
+    && FitsInCache(header.indexOffset, header.indexCount, sizeof(int), size);
+  for (int i = 0; i < kMeshAttributeCount; ++i) {
+    const uint64_t offset = header.attributeOffsets[i];
+    valid = valid && offset % kCacheAlignment == 0
+      && FitsInCache(offset, header.vertexCount,
+                     kAttributeComponents[i] * sizeof(float), size);
+  }
+  // The renderer indexes the vertex arrays unchecked, so every index must be
+  // in range.  Negative indices compare as large unsigned ones.
+  const char* data = cache_.GetData();
+  if (valid && header.indexCount) {
+    const int* indices =
+      reinterpret_cast<const int*>(data + header.indexOffset);
+    uint32_t maxIndex = 0;
+    for (uint32_t i = 0; i < header.indexCount; ++i) {
+      maxIndex = std::max(maxIndex, static_cast<uint32_t>(indices[i]));
+    }
+    valid = maxIndex < header.vertexCount;
+  }
+  if (!valid) {
+    cache_.Close();
+    return false;
+  }
+
+  vertexCount_ = static_cast<int>(header.vertexCount);
+  indexCount_ = static_cast<int>(header.indexCount);
+  vertices_ = reinterpret_cast<const Vector3f*>(data + header.vertexOffset);
+  indices_ = reinterpret_cast<const int*>(data + header.indexOffset);
+  for (int i = 0; i < kMeshAttributeCount; ++i) {
+    attributes_[i] = header.attributeOffsets[i] ?
+      reinterpret_cast<const float*>(data + header.attributeOffsets[i]) :
+      nullptr;
+  }
+  min_ = Vector3f(header.min);
+  max_ = Vector3f(header.max);
+  return true;
+}
+
+void Mesh::WriteCache(const std::string& cacheName,
+                      const CacheHeader& source) const {
+  CacheHeader header = source;
+  std::memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.version = kCacheVersion;
+  header.vertexCount = static_cast<uint32_t>(vertexCount_);
+  header.indexCount = static_cast<uint32_t>(indexCount_);
+  Vector3f::Map(header.min) = min_;
+  Vector3f::Map(header.max) = max_;
+  header.vertexOffset = AlignOffset(sizeof(header));
+  const uint64_t vertexEnd =
+    header.vertexOffset + vertexCount_ * sizeof(Vector3f);
+  header.indexOffset = AlignOffset(vertexEnd);
+  const uint64_t indexEnd = header.indexOffset + indexCount_ * sizeof(int);
+  uint64_t end = indexEnd;
+  for (int i = 0; i < kMeshAttributeCount; ++i) {
+    header.attributeOffsets[i] = 0;
+    if (attributes_[i]) {
+      header.attributeOffsets[i] = AlignOffset(end);
+      end = header.attributeOffsets[i]
+        + vertexCount_ * kAttributeComponents[i] * sizeof(float);
+    }
+  }
+
+  // Written under a temporary name of this process and renamed, so that
+  // other processes never map a partially written cache, nor one mixed from
+  // several writers.  Failing to write it is harmless.
+  const std::string tempName = GetTempName(cacheName);
+  std::ofstream ofs(tempName.c_str(), std::ios::binary);
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  WritePadding(ofs, sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(vertices_),
+            vertexCount_ * sizeof(Vector3f));
+  WritePadding(ofs, vertexEnd);
+  ofs.write(reinterpret_cast<const char*>(indices_),
+            indexCount_ * sizeof(int));
+  uint64_t position = indexEnd;
+  for (int i = 0; i < kMeshAttributeCount; ++i) {
+    if (attributes_[i]) {
+      WritePadding(ofs, position);
+      const uint64_t size =
+        vertexCount_ * kAttributeComponents[i] * sizeof(float);
+      ofs.write(reinterpret_cast<const char*>(attributes_[i]), size);
+      position = header.attributeOffsets[i] + size;
+    }
+  }
+  WritePadding(ofs, position);
+  ofs.close();
+
+  std::error_code error;
+  if (!ofs) {
+    std::filesystem::remove(tempName, error);
+    return;
+  }
+  std::filesystem::rename(tempName, cacheName, error);
+  if (error) {
+    std::filesystem::remove(tempName, error);
+  }
+}
+
+void Mesh::Clear() {
+  cache_.Close();
+  parsedVertices_.clear();
+  parsedIndices_.clear();
+  parsedNormals_.clear();
+  vertices_ = nullptr;
+  indices_ = nullptr;
+  for (int i = 0; i < kMeshAttributeCount; ++i) {
+    attributes_[i] = nullptr;
+  }
+  vertexCount_ = 0;
+  indexCount_ = 0;
+  min_ = max_ = Vector3f::Zero();
+}
@@ -0,0 +1,67 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include "MappedFile.hpp"
+
+#include "Eigen/Core"
+
+#include "boost/noncopyable.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Optional per-vertex attributes of the binary mesh format
+enum MeshAttribute {
+  MESH_NORMAL,    // 3 floats
+  MESH_TEXCOORD,  // 2 floats
+  MESH_COLOR,     // 4 floats
+  kMeshAttributeCount
+};
+
+// Indexed triangle mesh loaded from an OBJ file, with smooth vertex normals.
+// The first load of a model writes a binary cache next to it, <model>.rmesh,
+// which later loads map into memory and use in place without parsing or
+// copying.
+class Mesh : public boost::noncopyable {
+ public:
+  Mesh();
+  ~Mesh();
+
+  // Returns false if the model cannot be read
+  bool Load(const char* filename);
+
+  int GetVertexCount() const;
+  int GetIndexCount() const;
+  const Eigen::Vector3f* GetVertices() const;
+  const int* GetIndices() const;
+  // Null if the mesh has no such attribute
+  const float* GetAttribute(MeshAttribute attribute) const;
+
+  const Eigen::Vector3f& GetMin() const;
+  const Eigen::Vector3f& GetMax() const;
+
+ private:
+  struct CacheHeader;
+
+  bool LoadCache(const std::string& cacheName, const CacheHeader& source);
+  void WriteCache(const std::string& cacheName,
+                  const CacheHeader& source) const;
+  void Clear();
+
+  // Either views into the mapped cache or into the parsed arrays
+  const Eigen::Vector3f* vertices_;
+  const int* indices_;
+  const float* attributes_[kMeshAttributeCount];
+  int vertexCount_;
+  int indexCount_;
+  Eigen::Vector3f min_;
+  Eigen::Vector3f max_;
+
+  MappedFile cache_;
+  std::vector<Eigen::Vector3f> parsedVertices_;
+  std::vector<int> parsedIndices_;
+  std::vector<Eigen::Vector3f> parsedNormals_;
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include "ObjLoader.hpp"
+
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+using namespace Eigen;
+
+namespace {
+// Files are split into chunks of at least this size that are parsed in
+// parallel
+const std::size_t kMinChunkSize = 1 << 20;
+
+// Geometry of one chunk, with indices relative to the whole file
+struct ObjChunk {
+  std::vector<Vector3f> vertices;
+  std::vector<int> indices;
+  Vector3f min;
+  Vector3f max;
+};
+
+// The scanner follows the rules of the previous stream-based parser, so the
+// output is identical for well-formed files: tokens are separated by the
+// whitespace skipped by operator>>, and after each face index everything up
+// to the next space is ignored, which skips texture and normal indices.
+// Malformed files may differ.  Numbers that fail to parse read as 0, as do
+// the remaining coordinates of a vertex, and from_chars accepts inf and nan,
+// which operator>> rejects.
+inline bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline const char* SkipSpace(const char* p, const char* end) {
+  while (p != end && IsSpace(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+inline const char* SkipPastSpace(const char* p, const char* end) {
+  p = static_cast<const char*>(std::memchr(p, ' ', end - p));
+  return p ? p + 1 : end;
+}
+
+// Like operator>>, a failed parse yields 0
+template<typename T>
+inline bool ParseNumber(const char*& p, const char* end, T& value) {
+  p = SkipSpace(p, end);
+  // from_chars does not accept an explicit plus sign
+  if (p != end && *p == '+') {
+    ++p;
+  }
+  const auto result = std::from_chars(p, end, value);
+  if (result.ec != std::errc()) {
+    value = 0;
+    return false;
+  }
+  p = result.ptr;
+  return true;
+}
+
+void ParseLine(const char* p, const char* end, ObjChunk& chunk) {
+  if (p == end || *p == '#') {
+    return;
+  }
+  p = SkipSpace(p, end);
+  const char* keyword = p;
+  while (p != end && !IsSpace(*p)) {
+    ++p;
+  }
+  const std::size_t keywordLength = p - keyword;
+
+  if (keywordLength == 1 && *keyword == 'v') {
+    Vector3f vec;
+    for (int i = 0; i < 3; ++i) {
+      if (!ParseNumber(p, end, vec[i])) {
+        std::fill(&vec[i], vec.data() + 3, 0.0f);
+        break;
+      }
+    }
+    if (chunk.vertices.empty()) {
+      chunk.min = chunk.max = vec;
+    } else {
+      chunk.min = chunk.min.cwiseMin(vec);
+      chunk.max = chunk.max.cwiseMax(vec);
+    }
+    chunk.vertices.push_back(vec);
+  } else if (keywordLength == 1 && *keyword == 'f') {
+    int idx[3];
+    for (int i = 0; i < 3; ++i) {
+      ParseNumber(p, end, idx[i]);
+      p = SkipPastSpace(p, end);
+      chunk.indices.push_back(idx[i] - 1);
+    }
+    idx[1] = idx[2];
+    while (ParseNumber(p, end, idx[2])) {
+      p = SkipPastSpace(p, end);
+      chunk.indices.push_back(idx[0] - 1);
+      chunk.indices.push_back(idx[1] - 1);
+      chunk.indices.push_back(idx[2] - 1);
+      idx[1] = idx[2];
+    }
+  }
+}
+
+void ParseChunk(const char* begin, const char* end, ObjChunk& chunk) {
+  while (begin != end) {
+    const char* lineEnd =
+      static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+    if (!lineEnd) {
+      lineEnd = end;
+    }
+    ParseLine(begin, lineEnd, chunk);
+    begin = lineEnd == end ? end : lineEnd + 1;
+  }
+}
+
+// Moves a chunk boundary to the start of the next line
+const char* NextLine(const char* p, const char* begin, const char* end) {
+  if (p == begin || p == end || p[-1] == '\n') {
+    return p;
+  }
+  p = static_cast<const char*>(std::memchr(p, '\n', end - p));
+  return p ? p + 1 : end;
+}
+}
+
+bool LoadSimpleObj(const char* filename,
+                   std::vector<Vector3f>& vertices,
+                   std::vector<int>& indices,
+                   Vector3f& min, Vector3f& max) {
+  MappedFile file;
+  if (!file.Open(filename)) {
+    return false;
+  }
+  if (!file.GetSize()) {
+    return true;
+  }
+  const char* begin = file.GetData();
+  const char* end = begin + file.GetSize();
+
+  ThreadPool threadPool;
+  const int chunkCount = static_cast<int>(std::max<std::size_t>(
+    std::min<std::size_t>(file.GetSize() / kMinChunkSize,
+                          threadPool.GetThreadCount() * 4),
+    1));
+  std::vector<ObjChunk> chunks(chunkCount);
+  threadPool.ParallelFor(chunkCount, [&] (int chunk) {
+    const std::size_t size = file.GetSize();
+    const char* chunkBegin = NextLine(begin + size * chunk / chunkCount,
+                                      begin, end);
+    const char* chunkEnd = NextLine(begin + size * (chunk + 1) / chunkCount,
+                                    begin, end);
+    ParseChunk(chunkBegin, chunkEnd, chunks[chunk]);
+  });
+
+  std::size_t vertexCount = vertices.size();
+  std::size_t indexCount = indices.size();
+  for (const auto& chunk : chunks) {
+    vertexCount += chunk.vertices.size();
+    indexCount += chunk.indices.size();
+  }
+  vertices.reserve(vertexCount);
+  indices.reserve(indexCount);
+  for (const auto& chunk : chunks) {
+    if (!chunk.vertices.empty()) {
+      if (vertices.empty()) {
+        min = chunk.min;
+        max = chunk.max;
+      } else {
+        min = min.cwiseMin(chunk.min);
+        max = max.cwiseMax(chunk.max);
+      }
+    }
+    vertices.insert(vertices.end(), chunk.vertices.begin(),
+                    chunk.vertices.end());
+    indices.insert(indices.end(), chunk.indices.begin(), chunk.indices.end());
+  }
+  return true;
+}
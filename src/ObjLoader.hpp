@@ -0,0 +1,16 @@
+#ifndef OBJLOADER_HPP
+#define OBJLOADER_HPP
+
+#include "Eigen/Core"
+
+#include <vector>
+
+// Loads vertex positions and faces of a Wavefront OBJ file.  Polygons are
+// triangulated as fans, and min and max receive the bounds of the vertices.
+// Returns false if the file cannot be read.
+bool LoadSimpleObj(const char* filename,
+                   std::vector<Eigen::Vector3f>& vertices,
+                   std::vector<int>& indices,
+                   Eigen::Vector3f& min, Eigen::Vector3f& max);
+
+#endif
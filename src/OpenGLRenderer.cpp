@@ -33,17 +33,36 @@ void OpenGLRenderer::SetViewport(int x, int y, int width, int height) {
 void OpenGLRenderer::DrawTriangles(const Vector3f* vertices,
                                    const int* indices,
                                    int count) {
+  DrawTriangles(vertices, VertexAttributes(), indices, count);
+}
+
+void OpenGLRenderer::DrawTriangles(const Vector3f* vertices,
+                                   const VertexAttributes& attributes,
+                                   const int* indices,
+                                   int count) {
+  // Same coloring as the default fragment stage of RastaManRenderer: vertex
+  // colors, else normals mapped to colors, else flat face normals
   glBegin(GL_TRIANGLES);
   for (int i = 0; i < count; i += 3) {
     const Vector3f& v0 = vertices[indices[i]];
     const Vector3f& v1 = vertices[indices[i+1]];
     const Vector3f& v2 = vertices[indices[i+2]];
-    Vector3f normal = (v1 - v0).cross(v2 - v0).normalized();
-    normal = normal * .5f + Vector3f::Constant(.5f);
-    glColor3fv(normal.data());
-    glVertex3fv(v0.data());
-    glVertex3fv(v1.data());
-    glVertex3fv(v2.data());
+    if (!attributes.colors && !attributes.normals) {
+      Vector3f normal = (v1 - v0).cross(v2 - v0).normalized();
+      normal = normal * .5f + Vector3f::Constant(.5f);
+      glColor3fv(normal.data());
+    }
+    for (int j = 0; j < 3; ++j) {
+      const int index = indices[i+j];
+      if (attributes.colors) {
+        glColor4fv(attributes.colors + index*4);
+      } else if (attributes.normals) {
+        const Vector3f normal =
+          Vector3f::Map(attributes.normals + index*3).normalized();
+        glColor3fv((normal * .5f + Vector3f::Constant(.5f)).eval().data());
+      }
+      glVertex3fv(vertices[index].data());
+    }
   }
   glEnd();
 }
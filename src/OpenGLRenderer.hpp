@@ -18,6 +18,10 @@ class OpenGLRenderer : public IRenderer {
   void DrawTriangles(const Eigen::Vector3f* vertices,
                      const int* indices,
                      int count);
+  void DrawTriangles(const Eigen::Vector3f* vertices,
+                     const VertexAttributes& attributes,
+                     const int* indices,
+                     int count);
 };
 
 #endif
@@ -0,0 +1,127 @@
+#include "PerfCounters.hpp"
+
+#ifdef __linux__
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef __linux__
+struct EventConfig {
+  uint32_t type;
+  uint64_t config;
+};
+
+uint64_t GetCacheConfig(uint64_t cache) {
+  return cache | PERF_COUNT_HW_CACHE_OP_READ << 8
+    | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+}
+
+const EventConfig kEventConfigs[PERF_EVENT_COUNT] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { PERF_TYPE_HW_CACHE, GetCacheConfig(PERF_COUNT_HW_CACHE_L1D) },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { PERF_TYPE_HW_CACHE, GetCacheConfig(PERF_COUNT_HW_CACHE_DTLB) }
+};
+
+int OpenEvent(const EventConfig& event, int groupFd) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = event.type;
+  attr.config = event.config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+    | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // User space only, which perf_event_paranoid allows by default
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1,
+                                  groupFd, 0));
+}
+#endif
+}
+
+PerfCounters::PerfCounters()
+    : groupFd_(-1), groupSize_(0) {
+  for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+    fds_[i] = -1;
+    groupIndex_[i] = -1;
+  }
+#ifdef __linux__
+  // The first event that opens leads the group
+  for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+    fds_[i] = OpenEvent(kEventConfigs[i], groupFd_);
+    if (fds_[i] < 0) {
+      continue;
+    }
+    if (groupFd_ < 0) {
+      groupFd_ = fds_[i];
+    }
+    groupIndex_[i] = groupSize_++;
+  }
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+  // Members before the leader
+  for (int i = PERF_EVENT_COUNT - 1; i >= 0; --i) {
+    if (fds_[i] >= 0) {
+      close(fds_[i]);
+    }
+  }
+#endif
+}
+
+PerfCounters& PerfCounters::GetThreadCounters() {
+  thread_local PerfCounters counters;
+  return counters;
+}
+
+const char* PerfCounters::GetName(PerfEvent event) {
+  static const char* const kNames[PERF_EVENT_COUNT] = {
+    "cycles",
+    "instructions",
+    "l1d_misses",
+    "llc_misses",
+    "dtlb_misses"
+  };
+  return kNames[event];
+}
+
+bool PerfCounters::IsAvailable(PerfEvent event) const {
+  return groupIndex_[event] >= 0;
+}
+
+bool PerfCounters::IsAvailable() const {
+  return groupSize_ > 0;
+}
+
+PerfCounts PerfCounters::Read() const {
+  PerfCounts counts;
+#ifdef __linux__
+  if (!groupSize_) {
+    return counts;
+  }
+
+  // Event count, time enabled, time running and the counts in group order
+  uint64_t values[3 + PERF_EVENT_COUNT];
+  const ssize_t size = (3 + groupSize_) * sizeof(uint64_t);
+  if (read(groupFd_, values, size) != size || !values[2]) {
+    return counts;
+  }
+  const double scale = static_cast<double>(values[1]) / values[2];
+  for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+    if (groupIndex_[i] >= 0) {
+      const uint64_t value = values[3 + groupIndex_[i]];
+      counts.counts[i] = values[1] == values[2] ? value :
+        static_cast<uint64_t>(value * scale);
+    }
+  }
+#endif
+  return counts;
+}
@@ -0,0 +1,95 @@
+#ifndef PERFCOUNTERS_HPP
+#define PERFCOUNTERS_HPP
+
+#include "boost/noncopyable.hpp"
+
+#include <cstdint>
+
+// Hardware events counted in user space
+enum PerfEvent {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  // L1 data cache read misses
+  PERF_L1D_MISSES,
+  // Last level cache misses
+  PERF_LLC_MISSES,
+  // Data TLB read misses
+  PERF_DTLB_MISSES,
+  PERF_EVENT_COUNT
+};
+
+struct PerfCounts {
+  PerfCounts() {
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+      counts[i] = 0;
+    }
+  }
+
+  uint64_t& operator[](PerfEvent event) {
+    return counts[event];
+  }
+  uint64_t operator[](PerfEvent event) const {
+    return counts[event];
+  }
+
+  PerfCounts& operator+=(const PerfCounts& other) {
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+      counts[i] += other.counts[i];
+    }
+    return *this;
+  }
+
+  PerfCounts operator-(const PerfCounts& other) const {
+    PerfCounts difference;
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+      difference.counts[i] = counts[i] - other.counts[i];
+    }
+    return difference;
+  }
+
+  // Instructions per cycle, 0 without cycles
+  double GetIpc() const {
+    return counts[PERF_CYCLES] ? static_cast<double>(
+      counts[PERF_INSTRUCTIONS]) / counts[PERF_CYCLES] : 0.0;
+  }
+
+  uint64_t counts[PERF_EVENT_COUNT];
+};
+
+// Hardware performance counters of the calling thread, from Linux
+// perf_event_open.  The events are opened as one group, so that they count
+// the same instructions and ratios between them are exact.
+//
+// Events that the CPU, the kernel or perf_event_paranoid do not allow, as
+// well as all events on other platforms and in most virtual machines, are
+// unavailable and read as 0.
+class PerfCounters : public boost::noncopyable {
+ public:
+  // Starts counting
+  PerfCounters();
+  ~PerfCounters();
+
+  // Counters of the calling thread, opened on its first call and closed when
+  // it exits
+  static PerfCounters& GetThreadCounters();
+
+  // Name in snake case, for reports
+  static const char* GetName(PerfEvent event);
+
+  bool IsAvailable(PerfEvent event) const;
+  // Whether any event is available
+  bool IsAvailable() const;
+
+  // Counts since the counters were opened, scaled up while the kernel
+  // multiplexes them with other counters.  Costs a system call.
+  PerfCounts Read() const;
+
+ private:
+  int groupFd_;
+  int fds_[PERF_EVENT_COUNT];
+  // Position of every available event in a read of the group
+  int groupIndex_[PERF_EVENT_COUNT];
+  int groupSize_;
+};
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef PIXELFORMAT_HPP
+#define PIXELFORMAT_HPP
+
+#include "Eigen/Core"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// Storage formats of render surfaces.  Color formats hold normalized RGBA
+// values, depth formats a single value in [0, 1].
+enum PixelFormat {
+  PIXEL_RGBA32F,
+  PIXEL_RGBA16F,
+  PIXEL_RGB10A2,
+  PIXEL_RGBA8,
+  PIXEL_D32F,
+  PIXEL_D24,
+  PIXEL_D16
+};
+
+inline bool IsDepthFormat(PixelFormat format) {
+  return format >= PIXEL_D32F;
+}
+
+// Packed pixel types.  Their memory layout matches the OpenGL pixel transfer
+// formats GL_RGBA with GL_HALF_FLOAT, GL_UNSIGNED_INT_2_10_10_10_REV and
+// GL_UNSIGNED_BYTE, respectively.
+struct PixelRGBA16F { uint16_t c[4]; };
+struct PixelRGB10A2 { uint32_t bits; };
+struct PixelRGBA8 { uint8_t c[4]; };
+// 24-bit unsigned normalized depth in the low bits, upper 8 bits unused
+struct PixelD24 { uint32_t bits; };
+struct PixelD16 { uint16_t bits; };
+
+namespace detail {
+inline float Saturate(float f) {
+  // Also maps NaN to 0
+  return f > 0.0f ? std::min(f, 1.0f) : 0.0f;
+}
+
+inline uint32_t FloatBits(float f) {
+  uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+inline float BitsFloat(uint32_t bits) {
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+// IEEE 754 binary16 conversion with round to nearest even
+inline uint16_t FloatToHalf(float f) {
+  const uint32_t bits = FloatBits(f);
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const uint32_t magnitude = bits & 0x7fffffff;
+  if (magnitude >= 0x7f800000) {
+    // Infinity or NaN
+    return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+  }
+  if (magnitude >= 0x477ff000) {
+    // Rounds to a value beyond the largest half
+    return sign | 0x7c00;
+  }
+  if (magnitude < 0x38800000) {
+    // Denormal half.  Adding 0.5 aligns the mantissa so that the float
+    // addition performs the rounding.
+    const float denormal = BitsFloat(magnitude) + 0.5f;
+    return sign | (FloatBits(denormal) - FloatBits(0.5f));
+  }
+  const uint32_t odd = (magnitude >> 13) & 1;
+  return sign | ((magnitude - 0x38000000 + 0xfff + odd) >> 13);
+}
+
+inline float HalfToFloat(uint16_t h) {
+  const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+  if (exponent == 0) {
+    // Zero or denormal, exactly representable as mantissa * 2^-24
+    const float f = mantissa * (1.0f / (1 << 24));
+    return BitsFloat(sign | FloatBits(f));
+  }
+  if (exponent == 0x1f) {
+    return BitsFloat(sign | 0x7f800000 | mantissa << 13);
+  }
+  return BitsFloat(sign | (exponent + 112) << 23 | mantissa << 13);
+}
+
+inline uint32_t ToUnorm(float f, uint32_t max) {
+  return static_cast<uint32_t>(Saturate(f) * max + 0.5f);
+}
+
+// Largest normalized depth that decodes to at most f.  A decoded value may
+// be the float just below the exact quotient, so the product is rounded down
+// and then stepped up if the next depth still decodes to at most f.
+inline uint32_t ToDepthUnorm(float f, uint32_t max) {
+  const double saturated = Saturate(f);
+  const uint32_t bits = static_cast<uint32_t>(saturated * max);
+  return bits < max && static_cast<float>((bits + 1.0) / max) <= saturated
+    ? bits + 1 : bits;
+}
+}
+
+// Conversion between a pixel type and the value type the renderer works
+// with: Eigen::Vector4f for color and float for depth surfaces.
+template<typename Pixel>
+struct PixelTraits;
+
+template<>
+struct PixelTraits<Eigen::Vector4f> {
+  typedef Eigen::Vector4f ValueType;
+  static const PixelFormat kFormat = PIXEL_RGBA32F;
+  static Eigen::Vector4f Encode(const Eigen::Vector4f& value) {
+    return value;
+  }
+  static Eigen::Vector4f Decode(const Eigen::Vector4f& pixel) {
+    return pixel;
+  }
+};
+
+template<>
+struct PixelTraits<PixelRGBA16F> {
+  typedef Eigen::Vector4f ValueType;
+  static const PixelFormat kFormat = PIXEL_RGBA16F;
+  static PixelRGBA16F Encode(const Eigen::Vector4f& value) {
+    PixelRGBA16F pixel;
+    for (int i = 0; i < 4; ++i) {
+      pixel.c[i] = detail::FloatToHalf(value[i]);
+    }
+    return pixel;
+  }
+  static Eigen::Vector4f Decode(const PixelRGBA16F& pixel) {
+    return Eigen::Vector4f(
+      detail::HalfToFloat(pixel.c[0]), detail::HalfToFloat(pixel.c[1]),
+      detail::HalfToFloat(pixel.c[2]), detail::HalfToFloat(pixel.c[3]));
+  }
+};
+
+template<>
+struct PixelTraits<PixelRGB10A2> {
+  typedef Eigen::Vector4f ValueType;
+  static const PixelFormat kFormat = PIXEL_RGB10A2;
+  static PixelRGB10A2 Encode(const Eigen::Vector4f& value) {
+    PixelRGB10A2 pixel;
+    pixel.bits = detail::ToUnorm(value[0], 1023)
+      | detail::ToUnorm(value[1], 1023) << 10
+      | detail::ToUnorm(value[2], 1023) << 20
+      | detail::ToUnorm(value[3], 3) << 30;
+    return pixel;
+  }
+  static Eigen::Vector4f Decode(const PixelRGB10A2& pixel) {
+    return Eigen::Vector4f((pixel.bits & 0x3ff) / 1023.0f,
+                           (pixel.bits >> 10 & 0x3ff) / 1023.0f,
+                           (pixel.bits >> 20 & 0x3ff) / 1023.0f,
+                           (pixel.bits >> 30) / 3.0f);
+  }
+};
+
+template<>
+struct PixelTraits<PixelRGBA8> {
+  typedef Eigen::Vector4f ValueType;
+  static const PixelFormat kFormat = PIXEL_RGBA8;
+  static PixelRGBA8 Encode(const Eigen::Vector4f& value) {
+    PixelRGBA8 pixel;
+    for (int i = 0; i < 4; ++i) {
+      pixel.c[i] = static_cast<uint8_t>(detail::ToUnorm(value[i], 255));
+    }
+    return pixel;
+  }
+  static Eigen::Vector4f Decode(const PixelRGBA8& pixel) {
+    return Eigen::Vector4f(pixel.c[0], pixel.c[1], pixel.c[2], pixel.c[3])
+      / 255.0f;
+  }
+};
+
+template<>
+struct PixelTraits<float> {
+  typedef float ValueType;
+  static const PixelFormat kFormat = PIXEL_D32F;
+  static float Encode(float value) { return value; }
+  static float Decode(float pixel) { return pixel; }
+};
+
+// Normalized depth is rounded down, so a stored depth is never farther than
+// the depth written.  Conservative depth bounds such as the Hi-Z buffer stay
+// valid after a round trip, and decoded depths encode to the same bits.  The
+// products are exact in double.
+template<>
+struct PixelTraits<PixelD24> {
+  typedef float ValueType;
+  static const PixelFormat kFormat = PIXEL_D24;
+  static PixelD24 Encode(float value) {
+    PixelD24 pixel;
+    pixel.bits = detail::ToDepthUnorm(value, 16777215);
+    return pixel;
+  }
+  static float Decode(const PixelD24& pixel) {
+    return static_cast<float>(pixel.bits / 16777215.0);
+  }
+};
+
+template<>
+struct PixelTraits<PixelD16> {
+  typedef float ValueType;
+  static const PixelFormat kFormat = PIXEL_D16;
+  static PixelD16 Encode(float value) {
+    PixelD16 pixel;
+    pixel.bits = static_cast<uint16_t>(detail::ToDepthUnorm(value, 65535));
+    return pixel;
+  }
+  static float Decode(const PixelD16& pixel) {
+    return static_cast<float>(pixel.bits / 65535.0);
+  }
+};
+
+#endif
@@ -1,6 +1,10 @@
+#include "Mesh.hpp"
 #include "OpenGLRenderer.hpp"
+#include "PerfCounters.hpp"
 #include "RastaManRenderer.hpp"
 #include "Font.hpp"
+#include "Telemetry.hpp"
+#include "Trace.hpp"
 
 #include "Eigen/Geometry"
 
@@ -10,56 +14,18 @@
 #include <chrono>
 #include <cmath>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <sstream>
+#include <string>
 
 using namespace Eigen;
 
-void LoadSimpleObj(const char* filename,
-                   std::vector<Vector3f>& vertices,
-                   std::vector<int>& indices,
-                   Vector3f& min, Vector3f& max) {
-  std::ifstream ifs(filename);
-  std::string line;
-  while (std::getline(ifs, line)) {
-    if (line[0] == '#') continue;
-    std::stringstream ss(line);
-    std::string keyword;
-    ss >> keyword;
-    if (keyword == "v") {
-      Eigen::Vector3f vec;
-      ss >> vec.x() >> vec.y() >> vec.z();
-      if (vertices.empty()) {
-        min = max = vec;
-      } else {
-        min = min.cwiseMin(vec);
-        max = max.cwiseMax(vec);
-      }
-      vertices.push_back(vec);
-    } else if (keyword == "f") {
-      int idx[3];
-      for (int i = 0; i < 3; ++i) {
-        ss >> idx[i];
-        ss.ignore(1000, ' ');
-        indices.push_back(idx[i] - 1);
-      }
-      idx[1] = idx[2];
-      while (ss >> idx[2]) {
-        ss.ignore(1000, ' ');
-        indices.push_back(idx[0] - 1);
-        indices.push_back(idx[1] - 1);
-        indices.push_back(idx[2] - 1);
-        idx[1] = idx[2];
-      }
-    }
-  }
-}
-
 int width = 512;
 int height = 512;
 
-std::vector<Vector3f> vertices;
-std::vector<int> indices;
+Mesh mesh;
 
 Matrix4f projectionMatrix;
 Matrix4f modelMatrix;
@@ -70,8 +36,11 @@ Quaternionf rotation(Quaternionf::Identity());
 Vector3f translation(0.0f, 0.0f, -2.0f);
 
 std::shared_ptr<RenderTarget> rt;
+const PixelFormat kColorFormat = PIXEL_RGBA8;
+const PixelFormat kDepthFormat = PIXEL_D24;
 const int kRendererCount = 2;
 std::unique_ptr<IRenderer> renderers[kRendererCount];
+RastaManRenderer* rastaManRenderer = nullptr;
 
 std::chrono::high_resolution_clock::time_point lastFrameTime;
 std::unique_ptr<Font> font;
@@ -83,6 +52,16 @@ enum RenderMode {
 };
 
 RenderMode renderMode = RM_OPENGL;
+bool smoothShading = true;
+
+// Telemetry of frames and of draws per render mode, so that the modes don't
+// mix
+const char* const kFrameTelemetry[] = {
+  "frame.opengl", "frame.rastaman", "frame.difference"
+};
+const char* const kDrawTelemetry[] = {
+  "draw.opengl", "draw.rastaman", "draw.rastaman"
+};
 
 Matrix4f getPerspectiveMatrix(float fieldOfView, float aspect, float zNear,
                               float zFar) {
@@ -103,14 +82,22 @@ Matrix4f getOrthographicMatrix(float left, float right, float bottom, float top,
     0, 0, 0, 1).finished();
 }
 
+GLenum getPixelType(PixelFormat format) {
+  switch (format) {
+    case PIXEL_RGBA16F: return GL_HALF_FLOAT;
+    case PIXEL_RGB10A2: return GL_UNSIGNED_INT_2_10_10_10_REV;
+    case PIXEL_RGBA8: return GL_UNSIGNED_BYTE;
+    default: return GL_FLOAT;
+  }
+}
+
 void resize(GLFWwindow* window, int width, int height) {
   ::width = width;
   ::height = height;
   for (auto& renderer : renderers) {
     renderer->SetViewport(0, 0, width, height);
   }
-  rt.reset(new RenderTarget(width, height));
-  dynamic_cast<RastaManRenderer*>(renderers[1].get())->SetRenderTarget(rt);
+  rt->Resize(width, height);
 
   const auto aspect = static_cast<float>(width)/height;
   projectionMatrix = getPerspectiveMatrix(60.0f, aspect, 0.1f, 100.0f);
@@ -154,6 +141,9 @@ void special(GLFWwindow* window, int key, int scancode, int action, int mods) {
     case GLFW_KEY_X:
       renderMode = RM_DIFFERENCE;
       break;
+    case GLFW_KEY_F:
+      smoothShading = !smoothShading;
+      break;
     case GLFW_KEY_W:
       translation.y() += 0.0625f;
       break;
@@ -166,6 +156,17 @@ void special(GLFWwindow* window, int key, int scancode, int action, int mods) {
     case GLFW_KEY_D:
       translation.x() += 0.0625f;
       break;
+    case GLFW_KEY_C:
+      rastaManRenderer->SetPerfCountersEnabled(
+        !rastaManRenderer->IsPerfCountersEnabled());
+      rastaManRenderer->ResetPerfCounts();
+      break;
+    case GLFW_KEY_T:
+      // Timeline of the last frames, for chrome://tracing
+      if (!Tracer::GetDefault().Write("RastaMan.json")) {
+        std::cerr << "Error writing RastaMan.json" << std::endl;
+      }
+      break;
   }
 }
 
@@ -181,15 +182,37 @@ void drawScene(IRenderer* renderer) {
   renderer->Clear(clearColor);
   renderer->SetProjectionMatrix(projectionMatrix);
   renderer->SetModelViewMatrix(modelViewMatrix);
-  renderer->DrawTriangles(&vertices[0], &indices[0], indices.size());
+  VertexAttributes attributes;
+  if (smoothShading) {
+    attributes.normals = mesh.GetAttribute(MESH_NORMAL);
+  }
+  renderer->DrawTriangles(mesh.GetVertices(), attributes, mesh.GetIndices(),
+                          mesh.GetIndexCount());
+}
+
+std::string formatMilliseconds(uint64_t micros) {
+  std::ostringstream ss;
+  ss << std::fixed << std::setprecision(2) << micros / 1000.0;
+  return ss.str();
+}
+
+void writePercentiles(std::ostream& os, const LatencyHistogram& histogram) {
+  os << "p50 " << formatMilliseconds(histogram.GetPercentile(50.0))
+     << " p99 " << formatMilliseconds(histogram.GetPercentile(99.0))
+     << " p99.9 " << formatMilliseconds(histogram.GetPercentile(99.9))
+     << " ms";
 }
 
 void drawOverlay(GLFWwindow* window) {
+  // Frames are timed from one overlay to the next, and include the overlay
+  // and the buffer swap
   const auto now = std::chrono::high_resolution_clock::now();
-  const auto elapsedMillis =
-    std::chrono::duration_cast<std::chrono::milliseconds>(now - lastFrameTime)
+  const auto elapsedMicros =
+    std::chrono::duration_cast<std::chrono::microseconds>(now - lastFrameTime)
     .count();
   lastFrameTime = now;
+  Telemetry& telemetry = Telemetry::GetDefault();
+  telemetry.Record(kFrameTelemetry[renderMode], elapsedMicros);
 
   std::stringstream ss;
   switch (renderMode) {
@@ -197,13 +220,40 @@ void drawOverlay(GLFWwindow* window) {
     case RM_RASTAMAN: ss << "RastaMan"; break;
     case RM_DIFFERENCE: ss << "Diff"; break;
   }
-  ss << " " << elapsedMillis << "ms";
+  ss << " draw ";
+  writePercentiles(ss, telemetry.GetHistogram(kDrawTelemetry[renderMode]));
 
   glDisable(GL_DEPTH_TEST);
   glColor3f(1.0f, 1.0f, 1.0f);
   int y = height;
   font->Draw(ss.str().c_str(), 0, y -= font->GetLineHeight());
 
+  ss.str("");
+  ss << "Frame " << formatMilliseconds(elapsedMicros) << " ms, ";
+  writePercentiles(ss, telemetry.GetHistogram(kFrameTelemetry[renderMode]));
+  font->Draw(ss.str().c_str(), 0, y -= font->GetLineHeight());
+
+  // Hardware counters of the frame per stage, in thousands
+  if (rastaManRenderer->IsPerfCountersEnabled()) {
+    if (!PerfCounters::GetThreadCounters().IsAvailable()) {
+      font->Draw("No hardware counters", 0, y -= font->GetLineHeight());
+    }
+    for (int i = 0; i < STAGE_COUNT && renderMode != RM_OPENGL &&
+         PerfCounters::GetThreadCounters().IsAvailable(); ++i) {
+      const PipelineStage stage = static_cast<PipelineStage>(i);
+      const PerfCounts counts = rastaManRenderer->GetPerfCounts(stage);
+      ss.str("");
+      ss << RastaManRenderer::GetStageName(stage)
+         << ": IPC " << counts.GetIpc()
+         << ", cycles " << counts[PERF_CYCLES] / 1000
+         << "k, L1D " << counts[PERF_L1D_MISSES] / 1000
+         << "k, LLC " << counts[PERF_LLC_MISSES] / 1000
+         << "k, dTLB " << counts[PERF_DTLB_MISSES] / 1000 << "k";
+      font->Draw(ss.str().c_str(), 0, y -= font->GetLineHeight());
+    }
+    rastaManRenderer->ResetPerfCounts();
+  }
+
   Vector2d mouse;
   glfwGetCursorPos(window, &mouse.x(), &mouse.y());
   if (mouse.x() < 0 || mouse.x() >= width || mouse.y() < 0 || mouse.y() >= height) {
@@ -214,12 +264,12 @@ void drawOverlay(GLFWwindow* window) {
   ss << "Position: (" << mouse << ")";
   font->Draw(ss.str().c_str(), 0, y -= font->GetLineHeight());
   
-  const auto color = (*rt->GetBackBuffer())(mouse.x(), mouse.y());
+  const auto color = rt->GetBackBuffer()->ReadValue(mouse.x(), mouse.y());
   ss.str("");
   ss << "Color: (" << color << ")";
   font->Draw(ss.str().c_str(), 0, y -= font->GetLineHeight());
 
-  const auto z = (*rt->GetZBuffer())(mouse.x(), mouse.y());
+  const auto z = rt->GetZBuffer()->ReadValue(mouse.x(), mouse.y());
   ss.str("");
   ss << "Depth: " << z;
   font->Draw(ss.str().c_str(), 0, y -= font->GetLineHeight());
@@ -230,6 +280,8 @@ void render(GLFWwindow* window) {
 
   if (renderMode == RM_OPENGL || renderMode == RM_DIFFERENCE) {
     glEnable(GL_DEPTH_TEST);
+    // Only the submission, as OpenGL draws asynchronously
+    TelemetryScope telemetry(kDrawTelemetry[RM_OPENGL]);
     drawScene(renderers[0].get());
   }
 
@@ -240,7 +292,10 @@ void render(GLFWwindow* window) {
   glLoadIdentity();
 
   if (renderMode == RM_RASTAMAN || renderMode == RM_DIFFERENCE) {
-    drawScene(renderers[1].get());
+    {
+      TelemetryScope telemetry(kDrawTelemetry[RM_RASTAMAN]);
+      drawScene(renderers[1].get());
+    }
 
     glRasterPos2f(-1.f, 1.f);
     glPixelZoom(1.f, -1.f);
@@ -248,10 +303,12 @@ void render(GLFWwindow* window) {
       glLogicOp(GL_XOR);
       glEnable(GL_COLOR_LOGIC_OP);
     }
-    glDrawPixels(rt->GetBackBuffer()->GetWidth(),
-                 rt->GetBackBuffer()->GetHeight(), GL_RGBA, GL_FLOAT,
-                 reinterpret_cast<const GLvoid*>(
-                   rt->GetBackBuffer()->GetPixels()));
+    TraceScope scope("Present");
+    TelemetryScope telemetry("present");
+    const auto backBuffer = rt->GetBackBuffer();
+    glDrawPixels(backBuffer->GetWidth(), backBuffer->GetHeight(), GL_RGBA,
+                 getPixelType(backBuffer->GetFormat()),
+                 reinterpret_cast<const GLvoid*>(backBuffer->GetData()));
     glDisable(GL_COLOR_LOGIC_OP);
   }
 
@@ -275,10 +332,14 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
-  Vector3f min, max;
-  LoadSimpleObj(argv[1], vertices, indices, min, max);
-  std::cout << vertices.size() << " vertices, "
-            << indices.size()/3 << " faces" << std::endl;
+  if (!mesh.Load(argv[1])) {
+    std::cerr << "Error reading " << argv[1] << std::endl;
+    return 1;
+  }
+  const Vector3f& min = mesh.GetMin();
+  const Vector3f& max = mesh.GetMax();
+  std::cout << mesh.GetVertexCount() << " vertices, "
+            << mesh.GetIndexCount()/3 << " faces" << std::endl;
   std::cout << "Bounds: (" << min.x() << " " << min.y() << " " << min.z()
             << ")-(" << max.x() << " " << max.y() << " " << max.z() << ")"
             << std::endl;
@@ -290,8 +351,9 @@ int main(int argc, char* argv[]) {
 
   renderers[0].reset(new OpenGLRenderer());
 
-  rt.reset(new RenderTarget(width, height));
-  renderers[1].reset(new RastaManRenderer(rt));
+  rt.reset(new RenderTarget(width, height, kColorFormat, kDepthFormat));
+  rastaManRenderer = new RastaManRenderer(rt);
+  renderers[1].reset(rastaManRenderer);
 
   if (!glfwInit()) {
     std::cerr << "Error initializing GLEW" << std::endl;
@@ -327,15 +389,30 @@ int main(int argc, char* argv[]) {
 
   bool running = true;
 
+  // Tracing is always on, so that the frames before a spike can be dumped
+  Tracer::GetDefault().SetThreadName("Main");
+  Tracer::GetDefault().SetEnabled(true);
+  Telemetry::GetDefault().SetEnabled(true);
+  lastFrameTime = std::chrono::high_resolution_clock::now();
+
   while (!glfwWindowShouldClose(window)) {
+    TraceScope scope("Frame");
     update();
     render(window);
-    glfwSwapBuffers(window);
+    {
+      TraceScope swapScope("SwapBuffers");
+      glfwSwapBuffers(window);
+    }
     glfwPollEvents();
   }
 
   glfwTerminate();
 
+  Telemetry::GetDefault().WriteSummary(std::cout);
+  if (!Telemetry::GetDefault().Write("RastaMan.telemetry.json")) {
+    std::cerr << "Error writing RastaMan.telemetry.json" << std::endl;
+  }
+
   //std::ofstream ofs("image.ppm");
   //ofs << "P6\n";
   //ofs << surface->GetWidth() << " " << surface->GetHeight() << "\n";
@@ -0,0 +1,482 @@
+#include "CpuDispatch.hpp"
+#include "PerfCounters.hpp"
+#include "RastaManRenderer.hpp"
+#include "RenderTarget.hpp"
+#include "Simd.hpp"
+
+#include "Eigen/Geometry"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Eigen;
+
+// Microbenchmarks of the pipeline stages and full-frame benchmarks of
+// synthetic meshes, without any window system.  Every benchmark is run in
+// samples of enough iterations to last a minimum time, and the median time
+// per iteration of several samples is reported as one JSON object per line.
+
+namespace {
+void PrintUsage() {
+  std::cerr
+    << "Usage: RastaManBench [options]\n"
+    << "  -b <filter>    Only run benchmarks whose name contains filter\n"
+    << "  -t <seconds>   Minimum duration of a sample (default 0.05)\n"
+    << "  -r <samples>   Samples per benchmark (default 5)\n"
+    << "  -l             List the benchmarks without running them\n"
+    << "  -c             Add hardware counters per iteration of one more"
+    << " sample,\n"
+    << "                 of the calling thread and of the pipeline stages\n"
+    << "  -i <isa>       Force the kernels of baseline, sse4.2, avx2 or"
+    << " avx512\n"
+    << "                 (default best supported, or RASTAMAN_ISA)\n";
+}
+
+struct Benchmark {
+  std::string name;
+  // What an operation is, e.g. pixels
+  std::string unit;
+  double operationsPerIteration;
+  std::function<void()> iteration;
+};
+
+// Indexed triangle mesh with vertex normals
+struct SyntheticMesh {
+  std::string name;
+  std::vector<Vector3f> vertices;
+  std::vector<float> normals;
+  std::vector<int> indices;
+};
+
+// Grid of rings x segments quads mapped onto a surface
+template<typename Surface>
+SyntheticMesh CreateGridMesh(const std::string& name, int rings,
+                             int segments, Surface surface) {
+  SyntheticMesh mesh;
+  mesh.name = name;
+  for (int i = 0; i <= rings; ++i) {
+    for (int j = 0; j <= segments; ++j) {
+      Vector3f position, normal;
+      surface(static_cast<float>(i) / rings, static_cast<float>(j) / segments,
+              &position, &normal);
+      mesh.vertices.push_back(position);
+      mesh.normals.insert(mesh.normals.end(), normal.data(), normal.data() + 3);
+    }
+  }
+  for (int i = 0; i < rings; ++i) {
+    for (int j = 0; j < segments; ++j) {
+      const int v00 = i*(segments + 1) + j;
+      const int v01 = v00 + 1;
+      const int v10 = v00 + segments + 1;
+      const int v11 = v10 + 1;
+      const int quad[6] = { v00, v01, v11, v00, v11, v10 };
+      mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+    }
+  }
+  return mesh;
+}
+
+const float kPi = 3.14159265f;
+
+SyntheticMesh CreateTorus(int rings, int segments) {
+  std::ostringstream name;
+  name << "torus" << rings*segments*2;
+  return CreateGridMesh(name.str(), rings, segments,
+      [] (float u, float v, Vector3f* position, Vector3f* normal) {
+    const float theta = 2*kPi*u;
+    const float phi = 2*kPi*v;
+    const Vector3f ring(std::cos(theta), std::sin(theta), 0.0f);
+    *normal = ring*std::cos(phi) + Vector3f::UnitZ()*std::sin(phi);
+    *position = ring + *normal * .4f;
+  });
+}
+
+SyntheticMesh CreateSphere(int rings, int segments) {
+  std::ostringstream name;
+  name << "sphere" << rings*segments*2;
+  return CreateGridMesh(name.str(), rings, segments,
+      [] (float u, float v, Vector3f* position, Vector3f* normal) {
+    const float theta = kPi*u;
+    const float phi = 2*kPi*v;
+    *normal = Vector3f(std::sin(theta)*std::cos(phi),
+                       std::sin(theta)*std::sin(phi), std::cos(theta));
+    *position = *normal;
+  });
+}
+
+Matrix4f GetPerspectiveMatrix(float fieldOfView, float aspect, float zNear,
+                              float zFar) {
+  const float f = 1.f/std::tan(fieldOfView/180.f * kPi * .5f);
+  return (Matrix4f() <<
+    f/aspect, 0, 0, 0,
+    0, f, 0, 0,
+    0, 0, (zFar + zNear)/(zNear - zFar), 2*zFar*zNear/(zNear - zFar),
+    0, 0, -1, 0).finished();
+}
+
+// Maps pixel coordinates with y pointing down to clip space
+Matrix4f GetPixelMatrix(int width, int height) {
+  return (Matrix4f() <<
+    2.0f/width, 0, 0, -1,
+    0, -2.0f/height, 0, 1,
+    0, 0, 1, 0,
+    0, 0, 0, 1).finished();
+}
+
+std::string GetSizeName(int width, int height) {
+  std::ostringstream name;
+  name << width << "x" << height;
+  return name.str();
+}
+
+// Exposes the stages of the pipeline
+class BenchRenderer : public RastaManRenderer {
+ public:
+  using RastaManRenderer::RastaManRenderer;
+  using RastaManRenderer::TransformedVertex;
+  using RastaManRenderer::TriangleSetup;
+  using RastaManRenderer::TransformVertices;
+  using RastaManRenderer::SetupTriangle;
+};
+
+typedef std::vector<BenchRenderer::TransformedVertex,
+                    aligned_allocator<BenchRenderer::TransformedVertex>>
+  TransformedVertices;
+
+// Render target, transforms and state of a benchmark.  All benchmarks share
+// one renderer, and with it one thread pool, and bind their view in every
+// iteration.
+struct View {
+  void Bind(RastaManRenderer* renderer) const {
+    const auto surface = renderTarget->GetBackBuffer();
+    renderer->SetRenderTarget(renderTarget);
+    renderer->SetViewport(0, 0, surface->GetWidth(), surface->GetHeight());
+    renderer->SetProjectionMatrix(projectionMatrix);
+    renderer->SetModelViewMatrix(modelViewMatrix);
+    renderer->SetPipelineState(state);
+  }
+
+  std::shared_ptr<RenderTarget> renderTarget;
+  Matrix4f projectionMatrix;
+  Matrix4f modelViewMatrix;
+  PipelineState state;
+};
+
+View CreatePerspectiveView(std::shared_ptr<RenderTarget> renderTarget) {
+  const auto surface = renderTarget->GetBackBuffer();
+  View view;
+  view.renderTarget = renderTarget;
+  view.projectionMatrix = GetPerspectiveMatrix(
+    60.0f, static_cast<float>(surface->GetWidth())/surface->GetHeight(),
+    0.1f, 100.0f);
+  view.modelViewMatrix = Affine3f(Translation3f(0.0f, 0.0f, -2.0f)).matrix();
+  return view;
+}
+
+// Benchmarks keep their state in shared pointers captured by the iteration
+std::vector<Benchmark> CreateBenchmarks(
+    const std::shared_ptr<BenchRenderer>& renderer) {
+  std::vector<Benchmark> benchmarks;
+  const auto torus = std::make_shared<SyntheticMesh>(CreateTorus(128, 256));
+  const auto sphere = std::make_shared<SyntheticMesh>(CreateSphere(256, 512));
+  const Vector2i sizes[] = {
+    Vector2i(256, 256), Vector2i(512, 512), Vector2i(1024, 1024),
+    Vector2i(1920, 1080)
+  };
+  std::vector<std::shared_ptr<RenderTarget>> renderTargets;
+  for (const Vector2i& size : sizes) {
+    renderTargets.push_back(std::make_shared<RenderTarget>(
+      size.x(), size.y(), PIXEL_RGBA8, PIXEL_D24));
+  }
+
+  // Stage microbenchmarks on the sphere, which fills a 512x512 viewport
+  {
+    const View view = CreatePerspectiveView(renderTargets[1]);
+    const int vertexCount = static_cast<int>(sphere->vertices.size());
+    const auto vertices = std::make_shared<TransformedVertices>(vertexCount);
+    view.Bind(renderer.get());
+    renderer->TransformVertices(&sphere->vertices[0], vertexCount,
+                                &(*vertices)[0]);
+    benchmarks.push_back(Benchmark {
+      "vertex/transform", "vertices", static_cast<double>(vertexCount),
+      [=] () {
+        view.Bind(renderer.get());
+        renderer->TransformVertices(&sphere->vertices[0], vertexCount,
+                                    &(*vertices)[0]);
+      }
+    });
+
+    const int triangleCount = static_cast<int>(sphere->indices.size()) / 3;
+    benchmarks.push_back(Benchmark {
+      "setup/triangles", "triangles", static_cast<double>(triangleCount),
+      [=] () {
+        view.Bind(renderer.get());
+        const int* indices = &sphere->indices[0];
+        BenchRenderer::TriangleSetup setup;
+        for (int i = 0; i < triangleCount*3; i += 3) {
+          renderer->SetupTriangle((*vertices)[indices[i]],
+                                  (*vertices)[indices[i+1]],
+                                  (*vertices)[indices[i+2]],
+                                  nullptr, &setup, nullptr);
+        }
+      }
+    });
+  }
+
+  // Fill rate of right triangles with legs of size pixels at random
+  // positions, with flat colors and without depth buffering.  Operations
+  // are the nominal areas.
+  View fillView;
+  fillView.renderTarget = renderTargets[1];
+  fillView.projectionMatrix = GetPixelMatrix(512, 512);
+  fillView.modelViewMatrix = Matrix4f::Identity();
+  fillView.state.depthTest = false;
+  fillView.state.depthWrite = false;
+  fillView.state.cullMode = CULL_NONE;
+  const int fillSizes[] = { 2, 8, 32, 128 };
+  for (int size : fillSizes) {
+    // About a million pixels per iteration
+    const float area = .5f * size * size;
+    const int triangleCount = std::max(static_cast<int>((1 << 20) / area), 1);
+    const auto triangles = std::make_shared<SyntheticMesh>();
+    std::mt19937 random(size);
+    std::uniform_real_distribution<float> position(
+      0.0f, static_cast<float>(512 - size));
+    for (int i = 0; i < triangleCount; ++i) {
+      const Vector3f corner(position(random), position(random), 0.0f);
+      const float legSize = static_cast<float>(size);
+      triangles->vertices.push_back(corner);
+      triangles->vertices.push_back(corner + Vector3f(legSize, 0.0f, 0.0f));
+      triangles->vertices.push_back(corner + Vector3f(0.0f, legSize, 0.0f));
+      for (int j = 0; j < 3; ++j) {
+        triangles->indices.push_back(i*3 + j);
+      }
+    }
+    std::ostringstream name;
+    name << "fill/" << size << "px";
+    benchmarks.push_back(Benchmark {
+      name.str(), "pixels", area * triangleCount,
+      [=] () {
+        fillView.Bind(renderer.get());
+        renderer->DrawTriangles(&triangles->vertices[0],
+                                &triangles->indices[0], triangleCount*3);
+      }
+    });
+  }
+
+  // Clearing only records the clear value.  Presenting reads the back
+  // buffer for display, which applies pending clears.
+  const float clearColor[4] = { 0, 0, 0, 0 };
+  for (const auto& renderTarget : renderTargets) {
+    const View view = CreatePerspectiveView(renderTarget);
+    const auto surface = renderTarget->GetBackBuffer();
+    const std::string sizeName =
+      GetSizeName(surface->GetWidth(), surface->GetHeight());
+    const double pixels =
+      static_cast<double>(surface->GetWidth()) * surface->GetHeight();
+    benchmarks.push_back(Benchmark {
+      "clear/" + sizeName, "pixels", pixels,
+      [=] () {
+        view.Bind(renderer.get());
+        renderer->Clear(clearColor);
+      }
+    });
+    benchmarks.push_back(Benchmark {
+      "present/" + sizeName, "pixels", pixels,
+      [=] () {
+        view.Bind(renderer.get());
+        renderer->Clear(clearColor);
+        surface->GetData();
+      }
+    });
+  }
+
+  // Smoothly shaded frames of a unit-sized mesh, cycling through the same
+  // eight views
+  for (const auto& mesh : { torus, sphere }) {
+    for (const auto& renderTarget : renderTargets) {
+      const View view = CreatePerspectiveView(renderTarget);
+      const auto surface = renderTarget->GetBackBuffer();
+      VertexAttributes attributes;
+      attributes.normals = &mesh->normals[0];
+      const auto frame = std::make_shared<int>(0);
+      benchmarks.push_back(Benchmark {
+        "frame/" + mesh->name + "/"
+          + GetSizeName(surface->GetWidth(), surface->GetHeight()),
+        "frames", 1.0,
+        [=] () {
+          view.Bind(renderer.get());
+          Affine3f modelTransform;
+          modelTransform =
+            AngleAxisf(2*kPi * ((*frame)++ % 8) / 8, Vector3f::UnitY())
+            * AngleAxisf(-.25f*kPi, Vector3f::UnitX()) * Scaling(.35f);
+          renderer->SetModelViewMatrix(
+            view.modelViewMatrix * modelTransform.matrix());
+          renderer->Clear(clearColor);
+          renderer->DrawTriangles(&mesh->vertices[0], attributes,
+                                  &mesh->indices[0],
+                                  static_cast<int>(mesh->indices.size()));
+        }
+      });
+    }
+  }
+  return benchmarks;
+}
+
+double TimeIterations(const Benchmark& benchmark, long long iterations) {
+  const auto start = std::chrono::steady_clock::now();
+  for (long long i = 0; i < iterations; ++i) {
+    benchmark.iteration();
+  }
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+// JSON object of the available events and the instructions per cycle
+void WritePerfCounts(const PerfCounts& counts, long long iterations) {
+  const PerfCounters& counters = PerfCounters::GetThreadCounters();
+  const char* separator = "";
+  std::cout << "{";
+  for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+    const PerfEvent event = static_cast<PerfEvent>(i);
+    if (counters.IsAvailable(event)) {
+      std::cout << separator << "\"" << PerfCounters::GetName(event) << "\":"
+                << static_cast<double>(counts[event]) / iterations;
+      separator = ",";
+    }
+  }
+  if (counters.IsAvailable(PERF_CYCLES) &&
+      counters.IsAvailable(PERF_INSTRUCTIONS)) {
+    std::cout << separator << "\"ipc\":" << counts.GetIpc();
+  }
+  std::cout << "}";
+}
+}
+
+int main(int argc, char* argv[]) {
+  const char* filter = "";
+  double minTime = 0.05;
+  int sampleCount = 5;
+  bool list = false;
+  bool perfCounters = false;
+  for (int i = 1; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "-b") && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (!std::strcmp(argv[i], "-t") && i + 1 < argc) {
+      minTime = std::atof(argv[++i]);
+    } else if (!std::strcmp(argv[i], "-r") && i + 1 < argc) {
+      sampleCount = std::atoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "-l")) {
+      list = true;
+    } else if (!std::strcmp(argv[i], "-c")) {
+      perfCounters = true;
+    } else if (!std::strcmp(argv[i], "-i") && i + 1 < argc) {
+      CpuIsa isa;
+      if (!ParseIsa(argv[++i], &isa)) {
+        PrintUsage();
+        return 1;
+      }
+      if (!SetCpuIsa(isa)) {
+        std::cerr << argv[i] << " is not supported, the best is "
+                  << GetIsaName(GetSupportedIsa()) << std::endl;
+        return 1;
+      }
+    } else {
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (minTime <= 0 || sampleCount <= 0) {
+    PrintUsage();
+    return 1;
+  }
+
+  const auto renderer = std::make_shared<BenchRenderer>(
+    std::make_shared<RenderTarget>(1, 1, PIXEL_RGBA8, PIXEL_D24));
+  const std::vector<Benchmark> benchmarks = CreateBenchmarks(renderer);
+  if (list) {
+    for (const auto& benchmark : benchmarks) {
+      std::cout << benchmark.name << std::endl;
+    }
+    return 0;
+  }
+
+  std::cout << "{\"context\":{\"simd_width\":" << kSimdWidth
+            << ",\"isa\":\"" << GetIsaName(GetCpuKernels().isa) << "\""
+            << ",\"threads\":" << std::thread::hardware_concurrency()
+            << ",\"min_time\":" << minTime
+            << ",\"samples\":" << sampleCount;
+  if (perfCounters) {
+    std::cout << ",\"perf_counters\":"
+              << (PerfCounters::GetThreadCounters().IsAvailable() ? "true"
+                                                                 : "false");
+  }
+  std::cout << "}}" << std::endl;
+  for (const auto& benchmark : benchmarks) {
+    if (benchmark.name.find(filter) == std::string::npos) {
+      continue;
+    }
+
+    // Warm up, then grow the iterations until a sample lasts long enough
+    benchmark.iteration();
+    long long iterations = 1;
+    for (;;) {
+      const double seconds = TimeIterations(benchmark, iterations);
+      if (seconds >= minTime) {
+        break;
+      }
+      const double scale = seconds > 0 ? 1.2 * minTime / seconds : 10.0;
+      iterations = std::max(iterations + 1, static_cast<long long>(
+        iterations * std::min(scale, 10.0)));
+    }
+
+    std::vector<double> samples(sampleCount);
+    for (auto& sample : samples) {
+      sample = TimeIterations(benchmark, iterations) / iterations;
+    }
+    std::sort(samples.begin(), samples.end());
+    const double median = samples[sampleCount / 2];
+    std::cout << "{\"name\":\"" << benchmark.name << "\""
+              << ",\"unit\":\"" << benchmark.unit << "\""
+              << ",\"iterations\":" << iterations
+              << ",\"median_ns\":" << median * 1e9
+              << ",\"min_ns\":" << samples.front() * 1e9
+              << ",\"max_ns\":" << samples.back() * 1e9
+              << ",\"rate\":" << benchmark.operationsPerIteration / median;
+    if (perfCounters && PerfCounters::GetThreadCounters().IsAvailable()) {
+      // The calling thread's counts include its share of the stage tasks
+      renderer->ResetPerfCounts();
+      renderer->SetPerfCountersEnabled(true);
+      const PerfCounts begin = PerfCounters::GetThreadCounters().Read();
+      TimeIterations(benchmark, iterations);
+      const PerfCounts caller =
+        PerfCounters::GetThreadCounters().Read() - begin;
+      renderer->SetPerfCountersEnabled(false);
+      std::cout << ",\"counters\":{\"caller\":";
+      WritePerfCounts(caller, iterations);
+      for (int i = 0; i < STAGE_COUNT; ++i) {
+        const PipelineStage stage = static_cast<PipelineStage>(i);
+        const PerfCounts counts = renderer->GetPerfCounts(stage);
+        if (counts[PERF_CYCLES] || counts[PERF_INSTRUCTIONS]) {
+          std::cout << ",\"" << RastaManRenderer::GetStageName(stage)
+                    << "\":";
+          WritePerfCounts(counts, iterations);
+        }
+      }
+      std::cout << "}";
+    }
+    std::cout << "}" << std::endl;
+  }
+  return 0;
+}
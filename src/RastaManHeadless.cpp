@@ -0,0 +1,460 @@
+#include "CpuDispatch.hpp"
+#include "Mesh.hpp"
+#include "PerfCounters.hpp"
+#include "RastaManRenderer.hpp"
+#include "RenderTarget.hpp"
+#include "Telemetry.hpp"
+#include "Texture.hpp"
+#include "Trace.hpp"
+
+#include "Eigen/Geometry"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+using namespace Eigen;
+
+// Renders a model from a camera orbiting it, without any window system, and
+// reports the frame rate.
+
+namespace {
+void PrintUsage() {
+  std::cerr
+    << "Usage: RastaManHeadless [options] <model.obj>\n"
+    << "  -s <width>x<height>  Image size (default 512x512)\n"
+    << "  -n <frames>          Frames in one orbit around the model"
+    << " (default 60)\n"
+    << "  -o <prefix>          Write frame i to <prefix><i>.ppm\n"
+    << "  -f                   Flat shading instead of vertex normals\n"
+    << "  -l                   Diffuse lighting with custom shaders\n"
+    << "  -t                   Diffuse lighting of a mipmapped checkerboard\n"
+    << "  -q <boxes>           Cull boxes around the model against it as an"
+    << " occluder\n"
+    << "  -p                   Count pipeline statistics and hardware"
+    << " counters, per frame\n"
+    << "  -j <file>            Write a timeline of the last frames as a"
+    << " Chrome trace\n"
+    << "  -m <file>            Write histograms of frame and stage times,"
+    << " and print\n"
+    << "                       their percentiles\n"
+    << "  -i <isa>             Force the kernels of baseline, sse4.2, avx2"
+    << " or avx512\n"
+    << "                       (default best supported, or RASTAMAN_ISA)\n";
+}
+
+enum ShadingMode {
+  SHADING_FLAT,
+  SHADING_SMOOTH,
+  SHADING_LIT,
+  SHADING_TEXTURED
+};
+
+// Diffuse lighting from a light at the camera, as an example of shaders
+struct LitVertexShader {
+  static const int kVaryingCount = 3;
+
+  Vector4f operator()(int index, float* varyings) const {
+    // Eye-space normal
+    Vector3f::Map(varyings) = normalMatrix * Vector3f::Map(normals + index*3);
+    return modelViewProjection
+      * (Vector4f() << positions[index], 1.0f).finished();
+  }
+
+  Matrix4f modelViewProjection;
+  Matrix3f normalMatrix;
+  const Vector3f* positions;
+  const float* normals;
+};
+
+struct LitFragmentShader {
+  void operator()(const FragmentQuad& quad, Vector4f* colors) const {
+    for (int i = 0; i < 4; ++i) {
+      const Vector3f normal(quad.varyings[0][i], quad.varyings[1][i],
+                            quad.varyings[2][i]);
+      const float diffuse = std::max(normal.normalized().z(), 0.0f);
+      colors[i] << (ambient + diffuse*(1.0f - ambient)) * albedo, 1.0f;
+    }
+  }
+
+  Vector3f albedo;
+  float ambient;
+};
+
+// Adds texture coordinates from a planar projection of the positions
+struct TexturedVertexShader : LitVertexShader {
+  static const int kVaryingCount = 5;
+
+  Vector4f operator()(int index, float* varyings) const {
+    Vector2f::Map(varyings + 3) =
+      (positions[index] - texCoordOrigin).head<2>() * texCoordScale;
+    return LitVertexShader::operator()(index, varyings);
+  }
+
+  Vector3f texCoordOrigin;
+  float texCoordScale;
+};
+
+struct TexturedFragmentShader {
+  void operator()(const FragmentQuad& quad, Vector4f* colors) const {
+    texture->SampleQuad(quad, 3, colors);
+    for (int i = 0; i < 4; ++i) {
+      const Vector3f normal(quad.varyings[0][i], quad.varyings[1][i],
+                            quad.varyings[2][i]);
+      const float diffuse = std::max(normal.normalized().z(), 0.0f);
+      colors[i].head<3>() *= ambient + diffuse*(1.0f - ambient);
+    }
+  }
+
+  const Texture* texture;
+  float ambient;
+};
+
+std::unique_ptr<Texture> CreateCheckerboard(int size, int squareSize) {
+  std::vector<PixelRGBA8> texels(size*size);
+  for (int y = 0; y < size; ++y) {
+    for (int x = 0; x < size; ++x) {
+      const bool dark = ((x / squareSize) ^ (y / squareSize)) & 1;
+      texels[y*size + x] = PixelTraits<PixelRGBA8>::Encode(dark ?
+        Vector4f(0.2f, 0.3f, 0.6f, 1.0f) : Vector4f(1.0f, 0.9f, 0.7f, 1.0f));
+    }
+  }
+  return std::unique_ptr<Texture>(new Texture(size, size, &texels[0]));
+}
+
+Matrix4f GetPerspectiveMatrix(float fieldOfView, float aspect, float zNear,
+                              float zFar) {
+  const float f = 1.f/std::tan(fieldOfView/180.f * 3.14159265f * .5f);
+  return (Matrix4f() <<
+    f/aspect, 0, 0, 0,
+    0, f, 0, 0,
+    0, 0, (zFar + zNear)/(zNear - zFar), 2*zFar*zNear/(zNear - zFar),
+    0, 0, -1, 0).finished();
+}
+
+void PrintStatistics(const PipelineStatistics& statistics, int frameCount) {
+  const struct {
+    const char* name;
+    uint64_t count;
+  } counters[] = {
+    { "vertices transformed", statistics.verticesTransformed },
+    { "triangles submitted", statistics.trianglesSubmitted },
+    { "triangles culled", statistics.trianglesCulled },
+    { "triangles clipped", statistics.trianglesClipped },
+    { "triangles rejected", statistics.trianglesRejected },
+    { "pixels visited", statistics.pixelsVisited },
+    { "edge test passes", statistics.edgeTestPasses },
+    { "depth test passes", statistics.depthTestPasses },
+    { "depth test failures", statistics.depthTestFailures },
+    { "fragments shaded", statistics.fragmentsShaded }
+  };
+  for (const auto& counter : counters) {
+    std::cout << "  " << counter.name << ": "
+              << counter.count / frameCount << std::endl;
+  }
+}
+
+void PrintPerfCounts(const RastaManRenderer& renderer, int frameCount) {
+  const PerfCounters& counters = PerfCounters::GetThreadCounters();
+  if (!counters.IsAvailable()) {
+    std::cout << "No hardware counters" << std::endl;
+    return;
+  }
+  std::cout << "Hardware counters per frame:" << std::endl;
+  for (int i = 0; i < STAGE_COUNT; ++i) {
+    const PipelineStage stage = static_cast<PipelineStage>(i);
+    const PerfCounts counts = renderer.GetPerfCounts(stage);
+    std::cout << "  " << RastaManRenderer::GetStageName(stage) << ":";
+    for (int j = 0; j < PERF_EVENT_COUNT; ++j) {
+      const PerfEvent event = static_cast<PerfEvent>(j);
+      if (counters.IsAvailable(event)) {
+        std::cout << " " << PerfCounters::GetName(event) << " "
+                  << counts[event] / frameCount;
+      }
+    }
+    std::cout << " ipc " << counts.GetIpc() << std::endl;
+  }
+}
+
+bool WritePpm(const std::string& filename, const IColorSurface& surface) {
+  std::ofstream ofs(filename.c_str(), std::ios::binary);
+  ofs << "P6\n";
+  ofs << surface.GetWidth() << " " << surface.GetHeight() << "\n";
+  ofs << 255 << "\n";
+
+  const int width = surface.GetWidth();
+  std::vector<Vector4f, aligned_allocator<Vector4f>> row(width);
+  std::vector<unsigned char> bytes(width * 3);
+  for (int y = 0; y < surface.GetHeight(); ++y) {
+    surface.ReadRect(AlignedBox<int, 2>(Vector2i(0, y),
+                                        Vector2i(width - 1, y)),
+                     &row[0], width);
+    for (int x = 0; x < width; ++x) {
+      for (int i = 0; i < 3; ++i) {
+        const float c = std::min(std::max(row[x][i], 0.0f), 1.0f);
+        bytes[x*3 + i] = static_cast<unsigned char>(c * 255 + .5f);
+      }
+    }
+    ofs.write(reinterpret_cast<const char*>(&bytes[0]), bytes.size());
+  }
+  return static_cast<bool>(ofs);
+}
+}
+
+int main(int argc, char* argv[]) {
+  int width = 512;
+  int height = 512;
+  int frameCount = 60;
+  const char* outputPrefix = nullptr;
+  ShadingMode shadingMode = SHADING_SMOOTH;
+  int queryCount = 0;
+  bool statistics = false;
+  const char* traceFilename = nullptr;
+  const char* telemetryFilename = nullptr;
+  const char* filename = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "-s") && i + 1 < argc) {
+      if (std::sscanf(argv[++i], "%dx%d", &width, &height) != 2) {
+        PrintUsage();
+        return 1;
+      }
+    } else if (!std::strcmp(argv[i], "-n") && i + 1 < argc) {
+      frameCount = std::atoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "-o") && i + 1 < argc) {
+      outputPrefix = argv[++i];
+    } else if (!std::strcmp(argv[i], "-f")) {
+      shadingMode = SHADING_FLAT;
+    } else if (!std::strcmp(argv[i], "-l")) {
+      shadingMode = SHADING_LIT;
+    } else if (!std::strcmp(argv[i], "-q") && i + 1 < argc) {
+      queryCount = std::atoi(argv[++i]);
+    } else if (!std::strcmp(argv[i], "-t")) {
+      shadingMode = SHADING_TEXTURED;
+    } else if (!std::strcmp(argv[i], "-p")) {
+      statistics = true;
+    } else if (!std::strcmp(argv[i], "-j") && i + 1 < argc) {
+      traceFilename = argv[++i];
+    } else if (!std::strcmp(argv[i], "-m") && i + 1 < argc) {
+      telemetryFilename = argv[++i];
+    } else if (!std::strcmp(argv[i], "-i") && i + 1 < argc) {
+      CpuIsa isa;
+      if (!ParseIsa(argv[++i], &isa)) {
+        PrintUsage();
+        return 1;
+      }
+      if (!SetCpuIsa(isa)) {
+        std::cerr << argv[i] << " is not supported, the best is "
+                  << GetIsaName(GetSupportedIsa()) << std::endl;
+        return 1;
+      }
+    } else if (argv[i][0] != '-' && !filename) {
+      filename = argv[i];
+    } else {
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (!filename || width <= 0 || height <= 0 || frameCount <= 0 ||
+      queryCount < 0) {
+    PrintUsage();
+    return 1;
+  }
+
+  Mesh mesh;
+  if (!mesh.Load(filename)) {
+    std::cerr << "Error reading " << filename << std::endl;
+    return 1;
+  }
+  if (!mesh.GetIndexCount()) {
+    std::cerr << "No faces in " << filename << std::endl;
+    return 1;
+  }
+  std::cout << mesh.GetVertexCount() << " vertices, "
+            << mesh.GetIndexCount()/3 << " faces, "
+            << GetIsaName(GetCpuKernels().isa) << " kernels" << std::endl;
+  const Vector3f& min = mesh.GetMin();
+  const Vector3f& max = mesh.GetMax();
+  VertexAttributes attributes;
+  if (shadingMode == SHADING_SMOOTH) {
+    attributes.normals = mesh.GetAttribute(MESH_NORMAL);
+  }
+
+  // Same framing as the interactive viewer
+  const Vector3f extents = max - min;
+  const float scale = 1.f / extents.maxCoeff();
+  const Vector3f mid = (max + min) * .5f;
+  const Matrix4f modelMatrix =
+    (Scaling(scale) * Translation3f(-mid)).matrix();
+
+  Tracer::GetDefault().SetThreadName("Main");
+  Tracer::GetDefault().SetEnabled(traceFilename != nullptr);
+  Telemetry& telemetry = Telemetry::GetDefault();
+  telemetry.SetEnabled(telemetryFilename != nullptr);
+
+  auto rt = std::make_shared<RenderTarget>(width, height, PIXEL_RGBA8,
+                                           PIXEL_D24);
+  RastaManRenderer renderer(rt);
+  renderer.SetViewport(0, 0, width, height);
+  const Matrix4f projectionMatrix = GetPerspectiveMatrix(
+    60.0f, static_cast<float>(width)/height, 0.1f, 100.0f);
+  renderer.SetProjectionMatrix(projectionMatrix);
+  renderer.SetStatisticsEnabled(statistics);
+  renderer.SetPerfCountersEnabled(statistics);
+
+  LitVertexShader vertexShader;
+  vertexShader.positions = mesh.GetVertices();
+  vertexShader.normals = mesh.GetAttribute(MESH_NORMAL);
+  LitFragmentShader fragmentShader;
+  fragmentShader.albedo = Vector3f(1.0f, 0.8f, 0.6f);
+  fragmentShader.ambient = 0.1f;
+
+  // Four repetitions of the checkerboard across the model
+  const std::unique_ptr<Texture> texture = CreateCheckerboard(256, 32);
+  TexturedVertexShader texturedVertexShader;
+  texturedVertexShader.positions = vertexShader.positions;
+  texturedVertexShader.normals = vertexShader.normals;
+  texturedVertexShader.texCoordOrigin = min;
+  texturedVertexShader.texCoordScale = 4 / extents.maxCoeff();
+  TexturedFragmentShader texturedFragmentShader;
+  texturedFragmentShader.texture = texture.get();
+  texturedFragmentShader.ambient = fragmentShader.ambient;
+
+  // Depth-only culling at a quarter of the resolution.  The boxes are
+  // scattered around the model in a cube twice its size.  Models are too
+  // finely tessellated for conservative rasterization, so the culling is
+  // approximate.
+  auto cullTarget = std::make_shared<RenderTarget>(
+    std::max(width/4, 1), std::max(height/4, 1), PIXEL_RGBA8, PIXEL_D32F);
+  RastaManRenderer culler(cullTarget);
+  culler.SetViewport(0, 0, cullTarget->GetZBuffer()->GetWidth(),
+                     cullTarget->GetZBuffer()->GetHeight());
+  culler.SetProjectionMatrix(projectionMatrix);
+  PipelineState cullState;
+  cullState.colorWrite = false;
+  culler.SetPipelineState(cullState);
+  std::vector<AlignedBox3f> boxes(queryCount);
+  for (auto& box : boxes) {
+    const Vector3f center =
+      mid + Vector3f::Random().cwiseProduct(extents);
+    const Vector3f halfSize = extents * .02f;
+    box = AlignedBox3f(center - halfSize, center + halfSize);
+  }
+  std::unique_ptr<bool[]> visible(new bool[queryCount]);
+  std::chrono::high_resolution_clock::duration occluderTime(0);
+  std::chrono::high_resolution_clock::duration queryTime(0);
+  int visibleCount = 0;
+
+  const float clearColor[4] = { 0, 0, 0, 0 };
+  std::chrono::high_resolution_clock::duration renderTime(0);
+  for (int frame = 0; frame < frameCount; ++frame) {
+    const float angle = 2 * 3.14159265f * frame / frameCount;
+    Affine3f viewTransform;
+    viewTransform = Translation3f(0.0f, 0.0f, -2.0f)
+      * AngleAxisf(angle, Vector3f::UnitY());
+
+    TraceScope frameScope("Frame");
+    const auto start = std::chrono::high_resolution_clock::now();
+    renderer.Clear(clearColor);
+    const Matrix4f modelViewMatrix = viewTransform.matrix() * modelMatrix;
+    vertexShader.modelViewProjection = projectionMatrix * modelViewMatrix;
+    vertexShader.normalMatrix =
+      modelViewMatrix.topLeftCorner<3, 3>().inverse().transpose();
+    if (shadingMode == SHADING_LIT) {
+      renderer.Draw(vertexShader, fragmentShader, mesh.GetIndices(),
+                    mesh.GetIndexCount());
+    } else if (shadingMode == SHADING_TEXTURED) {
+      texturedVertexShader.modelViewProjection =
+        vertexShader.modelViewProjection;
+      texturedVertexShader.normalMatrix = vertexShader.normalMatrix;
+      renderer.Draw(texturedVertexShader, texturedFragmentShader,
+                    mesh.GetIndices(), mesh.GetIndexCount());
+    } else {
+      renderer.SetModelViewMatrix(modelViewMatrix);
+      renderer.DrawTriangles(mesh.GetVertices(), attributes,
+                             mesh.GetIndices(), mesh.GetIndexCount());
+    }
+    const auto frameTime = std::chrono::high_resolution_clock::now() - start;
+    renderTime += frameTime;
+    if (telemetry.IsEnabled()) {
+      telemetry.Record("frame", std::chrono::duration_cast<
+        std::chrono::microseconds>(frameTime).count());
+    }
+
+    if (queryCount) {
+      const auto cullStart = std::chrono::high_resolution_clock::now();
+      culler.Clear(clearColor);
+      culler.SetModelViewMatrix(modelViewMatrix);
+      culler.DrawTriangles(mesh.GetVertices(), mesh.GetIndices(),
+                           mesh.GetIndexCount());
+      const auto queryStart = std::chrono::high_resolution_clock::now();
+      culler.IsVisible(&boxes[0], queryCount, visible.get());
+      const auto queryEnd = std::chrono::high_resolution_clock::now();
+      occluderTime += queryStart - cullStart;
+      queryTime += queryEnd - queryStart;
+      if (telemetry.IsEnabled()) {
+        telemetry.Record("occluders", std::chrono::duration_cast<
+          std::chrono::microseconds>(queryStart - cullStart).count());
+        telemetry.Record("queries", std::chrono::duration_cast<
+          std::chrono::microseconds>(queryEnd - queryStart).count());
+      }
+      visibleCount += static_cast<int>(
+        std::count(visible.get(), visible.get() + queryCount, true));
+    }
+
+    if (outputPrefix) {
+      TraceScope scope("WritePpm");
+      std::ostringstream name;
+      name << outputPrefix;
+      name.width(4);
+      name.fill('0');
+      name << frame << ".ppm";
+      if (!WritePpm(name.str(), *rt->GetBackBuffer())) {
+        std::cerr << "Error writing " << name.str() << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  const double seconds =
+    std::chrono::duration<double>(renderTime).count();
+  std::cout << frameCount << " frames in " << seconds << " s, "
+            << frameCount / seconds << " fps, "
+            << seconds * 1000 / frameCount << " ms/frame" << std::endl;
+  if (queryCount) {
+    typedef std::chrono::duration<double, std::milli> Milliseconds;
+    std::cout << "Occluders in "
+              << Milliseconds(occluderTime).count() / frameCount
+              << " ms/frame, " << queryCount << " queries in "
+              << Milliseconds(queryTime).count() / frameCount
+              << " ms/frame, "
+              << 100.0 * visibleCount / (static_cast<double>(queryCount)
+                                         * frameCount)
+              << "% visible" << std::endl;
+  }
+  if (statistics) {
+    std::cout << "Pipeline statistics per frame:" << std::endl;
+    PrintStatistics(renderer.GetStatistics(), frameCount);
+    PrintPerfCounts(renderer, frameCount);
+  }
+  if (telemetryFilename) {
+    // Stage times include those of the culler
+    telemetry.WriteSummary(std::cout);
+    if (!telemetry.Write(telemetryFilename)) {
+      std::cerr << "Error writing " << telemetryFilename << std::endl;
+      return 1;
+    }
+  }
+  if (traceFilename && !Tracer::GetDefault().Write(traceFilename)) {
+    std::cerr << "Error writing " << traceFilename << std::endl;
+    return 1;
+  }
+  return 0;
+}
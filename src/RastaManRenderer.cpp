@@ -1,10 +1,21 @@
 #include "RastaManRenderer.hpp"
 
+#include "CpuDispatch.hpp"
 #include "FixedPoint.hpp"
 #include "RenderSurface.hpp"
+#include "Simd.hpp"
+
+#include <algorithm>
+#include <bitset>
+#include <cfloat>
+#include <cmath>
 
 using namespace Eigen;
 
+// Tiles rendered concurrently must not share a lazily cleared surface tile
+static_assert(RastaManRenderer::kTileSize % RenderSurface1f::kClearTileSize
+              == 0, "Tiles must consist of whole clear tiles");
+
 namespace {
 typedef FixedPoint<int32_t, 8> FP;
 typedef Matrix<FP, 2, 1> Vector2FP;
@@ -26,21 +37,161 @@ inline T Orient2D(const Array<T, 2, 1>& a, const Array<T, 2, 1>& b,
 inline bool IsTopLeft(const Vector2FP& a, const Vector2FP& b) {
   return (a.y() == b.y() && a.x() > b.x()) || (a.y() < b.y());
 }
+
+const int kVertexBatchSize = 4096;
+
+const Vector4f kFrustumPlanes[6] = {
+  Vector4f(1, 0, 0, 1), Vector4f(-1, 0, 0, 1),
+  Vector4f(0, 1, 0, 1), Vector4f(0, -1, 0, 1),
+  Vector4f(0, 0, 1, 1), Vector4f(0, 0, -1, 1)
+};
+
+// Start of the index-th of count equal parts of [0, size)
+inline int SplitPoint(int size, int index, int count) {
+  return static_cast<int>(static_cast<int64_t>(size) * index / count);
+}
+
+inline int CountBits(uint64_t bits) {
+  return static_cast<int>(std::bitset<64>(bits).count());
+}
+
+inline Vector3f FaceColor(const Vector3f& v0, const Vector3f& v1,
+                          const Vector3f& v2) {
+  const Vector3f normal = (v1 - v0).cross(v2 - v0).normalized();
+  return normal*.5f + Vector3f::Constant(.5f);
+}
+
+// Returns a bit mask of the planes the clip-space vertex lies behind.
+inline int OutCode(const Vector4f& v, const Vector4f* planes, int count) {
+  int code = 0;
+  for (int i = 0; i < count; ++i) {
+    if (planes[i].dot(v) < 0.0f) {
+      code |= 1 << i;
+    }
+  }
+  return code;
 }
 
+// Edge functions multiply two coordinate differences within the bounding
+// box of a triangle, in pixels, and their difference must fit into FP.
+// Blocks may start a little before the box.
+constexpr bool FitsEdgeFunctions(int64_t width, int64_t height) {
+  return 2 * (width + RastaManRenderer::kBlockSize + 1)
+    * (height + RastaManRenderer::kBlockSize + 1)
+    << FP::frac_bits <= std::numeric_limits<int32_t>::max();
+}
+
+static_assert(FitsEdgeFunctions(2 * RastaManRenderer::kGuardBand,
+                                2 * RastaManRenderer::kGuardBand),
+              "Triangles within the guard band must fit into FP");
+
+// Clip-space polygon vertex with the varyings of the current draw
+struct ClipVertex {
+  Vector4f position;
+  float varyings[RastaManRenderer::kMaxVaryings];
+};
+
+// Sutherland-Hodgman clipping of a convex polygon against one plane.
+// Returns the number of vertices written to out, at most count + 1.
+// Varyings are interpolated linearly in clip space.
+int ClipPolygon(const ClipVertex* in, int count, const Vector4f& plane,
+                int varyingCount, ClipVertex* out) {
+  int outCount = 0;
+  for (int i = 0; i < count; ++i) {
+    const ClipVertex& a = in[i];
+    const ClipVertex& b = in[(i + 1) % count];
+    const float da = plane.dot(a.position);
+    const float db = plane.dot(b.position);
+    if (da >= 0.0f) {
+      out[outCount++] = a;
+    }
+    if ((da >= 0.0f) != (db >= 0.0f)) {
+      const float t = da / (da - db);
+      ClipVertex& vertex = out[outCount++];
+      vertex.position = a.position + (b.position - a.position) * t;
+      for (int j = 0; j < varyingCount; ++j) {
+        vertex.varyings[j] =
+          a.varyings[j] + (b.varyings[j] - a.varyings[j]) * t;
+      }
+    }
+  }
+  return outCount;
+}
+
+// Fragment stage of DrawTriangles with attributes: vertex colors, or else
+// normals mapped to colors like the flat face colors, or else texture
+// coordinates as red and green
+struct AttributeShader {
+  void operator()(const FragmentQuad& quad, Vector4f* colors) const {
+    for (int i = 0; i < 4; ++i) {
+      if (colorOffset >= 0) {
+        colors[i] = Vector4f(quad.varyings[colorOffset][i],
+                             quad.varyings[colorOffset + 1][i],
+                             quad.varyings[colorOffset + 2][i],
+                             quad.varyings[colorOffset + 3][i]);
+      } else if (normalOffset >= 0) {
+        const Vector3f normal(quad.varyings[normalOffset][i],
+                              quad.varyings[normalOffset + 1][i],
+                              quad.varyings[normalOffset + 2][i]);
+        colors[i] << normal.normalized()*.5f + Vector3f::Constant(.5f), 1.0f;
+      } else {
+        colors[i] = Vector4f(quad.varyings[texCoordOffset][i],
+                             quad.varyings[texCoordOffset + 1][i],
+                             0.0f, 1.0f);
+      }
+    }
+  }
+
+  int normalOffset;
+  int texCoordOffset;
+  int colorOffset;
+};
+
+// Interpolated depths are a sum of three float terms.  A bound computed with
+// different operations may be off by a few ulps of the terms' magnitude.
+inline float DepthErrorBound(float magnitude) {
+  return 8.0f * FLT_EPSILON * magnitude;
+}
+}
+
+const int RastaManRenderer::kTileSize;
+const int RastaManRenderer::kGuardBand;
+const int RastaManRenderer::kBlockSize;
+const int RastaManRenderer::kMaxVaryings;
+const int RastaManRenderer::kMaxSplitDepth;
+
 RastaManRenderer::RastaManRenderer(std::shared_ptr<RenderTarget> rt)
   : modelViewMatrix_(Matrix4f::Identity()),
     projectionMatrix_(Matrix4f::Identity()),
     modelViewProjectionMatrix_(Matrix4f::Identity()),
-    renderTarget_(rt) {
+    renderTarget_(rt),
+    statisticsEnabled_(false),
+    perfCountersEnabled_(false),
+    threadPool_() {
+  // Until a viewport is set, the guard band is the view frustum
+  clipPlanes_[0] = kFrustumPlanes[4];
+  for (int i = 0; i < 4; ++i) {
+    clipPlanes_[i + 1] = kFrustumPlanes[i];
+  }
+  SetVertexAttributes(VertexAttributes());
+  quadShader_ = nullptr;
+  fragmentShader_ = nullptr;
+  positions_ = nullptr;
 }
 
 RastaManRenderer::~RastaManRenderer() {
 }
 
 void RastaManRenderer::Clear(const float clearColor[4]) {
-  renderTarget_->GetBackBuffer()->Clear(Vector4f(clearColor));
-  renderTarget_->GetZBuffer()->Clear(1.f);
+  TraceScope scope("Clear");
+  TelemetryScope telemetry(GetStageName(STAGE_CLEAR));
+  const PerfCounts counts = BeginStage();
+  renderTarget_->GetBackBuffer()->ClearValue(Vector4f(clearColor));
+  renderTarget_->GetZBuffer()->ClearValue(1.f);
+  // The Hi-Z buffer is small, and its clear tiles span several tiles of the
+  // renderer
+  renderTarget_->GetHiZBuffer()->Fill(1.f);
+  EndStage(STAGE_CLEAR, counts);
 }
 
 void RastaManRenderer::SetModelViewMatrix(const Matrix4f& matrix) {
@@ -57,74 +208,719 @@ void RastaManRenderer::SetRenderTarget(std::shared_ptr<RenderTarget> rt) {
   renderTarget_ = rt;
 }
 
+void RastaManRenderer::SetPipelineState(const PipelineState& state) {
+  state_ = state;
+}
+
+const PipelineState& RastaManRenderer::GetPipelineState() const {
+  return state_;
+}
+
+void RastaManRenderer::SetStatisticsEnabled(bool enabled) {
+  statisticsEnabled_ = enabled;
+}
+
+bool RastaManRenderer::IsStatisticsEnabled() const {
+  return statisticsEnabled_;
+}
+
+PipelineStatistics RastaManRenderer::GetStatistics() const {
+  std::lock_guard<std::mutex> lock(statisticsMutex_);
+  return statistics_;
+}
+
+void RastaManRenderer::ResetStatistics() {
+  std::lock_guard<std::mutex> lock(statisticsMutex_);
+  statistics_ = PipelineStatistics();
+}
+
+void RastaManRenderer::AddStatistics(const PipelineStatistics& statistics) {
+  std::lock_guard<std::mutex> lock(statisticsMutex_);
+  statistics_ += statistics;
+}
+
+void RastaManRenderer::SetPerfCountersEnabled(bool enabled) {
+  perfCountersEnabled_ = enabled;
+}
+
+bool RastaManRenderer::IsPerfCountersEnabled() const {
+  return perfCountersEnabled_;
+}
+
+PerfCounts RastaManRenderer::GetPerfCounts(PipelineStage stage) const {
+  std::lock_guard<std::mutex> lock(statisticsMutex_);
+  return perfCounts_[stage];
+}
+
+void RastaManRenderer::ResetPerfCounts() {
+  std::lock_guard<std::mutex> lock(statisticsMutex_);
+  for (auto& counts : perfCounts_) {
+    counts = PerfCounts();
+  }
+}
+
+const char* RastaManRenderer::GetStageName(PipelineStage stage) {
+  static const char* const kNames[STAGE_COUNT] = {
+    "clear",
+    "vertex",
+    "setup",
+    "raster"
+  };
+  return kNames[stage];
+}
+
+PerfCounts RastaManRenderer::BeginStage() const {
+  return perfCountersEnabled_ ? PerfCounters::GetThreadCounters().Read()
+                              : PerfCounts();
+}
+
+void RastaManRenderer::EndStage(PipelineStage stage, const PerfCounts& begin) {
+  if (!perfCountersEnabled_) {
+    return;
+  }
+  const PerfCounts counts = PerfCounters::GetThreadCounters().Read() - begin;
+  std::lock_guard<std::mutex> lock(statisticsMutex_);
+  perfCounts_[stage] += counts;
+}
+
 void RastaManRenderer::SetViewport(int x, int y, int width, int height) {
   viewport_ = AlignedBox<int, 2>(Vector2i(x, y),
                                  Vector2i(x + width - 1, y + height - 1));
   viewportScale_ = Vector3f(0.5f * width, -0.5f * height, 0.5f);
   viewportBias_ = Vector3f(0.5f * width + x, 0.5f * height + y, 0.5f);
+
+  // Edge functions multiply two coordinate differences and must fit into
+  // FP, so vertices may be at most kGuardBand pixels away from the viewport
+  // center.  Viewports larger than the guard band are clipped at their edges,
+  // and ClipTriangle splits the triangles that are still too large.
+  const Vector2f guardBand(std::max(kGuardBand / (0.5f * width), 1.0f),
+                           std::max(kGuardBand / (0.5f * height), 1.0f));
+  clipPlanes_[0] = Vector4f(0, 0, 1, 1);  // Near plane
+  clipPlanes_[1] = Vector4f(1, 0, 0, guardBand.x());
+  clipPlanes_[2] = Vector4f(-1, 0, 0, guardBand.x());
+  clipPlanes_[3] = Vector4f(0, 1, 0, guardBand.y());
+  clipPlanes_[4] = Vector4f(0, -1, 0, guardBand.y());
+}
+
+void RastaManRenderer::SetVertexAttributes(
+    const VertexAttributes& attributes) {
+  attributes_ = attributes;
+  varyingCount_ = 0;
+  auto allocate = [this] (const float* stream, int components) {
+    if (!stream) {
+      return -1;
+    }
+    varyingCount_ += components;
+    return varyingCount_ - components;
+  };
+  normalOffset_ = allocate(attributes.normals, 3);
+  texCoordOffset_ = allocate(attributes.texCoords, 2);
+  colorOffset_ = allocate(attributes.colors, 4);
 }
 
 void RastaManRenderer::DrawTriangles(const Eigen::Vector3f* vertices,
                                      const int* indices,
                                      int count) {
-  for (int i = 0; i < count; i += 3) {
-    DrawTriangle(
-      (Vector4f() << vertices[indices[i]], 1.0f).finished(),
-      (Vector4f() << vertices[indices[i+1]], 1.0f).finished(),
-      (Vector4f() << vertices[indices[i+2]], 1.0f).finished()
-    );
+  DrawTriangles(vertices, VertexAttributes(), indices, count);
+}
+
+void RastaManRenderer::DrawTriangles(const Eigen::Vector3f* vertices,
+                                     const VertexAttributes& attributes,
+                                     const int* indices,
+                                     int count) {
+  TraceScope scope("DrawTriangles");
+  SetVertexAttributes(attributes);
+  positions_ = vertices;
+  const AttributeShader shader = {
+    normalOffset_, texCoordOffset_, colorOffset_
+  };
+  const int vertexCount = BeginDraw(
+    indices, count, varyingCount_,
+    varyingCount_ ? &ShadeQuads<AttributeShader> : nullptr, &shader);
+  ForEachVertexBatch(vertexCount, [&] (int begin, int end) {
+    TransformVertices(vertices + begin, end - begin,
+                      &transformedVertices_[begin]);
+    for (int i = begin; i < end && varyingCount_; ++i) {
+      FetchVaryings(i, &vertexVaryings_[i*varyingCount_]);
+    }
+  });
+  SetupTriangles(indices, count);
+  RasterizeTiles();
+}
+
+int RastaManRenderer::BeginDraw(const int* indices, int count,
+                                int varyingCount, QuadShader quadShader,
+                                const void* fragmentShader) {
+  varyingCount_ = varyingCount;
+  quadShader_ = quadShader;
+  fragmentShader_ = fragmentShader;
+
+  // Geometry is split into one contiguous range per thread, so concatenating
+  // the bins of all batches in order keeps the submission order per tile.
+  const int batchCount = threadPool_.GetThreadCount();
+  const int triangleCount = count / 3;
+  batchTriangles_.resize(batchCount);
+  batchVaryings_.resize(batchCount);
+  batchBins_.resize(batchCount);
+
+  // Every vertex up to the largest index is transformed exactly once, no
+  // matter how many triangles share it.
+  std::vector<int> batchMaxIndex(batchCount, -1);
+  threadPool_.ParallelFor(batchCount, [&] (int batch) {
+    TraceScope scope("FindVertexCount");
+    const int begin = SplitPoint(triangleCount, batch, batchCount);
+    const int end = SplitPoint(triangleCount, batch + 1, batchCount);
+    int maxIndex = -1;
+    for (int i = begin*3; i < end*3; ++i) {
+      maxIndex = std::max(maxIndex, indices[i]);
+    }
+    batchMaxIndex[batch] = maxIndex;
+  });
+  const int vertexCount =
+    *std::max_element(batchMaxIndex.begin(), batchMaxIndex.end()) + 1;
+
+  transformedVertices_.resize(vertexCount);
+  vertexVaryings_.resize(vertexCount * varyingCount);
+
+  if (statisticsEnabled_) {
+    PipelineStatistics statistics;
+    statistics.verticesTransformed = vertexCount;
+    statistics.trianglesSubmitted = triangleCount;
+    AddStatistics(statistics);
   }
+  return vertexCount;
+}
+
+void RastaManRenderer::ForEachVertexBatch(
+    int vertexCount, const std::function<void(int, int)>& task) {
+  TelemetryScope telemetry(GetStageName(STAGE_VERTEX));
+  const int vertexBatchCount =
+    (vertexCount + kVertexBatchSize - 1) / kVertexBatchSize;
+  threadPool_.ParallelFor(vertexBatchCount, [&] (int batch) {
+    TraceScope scope("TransformVertices");
+    const PerfCounts counts = BeginStage();
+    const int begin = batch * kVertexBatchSize;
+    task(begin, std::min(begin + kVertexBatchSize, vertexCount));
+    EndStage(STAGE_VERTEX, counts);
+  });
+}
+
+void RastaManRenderer::SetupTriangles(const int* indices, int count) {
+  TelemetryScope telemetry(GetStageName(STAGE_SETUP));
+  const auto surface = renderTarget_->GetBackBuffer();
+  const int tilesX = (surface->GetWidth() + kTileSize - 1) / kTileSize;
+  const int tilesY = (surface->GetHeight() + kTileSize - 1) / kTileSize;
+  const int tileCount = tilesX * tilesY;
+  const int triangleCount = count / 3;
+  const int batchCount = static_cast<int>(batchTriangles_.size());
+
+  threadPool_.ParallelFor(batchCount, [&] (int batch) {
+    TraceScope scope("SetupTriangles");
+    const PerfCounts counts = BeginStage();
+    auto& triangles = batchTriangles_[batch];
+    auto& varyingSetups = batchVaryings_[batch];
+    auto& bins = batchBins_[batch];
+    triangles.clear();
+    varyingSetups.clear();
+    bins.resize(tileCount);
+    for (auto& bin : bins) {
+      bin.clear();
+    }
+
+    const int begin = SplitPoint(triangleCount, batch, batchCount);
+    const int end = SplitPoint(triangleCount, batch + 1, batchCount);
+    std::vector<TriangleSetup> setups(1);
+    std::vector<VaryingSetup> varyingSetup(1);
+    // Shaded triangles get plane equations, if only the one of 1/w
+    const bool shade = quadShader_ != nullptr;
+    PipelineStatistics statistics;
+    for (int i = begin*3; i < end*3; i += 3) {
+      const float* const varyings[3] = {
+        vertexVaryings_.data() + indices[i]*varyingCount_,
+        vertexVaryings_.data() + indices[i+1]*varyingCount_,
+        vertexVaryings_.data() + indices[i+2]*varyingCount_
+      };
+      int setupCount = SetupTriangle(transformedVertices_[indices[i]],
+                                     transformedVertices_[indices[i+1]],
+                                     transformedVertices_[indices[i+2]],
+                                     shade ? varyings : nullptr,
+                                     &setups[0],
+                                     shade ? &varyingSetup[0] : nullptr,
+                                     statisticsEnabled_ ? &statistics
+                                                        : nullptr);
+      if (setupCount < 0) {
+        ++statistics.trianglesClipped;
+        setupCount = ClipTriangle(GetClipPosition(indices[i]),
+                                  GetClipPosition(indices[i+1]),
+                                  GetClipPosition(indices[i+2]),
+                                  shade ? varyings : nullptr,
+                                  &setups,
+                                  shade ? &varyingSetup : nullptr);
+      }
+      if (!setupCount) {
+        continue;
+      }
+
+      const Vector3f color = shade || !state_.colorWrite ? Vector3f::Zero() :
+        FaceColor(positions_[indices[i]], positions_[indices[i+1]],
+                  positions_[indices[i+2]]);
+      for (int j = 0; j < setupCount; ++j) {
+        TriangleSetup& triangle = setups[j];
+        triangle.color = color;
+        const int index = static_cast<int>(triangles.size());
+        triangles.push_back(triangle);
+        if (shade) {
+          varyingSetups.push_back(varyingSetup[j]);
+        }
+
+        const int minX = std::max(triangle.box.min().x() / kTileSize, 0);
+        const int minY = std::max(triangle.box.min().y() / kTileSize, 0);
+        const int maxX = std::min(triangle.box.max().x() / kTileSize,
+                                  tilesX - 1);
+        const int maxY = std::min(triangle.box.max().y() / kTileSize,
+                                  tilesY - 1);
+        for (int y = minY; y <= maxY; ++y) {
+          for (int x = minX; x <= maxX; ++x) {
+            bins[y*tilesX + x].push_back(index);
+          }
+        }
+      }
+    }
+    if (statisticsEnabled_) {
+      AddStatistics(statistics);
+    }
+    EndStage(STAGE_SETUP, counts);
+  });
+}
+
+void RastaManRenderer::RasterizeTiles() {
+  TelemetryScope telemetry(GetStageName(STAGE_RASTER));
+  const auto surface = renderTarget_->GetBackBuffer();
+  const int tilesX = (surface->GetWidth() + kTileSize - 1) / kTileSize;
+  const int tilesY = (surface->GetHeight() + kTileSize - 1) / kTileSize;
+  const int tileCount = tilesX * tilesY;
+  const int batchCount = static_cast<int>(batchTriangles_.size());
+
+  const Rasterizer rasterizer = GetRasterizer();
+  threadPool_.ParallelFor(tileCount, [&] (int tileIndex) {
+    bool empty = true;
+    for (int batch = 0; batch < batchCount && empty; ++batch) {
+      empty = batchBins_[batch][tileIndex].empty();
+    }
+    if (empty) {
+      return;
+    }
+
+    TraceScope scope("RasterizeTile");
+    const PerfCounts counts = BeginStage();
+    const Vector2i tileMin(tileIndex % tilesX * kTileSize,
+                           tileIndex / tilesX * kTileSize);
+    const Vector2i tileMax(
+      std::min(tileMin.x() + kTileSize, surface->GetWidth()) - 1,
+      std::min(tileMin.y() + kTileSize, surface->GetHeight()) - 1);
+    Tile& tile = GetTile();
+    LoadTile(AlignedBox<int, 2>(tileMin, tileMax), &tile);
+    for (int batch = 0; batch < batchCount; ++batch) {
+      const auto& triangles = batchTriangles_[batch];
+      const auto& varyingSetups = batchVaryings_[batch];
+      for (int index : batchBins_[batch][tileIndex]) {
+        (this->*rasterizer)(
+          triangles[index],
+          varyingSetups.empty() ? nullptr : &varyingSetups[index], &tile);
+      }
+    }
+    StoreTile(tile);
+    if (statisticsEnabled_) {
+      AddStatistics(tile.statistics);
+    }
+    EndStage(STAGE_RASTER, counts);
+  });
+
+  // The fragment shader only lives for the draw
+  quadShader_ = nullptr;
+  fragmentShader_ = nullptr;
 }
 
 Vector4f RastaManRenderer::ProcessVertex(const Vector4f& position) {
   return modelViewProjectionMatrix_ * position;
 }
 
-Vector4f RastaManRenderer::ProcessFragment(const Vector3f& position) {
-  return Vector4f(1, 1, 1, 1);
+void RastaManRenderer::FetchVaryings(int index, float* varyings) const {
+  if (normalOffset_ >= 0) {
+    std::copy_n(attributes_.normals + index*3, 3, varyings + normalOffset_);
+  }
+  if (texCoordOffset_ >= 0) {
+    std::copy_n(attributes_.texCoords + index*2, 2,
+                varyings + texCoordOffset_);
+  }
+  if (colorOffset_ >= 0) {
+    std::copy_n(attributes_.colors + index*4, 4, varyings + colorOffset_);
+  }
+}
+
+Vector4f RastaManRenderer::GetClipPosition(int index) {
+  if (positions_) {
+    return ProcessVertex((Vector4f() << positions_[index], 1.0f).finished());
+  }
+  return clipPositions_[index];
+}
+
+RastaManRenderer::TransformedVertex RastaManRenderer::TransformVertex(
+    const Vector4f& position) {
+  return TransformClipVertex(ProcessVertex(position));
+}
+
+RastaManRenderer::TransformedVertex RastaManRenderer::TransformClipVertex(
+    const Vector4f& clip) {
+  TransformedVertex vertex;
+  vertex.outCode = OutCode(clip, kFrustumPlanes, 6)
+    | OutCode(clip, clipPlanes_, 5) << 6;
+  if (!(vertex.outCode >> 6)) {
+    ProjectVertex(clip, &vertex);
+  }
+  return vertex;
+}
+
+void RastaManRenderer::TransformVertices(const Vector3f* positions, int count,
+                                         TransformedVertex* vertices) {
+  VertexTransform transform;
+  const Matrix4f& m = modelViewProjectionMatrix_;
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      transform.matrix[i][j] = m(i, j);
+    }
+  }
+  for (int i = 0; i < 11; ++i) {
+    const Vector4f& plane = i < 6 ? kFrustumPlanes[i] : clipPlanes_[i - 6];
+    for (int j = 0; j < 4; ++j) {
+      transform.planes[i][j] = plane[j];
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    transform.viewportScale[i] = viewportScale_[i];
+    transform.viewportBias[i] = viewportBias_[i];
+  }
+  transform.fixedScale = static_cast<float>(1 << FP::frac_bits);
+
+  // The kernel writes straight into the vertices
+  static_assert(sizeof(FP) == sizeof(int32_t), "FP must be its raw value");
+  TransformedVertex& first = vertices[0];
+  const TransformedVertexOutput output = {
+    { &first.screen[0], &first.screen[1], &first.screen[2] },
+    { &first.fixed[0], &first.fixed[1] },
+    &first.outCode,
+    &first.invW,
+    sizeof(TransformedVertex)
+  };
+  GetCpuKernels().transformVertices(transform, positions[0].data(), count,
+                                    output);
+}
+
+void RastaManRenderer::ProjectVertex(const Vector4f& clip,
+                                     TransformedVertex* vertex) {
+  const Vector4f ndc = clip / clip.w();
+  vertex->screen = ndc.head<3>().cwiseProduct(viewportScale_) + viewportBias_;
+  vertex->fixed =
+    (vertex->screen.head<2>() - Vector2f(0.5f, 0.5f)).cast<FP>();
+  vertex->invW = 1.0f / clip.w();
+}
+
+int RastaManRenderer::SetupTriangle(const TransformedVertex& v0,
+                                    const TransformedVertex& v1,
+                                    const TransformedVertex& v2,
+                                    const float* const* varyings,
+                                    TriangleSetup* triangles,
+                                    VaryingSetup* varyingSetups,
+                                    PipelineStatistics* statistics) {
+  // Trivially reject triangles outside one of the frustum planes, and only
+  // clip triangles that cross the near plane or leave the guard band, or
+  // that are too large for the edge functions within viewports larger than
+  // the guard band.
+  if (v0.outCode & v1.outCode & v2.outCode & 0x3f) {
+    if (statistics) {
+      ++statistics->trianglesRejected;
+    }
+    return 0;
+  }
+  if ((v0.outCode | v1.outCode | v2.outCode) >> 6) {
+    return -1;
+  }
+  const FP width = std::max(std::max(v0.fixed.x(), v1.fixed.x()), v2.fixed.x())
+    - std::min(std::min(v0.fixed.x(), v1.fixed.x()), v2.fixed.x());
+  const FP height = std::max(std::max(v0.fixed.y(), v1.fixed.y()), v2.fixed.y())
+    - std::min(std::min(v0.fixed.y(), v1.fixed.y()), v2.fixed.y());
+  if (!FitsEdgeFunctions(width.GetAs<int>() + 1, height.GetAs<int>() + 1)) {
+    return -1;
+  }
+  return SetupScreenTriangle(v0, v1, v2, varyings, triangles, varyingSetups,
+                             statistics);
 }
 
-void RastaManRenderer::RasterizeTriangle(
-    const Vector3f& v0,
-    const Vector3f& v1,
-    const Vector3f& v2,
-    std::function<void(const Vector3f&)> callback) {
+int RastaManRenderer::ClipTriangle(const Vector4f& clip0,
+                                   const Vector4f& clip1,
+                                   const Vector4f& clip2,
+                                   const float* const* varyings,
+                                   std::vector<TriangleSetup>* triangles,
+                                   std::vector<VaryingSetup>* varyingSetups) {
+  const int clipCodes = OutCode(clip0, clipPlanes_, 5)
+    | OutCode(clip1, clipPlanes_, 5) | OutCode(clip2, clipPlanes_, 5);
+  const int varyingCount = varyings ? varyingCount_ : 0;
+
+  ClipVertex polygon[2][8];
+  const Vector4f* clip[3] = { &clip0, &clip1, &clip2 };
+  for (int i = 0; i < 3; ++i) {
+    polygon[0][i].position = *clip[i];
+    std::copy_n(varyings ? varyings[i] : nullptr, varyingCount,
+                polygon[0][i].varyings);
+  }
+  int count = 3;
+  int current = 0;
+  for (int i = 0; i < 5 && count >= 3; ++i) {
+    if (clipCodes & (1 << i)) {
+      count = ClipPolygon(polygon[current], count, clipPlanes_[i],
+                          varyingCount, polygon[1 - current]);
+      current = 1 - current;
+    }
+  }
+
+  // Polygons too large for the edge functions are split in halves at the
+  // center of their longer side, depth first.  Both halves get the same
+  // vertices on the split line, so that no pixel is lost or drawn twice.
+  struct ClipPolygonPiece {
+    ClipVertex vertices[8 + kMaxSplitDepth];
+    int count;
+    int depth;
+  } pieces[kMaxSplitDepth + 1];
+  std::copy_n(polygon[current], count, pieces[0].vertices);
+  pieces[0].count = count;
+  pieces[0].depth = 0;
+  int pieceCount = 1;
+  int triangleCount = 0;
+  while (pieceCount) {
+    const ClipPolygonPiece piece = pieces[--pieceCount];
+    if (piece.count < 3) {
+      continue;
+    }
+
+    TransformedVertex vertices[8 + kMaxSplitDepth];
+    AlignedBox<int, 2> bounds;
+    for (int i = 0; i < piece.count; ++i) {
+      ProjectVertex(piece.vertices[i].position, &vertices[i]);
+      bounds.extend(Vector2i(vertices[i].fixed.x(), vertices[i].fixed.y()));
+    }
+    const Vector2i size = bounds.sizes() + Vector2i::Ones();
+    if (!FitsEdgeFunctions(size.x(), size.y())
+        && piece.depth < kMaxSplitDepth) {
+      // Plane through the center of the longer side in normalized device
+      // coordinates, where fixed point coordinates are half a pixel off
+      const int axis = size.x() >= size.y() ? 0 : 1;
+      const float center =
+        (0.5f * (bounds.min()[axis] + bounds.max()[axis] + 1)
+         - viewportBias_[axis]) / viewportScale_[axis];
+      Vector4f plane = Vector4f::Zero();
+      plane[axis] = -1.0f;
+      plane.w() = center;
+      for (int side = 0; side < 2; ++side) {
+        ClipPolygonPiece& half = pieces[pieceCount++];
+        half.count = ClipPolygon(piece.vertices, piece.count,
+                                 side ? -plane : plane, varyingCount,
+                                 half.vertices);
+        half.depth = piece.depth + 1;
+      }
+      continue;
+    }
+
+    const std::size_t needed = triangleCount + piece.count - 2;
+    if (triangles->size() < needed) {
+      triangles->resize(needed);
+      if (varyingSetups) {
+        varyingSetups->resize(needed);
+      }
+    }
+    for (int i = 1; i + 1 < piece.count; ++i) {
+      const float* const triangleVaryings[3] = {
+        piece.vertices[0].varyings,
+        piece.vertices[i].varyings,
+        piece.vertices[i + 1].varyings
+      };
+      triangleCount += SetupScreenTriangle(
+        vertices[0], vertices[i], vertices[i + 1],
+        varyings ? triangleVaryings : nullptr, &(*triangles)[triangleCount],
+        varyingSetups ? &(*varyingSetups)[triangleCount] : nullptr);
+    }
+  }
+  return triangleCount;
+}
+
+int RastaManRenderer::SetupScreenTriangle(const TransformedVertex& v0,
+                                          const TransformedVertex& v1,
+                                          const TransformedVertex& v2,
+                                          const float* const* varyings,
+                                          TriangleSetup* triangle,
+                                          VaryingSetup* varyingSetup,
+                                          PipelineStatistics* statistics) {
+  const TransformedVertex* v[3] = { &v0, &v1, &v2 };
+  const float* vertexVaryings[3] = {
+    varyings ? varyings[0] : nullptr,
+    varyings ? varyings[1] : nullptr,
+    varyings ? varyings[2] : nullptr
+  };
+
   // Double triangle area for interpolation and backface culling
-  const auto doubleArea = Orient2D<float>(v0.head<2>(), v1.head<2>(),
-                                          v2.head<2>());
+  auto doubleArea = Orient2D<float>(v[0]->screen.head<2>(),
+                                    v[1]->screen.head<2>(),
+                                    v[2]->screen.head<2>());
 
-  // Backface culling
-  if (doubleArea <= 0.0f) {
-    return;
+  // Face culling.  Surviving clockwise triangles are flipped, as the
+  // rasterizer expects counter-clockwise winding.
+  if (doubleArea == 0.0f ||
+      (doubleArea < 0.0f && state_.cullMode == CULL_BACK) ||
+      (doubleArea > 0.0f && state_.cullMode == CULL_FRONT)) {
+    if (statistics) {
+      ++statistics->trianglesCulled;
+    }
+    return 0;
+  }
+  if (doubleArea < 0.0f) {
+    std::swap(v[1], v[2]);
+    std::swap(vertexVaryings[1], vertexVaryings[2]);
+    doubleArea = -doubleArea;
   }
 
   // Precomputation for z interpolation formula:
   // z = v0.z + w1/doubleArea*(v1.z-v0.z) + w2/doubleArea*(v2.z-v0.z)
-  const float zz[3] = {
-    v0.z(),
-    (v1.z() - v0.z()) / doubleArea,
-    (v2.z() - v0.z()) / doubleArea,
-  };
+  const float z[3] = { v[0]->screen.z(), v[1]->screen.z(), v[2]->screen.z() };
+  triangle->zz[0] = z[0];
+  triangle->zz[1] = (z[1] - z[0]) / doubleArea;
+  triangle->zz[2] = (z[2] - z[0]) / doubleArea;
 
-  // Convert to fixed point
-  const Vector2FP iv0 = (v0.head<2>() - Vector2f(0.5f, 0.5f)).cast<FP>();
-  const Vector2FP iv1 = (v1.head<2>() - Vector2f(0.5f, 0.5f)).cast<FP>();
-  const Vector2FP iv2 = (v2.head<2>() - Vector2f(0.5f, 0.5f)).cast<FP>();
+  // Inside the triangle, both interpolation terms are at most as large as
+  // the corresponding depth differences.
+  triangle->minZ = std::min(std::min(z[0], z[1]), z[2])
+    - DepthErrorBound(std::abs(z[0]) + std::abs(z[1] - z[0])
+                      + std::abs(z[2] - z[0]));
 
   // Bounding box
-  AlignedBox<int, 2> box;
-  box.extend(Vector2i(iv0.x(), iv0.y()));
-  box.extend(Vector2i(iv1.x(), iv1.y()));
-  box.extend(Vector2i(iv2.x(), iv2.y()));
+  AlignedBox<int, 2>& box = triangle->box;
+  box.setEmpty();
+  for (int i = 0; i < 3; ++i) {
+    triangle->v[i] = v[i]->fixed;
+    box.extend(Vector2i(triangle->v[i].x(), triangle->v[i].y()));
+  }
   box = box.intersection(viewport_);
+  if (box.isEmpty()) {
+    if (statistics) {
+      ++statistics->trianglesRejected;
+    }
+    return 0;
+  }
 
+  if (varyingSetup) {
+    SetupVaryings(v, vertexVaryings, varyingSetup);
+  }
+  return 1;
+}
+
+void RastaManRenderer::SetupVaryings(const TransformedVertex* const* v,
+                                     const float* const* varyings,
+                                     VaryingSetup* setup) const {
+  // The planes are fitted to the fixed-point positions the edge functions
+  // use.  Attributes divided by w are affine in screen space, so that the
+  // rasterizer can step them with one addition per pixel.
+  Vector2f p[3];
+  for (int i = 0; i < 3; ++i) {
+    p[i] = Vector2f(v[i]->fixed.x().GetAs<float>(),
+                    v[i]->fixed.y().GetAs<float>());
+  }
+  const Vector2f e1 = p[1] - p[0];
+  const Vector2f e2 = p[2] - p[0];
+  const float det = e1.x()*e2.y() - e2.x()*e1.y();
+  // Triangles without area in fixed point get constant planes
+  const float invDet = det != 0.0f ? 1.0f / det : 0.0f;
+  auto fitPlane = [&] (float f0, float f1, float f2) {
+    const float d1 = f1 - f0;
+    const float d2 = f2 - f0;
+    return Vector3f(f0, (d1*e2.y() - d2*e1.y()) * invDet,
+                    (d2*e1.x() - d1*e2.x()) * invDet);
+  };
+
+  setup->origin = p[0];
+  setup->planes[0] = fitPlane(v[0]->invW, v[1]->invW, v[2]->invW);
+  for (int i = 0; i < varyingCount_; ++i) {
+    setup->planes[i + 1] = fitPlane(varyings[0][i] * v[0]->invW,
+                                    varyings[1][i] * v[1]->invW,
+                                    varyings[2][i] * v[2]->invW);
+  }
+}
+
+RastaManRenderer::Tile& RastaManRenderer::GetTile() {
+  static thread_local Tile tile;
+  return tile;
+}
+
+void RastaManRenderer::LoadTile(const AlignedBox<int, 2>& rect, Tile* tile) {
+  tile->rect = rect;
+  tile->statistics = PipelineStatistics();
+  if (state_.colorWrite) {
+    renderTarget_->GetBackBuffer()->ReadRect(rect, tile->color, kTileSize);
+  }
+  if (state_.depthTest || state_.depthWrite) {
+    renderTarget_->GetZBuffer()->ReadRect(rect, tile->depth, kTileSize);
+  }
+}
+
+void RastaManRenderer::StoreTile(const Tile& tile) {
+  if (state_.colorWrite) {
+    renderTarget_->GetBackBuffer()->WriteRect(tile.rect, tile.color,
+                                              kTileSize);
+  }
+  if (state_.depthWrite) {
+    renderTarget_->GetZBuffer()->WriteRect(tile.rect, tile.depth, kTileSize);
+  }
+}
+
+template<bool DepthTest, bool DepthWrite, bool ColorWrite, bool Shade,
+         bool Statistics>
+void RastaManRenderer::RasterizeTriangle(const TriangleSetup& triangle,
+                                         const VaryingSetup* varyings,
+                                         Tile* tile) {
+  const AlignedBox<int, 2> box = triangle.box.intersection(tile->rect);
   if (box.isEmpty()) {
     return;
   }
 
+  RenderSurface1f& hiZ = *renderTarget_->GetHiZBuffer();
+  const Vector4f color = (Vector4f() << triangle.color, 1.0f).finished();
+  // Counted in registers and added to the tile once
+  uint64_t pixelsVisited = 0;
+  uint64_t edgeTestPasses = 0;
+  uint64_t depthTestPasses = 0;
+  uint64_t depthTestFailures = 0;
+  uint64_t fragmentsShaded = 0;
+
+  // Reject the whole triangle if it lies behind everything in its box
+  if (DepthTest) {
+    const AlignedBox<int, 2> blocks(box.min() / kBlockSize,
+                                    box.max() / kBlockSize);
+    float maxZ = 0.0f;
+    for (int y = blocks.min().y(); y <= blocks.max().y(); ++y) {
+      for (int x = blocks.min().x(); x <= blocks.max().x(); ++x) {
+        maxZ = std::max(maxZ, hiZ(x, y));
+      }
+    }
+    if (triangle.minZ >= maxZ) {
+      return;
+    }
+  }
+
+  const Vector2FP& iv0 = triangle.v[0];
+  const Vector2FP& iv1 = triangle.v[1];
+  const Vector2FP& iv2 = triangle.v[2];
+  const float* zz = triangle.zz;
+
   // Bias for fill rule
   static const FP eps = std::numeric_limits<FP>::epsilon();
-  const Vector3FP bias(
+  Vector3FP bias(
     IsTopLeft(iv1, iv2) ? FP(0) : eps,
     IsTopLeft(iv2, iv0) ? FP(0) : eps,
     IsTopLeft(iv0, iv1) ? FP(0) : eps);
@@ -139,79 +935,595 @@ void RastaManRenderer::RasterizeTriangle(
     iv2.x() - iv0.x(),
     iv0.x() - iv1.x());
 
-  // Base values
-  Vector2i p(box.min());
-  Vector3FP row(
-    Orient2D<FP>(iv1, iv2, p.cast<FP>()),
-    Orient2D<FP>(iv2, iv0, p.cast<FP>()),
-    Orient2D<FP>(iv0, iv1, p.cast<FP>()));
+  // Conservative rasterization moves the edges inwards by half a pixel in
+  // both directions, so that they pass the pixel center only if they pass
+  // its whole square, and moves depth back by its largest change from the
+  // center of a pixel to a corner.
+  float zBias = 0.0f;
+  if (state_.conservativeRaster) {
+    for (int i = 0; i < 3; ++i) {
+      bias[i] += FP::FromRaw((std::abs(pixelInc[i].GetRaw())
+                              + std::abs(rowInc[i].GetRaw()) + 1) / 2);
+    }
+    const float dzdx = pixelInc[1].GetAs<float>()*zz[1]
+      + pixelInc[2].GetAs<float>()*zz[2];
+    const float dzdy = rowInc[1].GetAs<float>()*zz[1]
+      + rowInc[2].GetAs<float>()*zz[2];
+    zBias = .5f * (std::abs(dzdx) + std::abs(dzdy));
+    zBias += DepthErrorBound(std::abs(zz[0]) + zBias);
+  }
+
+  // Base values.  The edge functions are evaluated exactly, so the value at
+  // any pixel is the base value plus integer multiples of the increments.
+  const Vector3FP base(
+    Orient2D<FP>(iv1, iv2, box.min().cast<FP>()),
+    Orient2D<FP>(iv2, iv0, box.min().cast<FP>()),
+    Orient2D<FP>(iv0, iv1, box.min().cast<FP>()));
+
+  // Pixels are tested in groups of kSimdWidth horizontally adjacent pixels.
+  // Lane i of a group holds the edge function values of pixel x + i.
+  SimdInt laneOffset[3];
+  SimdInt groupInc[3];
+  SimdInt laneBias[3];
+  for (int i = 0; i < 3; ++i) {
+    int32_t offsets[kSimdWidth];
+    for (int lane = 0; lane < kSimdWidth; ++lane) {
+      offsets[lane] = lane * pixelInc[i].GetRaw();
+    }
+    laneOffset[i] = SimdLoad(offsets);
+    groupInc[i] = SimdSet(kSimdWidth * pixelInc[i].GetRaw());
+    laneBias[i] = SimdSet(bias[i].GetRaw());
+  }
+  // Same as FP::GetAs<float>(), which divides by a power of two
+  const SimdFloat toFloat = SimdSet(1.0f / (1 << FP::frac_bits));
+  const SimdFloat z0 = SimdSet(zz[0] + zBias);
+  const SimdFloat z1 = SimdSet(zz[1]);
+  const SimdFloat z2 = SimdSet(zz[2]);
 
-  for (; p.y() <= box.max().y(); ++p.y()) {
-    auto w = row;
-    for (p.x() = box.min().x(); p.x() <= box.max().x(); ++p.x()) {
-      if (w[0] >= bias[0] && w[1] >= bias[1] && w[2] >= bias[2]) {
-        // p is in triangle
-        const float z = v0.z() + w[1].GetAs<float>()*zz[1]
-          + w[2].GetAs<float>()*zz[2];
-        callback((Vector3f() << p.cast<float>(), z).finished());
+  // Varyings are stepped incrementally, by one addition per pixel group and
+  // per row, starting over from the plane equations in every block.
+  const int planeCount = Shade ? varyingCount_ + 1 : 0;
+  SimdFloat planeLane[kMaxVaryings + 1];
+  SimdFloat planeStep[kMaxVaryings + 1];
+  if (Shade) {
+    float lanes[kSimdWidth];
+    for (int lane = 0; lane < kSimdWidth; ++lane) {
+      lanes[lane] = static_cast<float>(lane);
+    }
+    const SimdFloat laneIndex = SimdLoad(lanes);
+    for (int i = 0; i < planeCount; ++i) {
+      planeLane[i] = laneIndex * SimdSet(varyings->planes[i].y());
+      planeStep[i] = SimdSet(kSimdWidth * varyings->planes[i].y());
+    }
+  }
+  const SimdFloat one = SimdSet(1.0f);
+
+  // Without shading, the blocks left after the coarse tests are collected
+  // and tested at once by the kernels of the CPU
+  const int kMaxBlocks = (kTileSize / kBlockSize) * (kTileSize / kBlockSize);
+  TriangleRaster raster;
+  BlockRaster blocks[kMaxBlocks];
+  int blockCount = 0;
+  if (!Shade) {
+    for (int i = 0; i < 3; ++i) {
+      raster.pixelInc[i] = pixelInc[i].GetRaw();
+      raster.rowInc[i] = rowInc[i].GetRaw();
+      raster.bias[i] = bias[i].GetRaw();
+    }
+    raster.z[0] = zz[0] + zBias;
+    raster.z[1] = zz[1];
+    raster.z[2] = zz[2];
+    raster.toFloat = 1.0f / (1 << FP::frac_bits);
+    raster.depthStride = kTileSize;
+  }
+
+  // Walk the bounding box in screen-aligned blocks.  As the edge functions
+  // are affine, their extremes over a block lie at its corners: a block is
+  // skipped if all corners fail one edge, and fully covered blocks need no
+  // per-pixel edge tests.
+  const int blockMask = ~(kBlockSize - 1);
+  for (int by = box.min().y() & blockMask; by <= box.max().y();
+       by += kBlockSize) {
+    const int y0 = std::max(by, box.min().y());
+    const int y1 = std::min(by + kBlockSize - 1, box.max().y());
+
+    for (int bx = box.min().x() & blockMask; bx <= box.max().x();
+         bx += kBlockSize) {
+      const int x0 = std::max(bx, box.min().x());
+      const int x1 = std::min(bx + kBlockSize - 1, box.max().x());
+
+      int64_t c00[3], dx[3], dy[3];
+      bool outside = false;
+      bool inside = true;
+      for (int i = 0; i < 3; ++i) {
+        c00[i] = base[i].GetRaw()
+          + static_cast<int64_t>(x0 - box.min().x()) * pixelInc[i].GetRaw()
+          + static_cast<int64_t>(y0 - box.min().y()) * rowInc[i].GetRaw();
+        dx[i] = static_cast<int64_t>(x1 - x0) * pixelInc[i].GetRaw();
+        dy[i] = static_cast<int64_t>(y1 - y0) * rowInc[i].GetRaw();
+        const int64_t minValue = c00[i] + std::min<int64_t>(dx[i], 0)
+          + std::min<int64_t>(dy[i], 0);
+        const int64_t maxValue = c00[i] + std::max<int64_t>(dx[i], 0)
+          + std::max<int64_t>(dy[i], 0);
+        outside = outside || maxValue < bias[i].GetRaw();
+        inside = inside && minValue >= bias[i].GetRaw();
+      }
+      if (outside) {
+        continue;
+      }
+
+      // Hierarchical depth test.  Depth is affine as well, so its minimum
+      // over the block is found at one of the corners.
+      const int blockX = bx / kBlockSize;
+      const int blockY = by / kBlockSize;
+      if (DepthTest) {
+        float blockMinZ = FLT_MAX;
+        float magnitude = 0.0f;
+        for (int j = 0; j < 4; ++j) {
+          const FP w1 = FP::FromRaw(static_cast<int32_t>(
+            c00[1] + (j & 1 ? dx[1] : 0) + (j & 2 ? dy[1] : 0)));
+          const FP w2 = FP::FromRaw(static_cast<int32_t>(
+            c00[2] + (j & 1 ? dx[2] : 0) + (j & 2 ? dy[2] : 0)));
+          const float t1 = w1.GetAs<float>() * zz[1];
+          const float t2 = w2.GetAs<float>() * zz[2];
+          blockMinZ = std::min(blockMinZ, zz[0] + t1 + t2);
+          magnitude = std::max(magnitude,
+                               std::abs(zz[0]) + std::abs(t1) + std::abs(t2));
+        }
+        if (blockMinZ - DepthErrorBound(magnitude) >= hiZ(blockX, blockY)) {
+          continue;
+        }
+      }
+      if (Statistics) {
+        pixelsVisited += (x1 - x0 + 1) * (y1 - y0 + 1);
+      }
+
+      bool written = false;
+      if (Shade) {
+        // Quads are aligned to even coordinates.  Their pixels outside the
+        // box are helpers that are interpolated but never written.
+        const int qx0 = x0 & ~1;
+        const int qy0 = y0 & ~1;
+        const int qx1 = x1 | 1;
+        const uint32_t boxColumns =
+          ((2u << (x1 - qx0)) - 1) & ~((1u << (x0 - qx0)) - 1);
+        float planeRow[kMaxVaryings + 1];
+        const Vector2f offset =
+          Vector2f(static_cast<float>(qx0), static_cast<float>(qy0))
+          - varyings->origin;
+        for (int i = 0; i < planeCount; ++i) {
+          const Vector3f& plane = varyings->planes[i];
+          planeRow[i] =
+            plane.x() + plane.y()*offset.x() + plane.z()*offset.y();
+        }
+
+        FragmentQuad quads[kBlockSize*kBlockSize/4];
+        int quadCount = 0;
+        for (int qy = qy0; qy <= y1; qy += 2) {
+          // Coverage, depth and varyings of both rows of the quads, with
+          // pixel qx0 + i in bit or element i
+          uint32_t rowCoverage[2];
+          float rowZ[2][kBlockSize + kSimdWidth];
+          float rowVaryings[2][kMaxVaryings][kBlockSize + kSimdWidth];
+          for (int r = 0; r < 2; ++r) {
+            const int y = qy + r;
+            int32_t start[3];
+            for (int i = 0; i < 3; ++i) {
+              start[i] = static_cast<int32_t>(c00[i]
+                + static_cast<int64_t>(qx0 - x0) * pixelInc[i].GetRaw()
+                + static_cast<int64_t>(y - y0) * rowInc[i].GetRaw());
+            }
+            SimdInt w0 = SimdSet(start[0]) + laneOffset[0];
+            SimdInt w1 = SimdSet(start[1]) + laneOffset[1];
+            SimdInt w2 = SimdSet(start[2]) + laneOffset[2];
+            SimdFloat planeValue[kMaxVaryings + 1];
+            for (int i = 0; i < planeCount; ++i) {
+              planeValue[i] = SimdSet(planeRow[i]) + planeLane[i];
+            }
+            uint32_t coverage = 0;
+            for (int x = qx0; x <= qx1; x += kSimdWidth) {
+              const int lane = x - qx0;
+              coverage |= SimdBits((w0 >= laneBias[0]) & (w1 >= laneBias[1])
+                                   & (w2 >= laneBias[2])) << lane;
+              SimdStore(&rowZ[r][lane], z0 + SimdToFloat(w1)*toFloat*z1
+                                        + SimdToFloat(w2)*toFloat*z2);
+              // Perspective correction with one division per pixel
+              const SimdFloat w = one / planeValue[0];
+              for (int i = 1; i < planeCount; ++i) {
+                SimdStore(&rowVaryings[r][i - 1][lane], planeValue[i] * w);
+              }
+
+              w0 = w0 + groupInc[0];
+              w1 = w1 + groupInc[1];
+              w2 = w2 + groupInc[2];
+              for (int i = 0; i < planeCount; ++i) {
+                planeValue[i] = planeValue[i] + planeStep[i];
+              }
+            }
+            rowCoverage[r] = y < y0 || y > y1 ? 0 :
+              (inside ? ~0u : coverage) & boxColumns;
+            if (Statistics) {
+              edgeTestPasses += CountBits(rowCoverage[r]);
+            }
+            for (int i = 0; i < planeCount; ++i) {
+              planeRow[i] += varyings->planes[i].z();
+            }
+          }
+
+          for (int qx = qx0; qx <= x1; qx += 2) {
+            const int column = qx - qx0;
+            const uint32_t coverage = (rowCoverage[0] >> column & 3)
+              | (rowCoverage[1] >> column & 3) << 2;
+            if (!coverage) {
+              continue;
+            }
+
+            // Early depth test, as shaders cannot change depth or discard
+            FragmentQuad& quad = quads[quadCount];
+            uint32_t mask = 0;
+            for (int j = 0; j < 4; ++j) {
+              const float fragmentZ = rowZ[j >> 1][column + (j & 1)];
+              quad.z[j] = fragmentZ;
+              if (!(coverage & (1u << j))
+                  || !(0 <= fragmentZ && fragmentZ <= 1)) {
+                continue;
+              }
+              float& depth = tile->depth[
+                (qy + (j >> 1) - tile->rect.min().y())*kTileSize
+                + (qx + (j & 1) - tile->rect.min().x())];
+              if (DepthTest && !(fragmentZ < depth)) {
+                if (Statistics) {
+                  ++depthTestFailures;
+                }
+                continue;
+              }
+              if (Statistics) {
+                ++depthTestPasses;
+              }
+              if (DepthWrite) {
+                depth = fragmentZ;
+                written = true;
+              }
+              mask |= 1u << j;
+            }
+            if (!mask) {
+              continue;
+            }
+
+            quad.x = qx;
+            quad.y = qy;
+            quad.mask = mask;
+            for (int i = 0; i < varyingCount_; ++i) {
+              for (int j = 0; j < 4; ++j) {
+                quad.varyings[i][j] =
+                  rowVaryings[j >> 1][i][column + (j & 1)];
+              }
+            }
+            ++quadCount;
+          }
+        }
+        if (quadCount) {
+          quadShader_(fragmentShader_, quads, quadCount, tile);
+          if (Statistics) {
+            fragmentsShaded += 4 * quadCount;
+          }
+        }
+      } else {
+        // The kernel tests the whole block, masked to the box
+        BlockRaster& block = blocks[blockCount++];
+        const uint32_t boxColumns =
+          ((2u << (x1 - bx)) - 1) & ~((1u << (x0 - bx)) - 1);
+        block.mask = 0;
+        for (int y = y0; y <= y1; ++y) {
+          block.mask |= static_cast<uint64_t>(boxColumns)
+            << (y - by)*kBlockSize;
+        }
+        for (int i = 0; i < 3; ++i) {
+          block.edge[i] = static_cast<int32_t>(c00[i]
+            - static_cast<int64_t>(x0 - bx) * pixelInc[i].GetRaw()
+            - static_cast<int64_t>(y0 - by) * rowInc[i].GetRaw());
+        }
+        block.flags = (inside ? BLOCK_INSIDE : 0)
+          | (DepthTest ? BLOCK_DEPTH_TEST : 0)
+          | (DepthWrite ? BLOCK_DEPTH_WRITE : 0);
+        block.depth = tile->depth + (by - tile->rect.min().y())*kTileSize
+          + (bx - tile->rect.min().x());
+      }
+
+      if (written) {
+        UpdateHiZ(*tile, blockX, blockY);
+      }
+    }
+  }
+
+  if (blockCount) {
+    BlockCoverage coverages[kMaxBlocks];
+    GetCpuKernels().rasterizeBlocks(raster, blocks, blockCount, coverages);
+    for (int b = 0; b < blockCount; ++b) {
+      const BlockCoverage& coverage = coverages[b];
+      const int blockOffset = static_cast<int>(blocks[b].depth - tile->depth);
+      if (Statistics) {
+        edgeTestPasses += CountBits(coverage.covered);
+        depthTestPasses += CountBits(coverage.passed);
+        depthTestFailures += CountBits(coverage.tested & ~coverage.passed);
+        fragmentsShaded += ColorWrite ? CountBits(coverage.passed) : 0;
+      }
+      if (ColorWrite && coverage.passed) {
+        for (int y = 0; y < kBlockSize; ++y) {
+          const uint32_t rowPassed = static_cast<uint32_t>(
+            coverage.passed >> y*kBlockSize) & ((1u << kBlockSize) - 1);
+          Vector4f* row = tile->color + blockOffset + y*kTileSize;
+          for (int x = 0; rowPassed >> x; ++x) {
+            if (rowPassed >> x & 1) {
+              row[x] = color;
+            }
+          }
+        }
       }
-      w += pixelInc;
+      if (DepthWrite && coverage.passed) {
+        const Vector2i pixel = tile->rect.min()
+          + Vector2i(blockOffset % kTileSize, blockOffset / kTileSize);
+        UpdateHiZ(*tile, pixel.x() / kBlockSize, pixel.y() / kBlockSize);
+      }
+    }
+  }
+
+  if (Statistics) {
+    PipelineStatistics& statistics = tile->statistics;
+    statistics.pixelsVisited += pixelsVisited;
+    statistics.edgeTestPasses += edgeTestPasses;
+    statistics.depthTestPasses += depthTestPasses;
+    statistics.depthTestFailures += depthTestFailures;
+    statistics.fragmentsShaded += fragmentsShaded;
+  }
+}
+
+RastaManRenderer::Rasterizer RastaManRenderer::GetRasterizer() const {
+  // Only colors are shaded, so draws without color writes always take the
+  // flat path.  Counting statistics is a separate instantiation, so that it
+  // costs nothing while disabled.
+  static const Rasterizer kRasterizers[2][12] = {
+    {
+      &RastaManRenderer::RasterizeTriangle<false, false, false, false,
+                                           false>,
+      &RastaManRenderer::RasterizeTriangle<true, false, false, false,
+                                           false>,
+      &RastaManRenderer::RasterizeTriangle<false, true, false, false,
+                                           false>,
+      &RastaManRenderer::RasterizeTriangle<true, true, false, false,
+                                           false>,
+      &RastaManRenderer::RasterizeTriangle<false, false, true, false,
+                                           false>,
+      &RastaManRenderer::RasterizeTriangle<true, false, true, false,
+                                           false>,
+      &RastaManRenderer::RasterizeTriangle<false, true, true, false,
+                                           false>,
+      &RastaManRenderer::RasterizeTriangle<true, true, true, false,
+                                           false>,
+      &RastaManRenderer::RasterizeTriangle<false, false, true, true,
+                                           false>,
+      &RastaManRenderer::RasterizeTriangle<true, false, true, true,
+                                           false>,
+      &RastaManRenderer::RasterizeTriangle<false, true, true, true,
+                                           false>,
+      &RastaManRenderer::RasterizeTriangle<true, true, true, true,
+                                           false>,
+    },
+    {
+      &RastaManRenderer::RasterizeTriangle<false, false, false, false,
+                                           true>,
+      &RastaManRenderer::RasterizeTriangle<true, false, false, false,
+                                           true>,
+      &RastaManRenderer::RasterizeTriangle<false, true, false, false,
+                                           true>,
+      &RastaManRenderer::RasterizeTriangle<true, true, false, false,
+                                           true>,
+      &RastaManRenderer::RasterizeTriangle<false, false, true, false,
+                                           true>,
+      &RastaManRenderer::RasterizeTriangle<true, false, true, false,
+                                           true>,
+      &RastaManRenderer::RasterizeTriangle<false, true, true, false,
+                                           true>,
+      &RastaManRenderer::RasterizeTriangle<true, true, true, false,
+                                           true>,
+      &RastaManRenderer::RasterizeTriangle<false, false, true, true,
+                                           true>,
+      &RastaManRenderer::RasterizeTriangle<true, false, true, true,
+                                           true>,
+      &RastaManRenderer::RasterizeTriangle<false, true, true, true,
+                                           true>,
+      &RastaManRenderer::RasterizeTriangle<true, true, true, true,
+                                           true>,
+    },
+  };
+  const Rasterizer* rasterizers = kRasterizers[statisticsEnabled_ ? 1 : 0];
+  const int depthFlags = (state_.depthTest ? 1 : 0) |
+                         (state_.depthWrite ? 2 : 0);
+  if (state_.colorWrite && quadShader_) {
+    return rasterizers[8 + depthFlags];
+  }
+  return rasterizers[depthFlags | (state_.colorWrite ? 4 : 0)];
+}
+
+void RastaManRenderer::UpdateHiZ(const Tile& tile, int blockX, int blockY) {
+  // Tiles are made of whole blocks
+  const int x0 = blockX * kBlockSize;
+  const int y0 = blockY * kBlockSize;
+  const int x1 = std::min(x0 + kBlockSize - 1, tile.rect.max().x());
+  const int y1 = std::min(y0 + kBlockSize - 1, tile.rect.max().y());
+
+  const int minX = tile.rect.min().x();
+  const int minY = tile.rect.min().y();
+  float maxZ = 0.0f;
+  for (int y = y0; y <= y1; ++y) {
+    for (int x = x0; x <= x1; ++x) {
+      maxZ = std::max(maxZ, tile.depth[(y - minY)*kTileSize + (x - minX)]);
     }
-    row += rowInc;
   }
+  (*renderTarget_->GetHiZBuffer())(blockX, blockY) = maxZ;
 }
 
 void RastaManRenderer::DrawTriangle(const Vector4f& v0,
                                     const Vector4f& v1,
                                     const Vector4f& v2) {
-  auto normal =
-    (v1 - v0).head<3>().cross((v2 - v0).head<3>()).normalized();
-  normal = normal*.5f + Vector3f::Constant(.5f);
-
-  /*
-   * Projection
-   */
-  const Vector4f clip[3] = {
-    ProcessVertex(v0),
-    ProcessVertex(v1),
-    ProcessVertex(v2)
-  };
+  TraceScope scope("DrawTriangle");
+  const auto surface = renderTarget_->GetBackBuffer();
+  const Vector2i surfaceMax(surface->GetWidth() - 1, surface->GetHeight() - 1);
 
-  /*
-   * TODO: Clipping?
-   */
-
-  /*
-   * Dehomogenization
-   */
-  const Vector4f ndc[3] = {
-    clip[0] / clip[0].w(),
-    clip[1] / clip[1].w(),
-    clip[2] / clip[2].w()
-  };
-
-  /*
-   * Viewport transform
-   */
-  Vector3f c[3];
-  for (int i = 0; i < 3; ++i) {
-    c[i] = ndc[i].head<3>().cwiseProduct(viewportScale_) + viewportBias_;
+  SetVertexAttributes(VertexAttributes());
+  quadShader_ = nullptr;
+  std::vector<TriangleSetup> setups(1);
+  PipelineStatistics statistics;
+  statistics.verticesTransformed = 3;
+  statistics.trianglesSubmitted = 1;
+  int setupCount = SetupTriangle(TransformVertex(v0), TransformVertex(v1),
+                                 TransformVertex(v2), nullptr, &setups[0],
+                                 nullptr, &statistics);
+  if (setupCount < 0) {
+    ++statistics.trianglesClipped;
+    setupCount = ClipTriangle(ProcessVertex(v0), ProcessVertex(v1),
+                              ProcessVertex(v2), nullptr, &setups, nullptr);
   }
+  const Vector3f color = FaceColor(v0.head<3>(), v1.head<3>(), v2.head<3>());
+  Tile& tile = GetTile();
+  for (int i = 0; i < setupCount; ++i) {
+    setups[i].color = color;
+    const AlignedBox<int, 2> box = setups[i].box.intersection(
+      AlignedBox<int, 2>(Vector2i(0, 0), surfaceMax));
+    if (box.isEmpty()) {
+      continue;
+    }
+    for (int y = box.min().y() / kTileSize; y <= box.max().y() / kTileSize;
+         ++y) {
+      for (int x = box.min().x() / kTileSize; x <= box.max().x() / kTileSize;
+           ++x) {
+        const Vector2i tileMin(x * kTileSize, y * kTileSize);
+        const Vector2i tileMax =
+          (tileMin + Vector2i::Constant(kTileSize - 1)).cwiseMin(surfaceMax);
+        const PerfCounts counts = BeginStage();
+        LoadTile(AlignedBox<int, 2>(tileMin, tileMax), &tile);
+        (this->*GetRasterizer())(setups[i], nullptr, &tile);
+        StoreTile(tile);
+        EndStage(STAGE_RASTER, counts);
+        statistics += tile.statistics;
+      }
+    }
+  }
+  if (statisticsEnabled_) {
+    AddStatistics(statistics);
+  }
+}
+
+bool RastaManRenderer::IsVisible(const AlignedBox<int, 2>& rect,
+                                 float minZ) const {
+  return IsRectVisible(*renderTarget_->GetZBuffer(),
+                       *renderTarget_->GetHiZBuffer(), rect, minZ);
+}
 
-  /*
-   * Rasterization
-   */
-  RasterizeTriangle(c[0], c[1], c[2], [&] (const Vector3f& fragment) {
-    Vector2i pixel = fragment.head<2>().cast<int>();
-    float& zBuffer = (*renderTarget_->GetZBuffer())(pixel.x(), pixel.y());
+bool RastaManRenderer::IsVisible(const AlignedBox3f& box) const {
+  return IsBoxVisible(*renderTarget_->GetZBuffer(),
+                      *renderTarget_->GetHiZBuffer(), box);
+}
 
-    if (fragment.z() < zBuffer && 0 <= fragment.z() && fragment.z() <= 1) {
-      Vector4f& backBuffer = (*renderTarget_->GetBackBuffer())(pixel.x(),
-                                                               pixel.y());
-      const auto color = ProcessFragment(fragment);
-      //backBuffer = color;
-      backBuffer = (Vector4f() << normal, 1.0f).finished();
-      zBuffer = fragment.z();
+void RastaManRenderer::IsVisible(const AlignedBox3f* boxes, int count,
+                                 bool* visible) {
+  const auto zBuffer = renderTarget_->GetZBuffer();
+  const auto hiZ = renderTarget_->GetHiZBuffer();
+  const int kQueryBatchSize = 256;
+  const int batchCount = (count + kQueryBatchSize - 1) / kQueryBatchSize;
+  threadPool_.ParallelFor(batchCount, [&] (int batch) {
+    TraceScope scope("IsVisible");
+    const int end = std::min((batch + 1) * kQueryBatchSize, count);
+    for (int i = batch * kQueryBatchSize; i < end; ++i) {
+      visible[i] = IsBoxVisible(*zBuffer, *hiZ, boxes[i]);
     }
   });
 }
+
+bool RastaManRenderer::IsRectVisible(const IDepthSurface& zBuffer,
+                                     const RenderSurface1f& hiZ,
+                                     const AlignedBox<int, 2>& rect,
+                                     float minZ) const {
+  const AlignedBox<int, 2> surface(
+    Vector2i(0, 0), Vector2i(zBuffer.GetWidth() - 1, zBuffer.GetHeight() - 1));
+  const AlignedBox<int, 2> pixels = rect.intersection(surface);
+  if (pixels.isEmpty()) {
+    return false;
+  }
+
+  // Blocks whose farthest depth is nearer are occluded as a whole.  As the
+  // Hi-Z buffer holds the farthest depth of every block, blocks inside the
+  // rect are visible otherwise, and only the partially covered blocks at
+  // its border are tested pixel by pixel.
+  for (int by = pixels.min().y() / kBlockSize;
+       by <= pixels.max().y() / kBlockSize; ++by) {
+    for (int bx = pixels.min().x() / kBlockSize;
+         bx <= pixels.max().x() / kBlockSize; ++bx) {
+      if (!(minZ < hiZ(bx, by))) {
+        continue;
+      }
+      const AlignedBox<int, 2> wholeBlock = surface.intersection(
+        AlignedBox<int, 2>(Vector2i(bx, by) * kBlockSize,
+                           Vector2i(bx, by) * kBlockSize
+                           + Vector2i::Constant(kBlockSize - 1)));
+      if (pixels.contains(wholeBlock)) {
+        return true;
+      }
+      const AlignedBox<int, 2> block = pixels.intersection(wholeBlock);
+      float depth[kBlockSize*kBlockSize];
+      zBuffer.ReadRect(block, depth, kBlockSize);
+      const Vector2i size = block.sizes() + Vector2i::Ones();
+      for (int y = 0; y < size.y(); ++y) {
+        for (int x = 0; x < size.x(); ++x) {
+          if (minZ < depth[y*kBlockSize + x]) {
+            return true;
+          }
+        }
+      }
+    }
+  }
+  return false;
+}
+
+bool RastaManRenderer::IsBoxVisible(const IDepthSurface& zBuffer,
+                                    const RenderSurface1f& hiZ,
+                                    const AlignedBox3f& box) const {
+  // The corners are the clip-space center plus or minus each half axis
+  const Vector4f center = modelViewProjectionMatrix_
+    * (Vector4f() << box.center(), 1.0f).finished();
+  const Vector3f halfSize = box.sizes() * .5f;
+  Vector4f axes[3];
+  for (int i = 0; i < 3; ++i) {
+    axes[i] = modelViewProjectionMatrix_.col(i) * halfSize[i];
+  }
+
+  AlignedBox2f bounds;
+  float minZ = FLT_MAX;
+  for (int i = 0; i < 8; ++i) {
+    const Vector4f clip = center + (i & 1 ? axes[0] : -axes[0])
+      + (i & 2 ? axes[1] : -axes[1]) + (i & 4 ? axes[2] : -axes[2]);
+    if (!(clip.w() > 0 && clip.z() >= -clip.w())) {
+      return true;
+    }
+    const Vector3f screen = (clip.head<3>() * (1.0f / clip.w()))
+      .cwiseProduct(viewportScale_) + viewportBias_;
+    bounds.extend(screen.head<2>());
+    minZ = std::min(minZ, screen.z());
+  }
+
+  // Every pixel whose square the bounds touch.  Bounds far outside the
+  // render target are clamped before conversion.
+  const Vector2f limit(static_cast<float>(zBuffer.GetWidth()),
+                       static_cast<float>(zBuffer.GetHeight()));
+  const Vector2f lower =
+    bounds.min().cwiseMax(Vector2f::Constant(-1.0f)).cwiseMin(limit);
+  const Vector2f upper =
+    bounds.max().cwiseMax(Vector2f::Constant(-1.0f)).cwiseMin(limit);
+  return IsRectVisible(
+    zBuffer, hiZ,
+    AlignedBox<int, 2>(Vector2i(static_cast<int>(std::floor(lower.x())),
+                                static_cast<int>(std::floor(lower.y()))),
+                       Vector2i(static_cast<int>(std::floor(upper.x())),
+                                static_cast<int>(std::floor(upper.y())))),
+    minZ);
+}
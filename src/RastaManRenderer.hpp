@@ -1,19 +1,113 @@
 #ifndef RASTAMANRENDERER_HPP
 #define RASTAMANRENDERER_HPP
 
+#include "FixedPoint.hpp"
 #include "IRenderer.hpp"
+#include "PerfCounters.hpp"
 #include "RenderTarget.hpp"
+#include "Shader.hpp"
+#include "Telemetry.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
 
 #include "Eigen/Core"
 #include "Eigen/Geometry"
 
 #include "boost/noncopyable.hpp"
 
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <vector>
 
+enum CullMode {
+  CULL_NONE,
+  CULL_BACK,
+  CULL_FRONT
+};
+
+// Fixed-function state.  Every combination of the per-fragment flags selects
+// a separately compiled rasterizer.
+struct PipelineState {
+  PipelineState()
+    : depthTest(true), depthWrite(true), colorWrite(true),
+      conservativeRaster(false), cullMode(CULL_BACK) {
+  }
+
+  bool depthTest;
+  bool depthWrite;
+  bool colorWrite;
+  // Only pixels completely inside a triangle are written, with the farthest
+  // depth of the triangle within the pixel.  Occluders drawn like this into
+  // a low-resolution render target never hide more than at full resolution.
+  // Pixels covered only by several triangles together stay empty, so this
+  // suits simplified occluder meshes with large triangles.
+  bool conservativeRaster;
+  CullMode cullMode;
+};
+
+// Work done by the stages of the pipeline.  Every submitted triangle is
+// either culled, rejected, clipped or set up directly.  Pixels in blocks
+// skipped as a whole, by the edge functions or the Hi-Z buffer, are not
+// visited.
+struct PipelineStatistics {
+  PipelineStatistics()
+    : verticesTransformed(0), trianglesSubmitted(0), trianglesCulled(0),
+      trianglesClipped(0), trianglesRejected(0), pixelsVisited(0),
+      edgeTestPasses(0), depthTestPasses(0), depthTestFailures(0),
+      fragmentsShaded(0) {
+  }
+
+  PipelineStatistics& operator+=(const PipelineStatistics& other) {
+    verticesTransformed += other.verticesTransformed;
+    trianglesSubmitted += other.trianglesSubmitted;
+    trianglesCulled += other.trianglesCulled;
+    trianglesClipped += other.trianglesClipped;
+    trianglesRejected += other.trianglesRejected;
+    pixelsVisited += other.pixelsVisited;
+    edgeTestPasses += other.edgeTestPasses;
+    depthTestPasses += other.depthTestPasses;
+    depthTestFailures += other.depthTestFailures;
+    fragmentsShaded += other.fragmentsShaded;
+    return *this;
+  }
+
+  uint64_t verticesTransformed;
+  uint64_t trianglesSubmitted;
+  uint64_t trianglesCulled;     // Facing away or without area
+  uint64_t trianglesClipped;    // Crossing the near plane or the guard band
+  uint64_t trianglesRejected;   // Outside the view frustum or the viewport
+  uint64_t pixelsVisited;       // Tested against the edges of a triangle
+  uint64_t edgeTestPasses;      // Visited pixels inside the triangle
+  uint64_t depthTestPasses;     // Including all with the depth test off
+  uint64_t depthTestFailures;
+  uint64_t fragmentsShaded;     // Colors computed, including helper pixels
+};
+
+// Stages of the pipeline with hardware counters of their own
+enum PipelineStage {
+  STAGE_CLEAR,
+  STAGE_VERTEX,
+  STAGE_SETUP,
+  STAGE_RASTER,
+  STAGE_COUNT
+};
+
 class RastaManRenderer : public boost::noncopyable, public IRenderer {
  public:
+  // Edge length of the square screen-space tiles triangles are binned into.
+  static const int kTileSize = 64;
+  // Largest distance of a vertex from the viewport center in pixels.  Twice
+  // the squared extent must fit into the 23 integer bits of FP.  Larger
+  // viewports are clipped at their edges, and triangles too large for FP are
+  // split by ClipTriangle.
+  static const int kGuardBand = 1000;
+  // Edge length of the blocks tiles are traversed in, one Hi-Z entry each.
+  static const int kBlockSize = RenderTarget::kHiZBlockSize;
+  // Floats interpolated across triangles, enough for all vertex attributes
+  static const int kMaxVaryings = ::kMaxVaryings;
+
   RastaManRenderer(std::shared_ptr<RenderTarget> rt);
   ~RastaManRenderer();
 
@@ -26,21 +120,206 @@ class RastaManRenderer : public boost::noncopyable, public IRenderer {
 
   void SetRenderTarget(std::shared_ptr<RenderTarget> rt);
 
+  void SetPipelineState(const PipelineState& state);
+  const PipelineState& GetPipelineState() const;
+
+  // Statistics are only counted while enabled.  Otherwise the rasterizer
+  // runs without any counting code.
+  void SetStatisticsEnabled(bool enabled);
+  bool IsStatisticsEnabled() const;
+  // Work done since the last reset, e.g. in the current frame
+  PipelineStatistics GetStatistics() const;
+  void ResetStatistics();
+
+  // Hardware counters of the stages on all threads, see PerfCounters.  They
+  // are read at the start and end of every task, which takes two system
+  // calls, so they are only counted while enabled.
+  void SetPerfCountersEnabled(bool enabled);
+  bool IsPerfCountersEnabled() const;
+  // Counts since the last reset
+  PerfCounts GetPerfCounts(PipelineStage stage) const;
+  void ResetPerfCounts();
+  // Name in lower case, for reports.  While Telemetry is enabled, the
+  // duration of every stage of a draw is recorded under its name.
+  static const char* GetStageName(PipelineStage stage);
+
+  void DrawTriangles(const Eigen::Vector3f* vertices,
+                     const int* indices,
+                     int count);
+  // Interpolates the given attributes perspective-correctly across the
+  // triangles and passes them to the fragment stage.
   void DrawTriangles(const Eigen::Vector3f* vertices,
+                     const VertexAttributes& attributes,
                      const int* indices,
                      int count);
 
+  // Draws indexed triangles with user shaders, see Shader.hpp.  Vertices are
+  // numbered 0 up to the largest index, and fragments are shaded in quads.
+  template<class VertexShader, class FragmentShader>
+  void Draw(const VertexShader& vertexShader,
+            const FragmentShader& fragmentShader,
+            const int* indices,
+            int count);
+
   void DrawTriangle(const Eigen::Vector4f& v0,
                     const Eigen::Vector4f& v1,
                     const Eigen::Vector4f& v2);
 
+  // Occlusion queries against the depth of everything drawn since the last
+  // clear.  For culling, occluders are drawn without color writes and with
+  // conservativeRaster into a small render target, preferably PIXEL_D32F,
+  // and with the projection of the main view.
+
+  // Returns whether any pixel of rect has a depth farther than minZ.
+  // Pixels outside the render target are never visible.
+  bool IsVisible(const Eigen::AlignedBox<int, 2>& rect, float minZ) const;
+  // Tests the screen-space bounds of a box in object coordinates under the
+  // current transforms.  Boxes crossing the near plane are always visible.
+  bool IsVisible(const Eigen::AlignedBox3f& box) const;
+  // Tests count boxes concurrently and writes the results to visible
+  void IsVisible(const Eigen::AlignedBox3f* boxes, int count, bool* visible);
+
  protected:
+  typedef FixedPoint<int32_t, 8> FP;
+  typedef Eigen::Matrix<FP, 2, 1> Vector2FP;
+
+  // Screen-space triangle after projection, culling and viewport transform.
+  struct TriangleSetup {
+    Eigen::AlignedBox<int, 2> box;  // Bounding box clipped to the viewport
+    Vector2FP v[3];                 // Vertices in pixel space
+    float zz[3];                    // Coefficients for z interpolation
+    float minZ;                     // Lower bound of all interpolated depths
+    Eigen::Vector3f color;
+  };
+
+  // Plane equations f(x, y) = f0 + a*(x - x0) + b*(y - y0) over pixel
+  // coordinates, stored as (f0, a, b), of 1/w and of every varying divided
+  // by w.  Kept apart from TriangleSetup, so that draws without attributes
+  // do not bin them.
+  struct VaryingSetup {
+    Eigen::Vector2f origin;                   // (x0, y0), the first vertex
+    Eigen::Vector3f planes[kMaxVaryings + 1];  // 1/w, then the varyings
+  };
+
+  // Vertex after the vertex stage, shared by all triangles using it.  The
+  // screen-space position is only valid if no clip plane bit is set.
+  struct TransformedVertex {
+    Eigen::Vector3f screen;  // Window coordinates and depth
+    Vector2FP fixed;         // Window coordinates relative to pixel centers
+    int outCode;             // Frustum planes in bits 0-5, clip planes above
+    float invW;              // Reciprocal of the clip-space w
+  };
+
   Eigen::Vector4f ProcessVertex(const Eigen::Vector4f& position);
-  Eigen::Vector4f ProcessFragment(const Eigen::Vector3f& position);
-  void RasterizeTriangle(const Eigen::Vector3f& v0,
-                         const Eigen::Vector3f& v1,
-                         const Eigen::Vector3f& v2,
-                         std::function<void(const Eigen::Vector3f&)> callback);
+  TransformedVertex TransformVertex(const Eigen::Vector4f& position);
+  // Classifies and projects a vertex the vertex stage produced
+  TransformedVertex TransformClipVertex(const Eigen::Vector4f& clip);
+  // Transforms count vertices with the vertex kernel of the CPU, which
+  // processes them as structure of arrays
+  void TransformVertices(const Eigen::Vector3f* positions, int count,
+                         TransformedVertex* vertices);
+  void ProjectVertex(const Eigen::Vector4f& clip, TransformedVertex* vertex);
+  // Gathers the attributes of the current draw into varyings
+  void FetchVaryings(int index, float* varyings) const;
+  // Clip-space position of a vertex of the current draw, for clipping
+  Eigen::Vector4f GetClipPosition(int index);
+  // Clipped polygons too large for the edge functions are split in halves at
+  // most this many times
+  static const int kMaxSplitDepth = 8;
+
+  // Returns the number of screen-space triangles written to triangles, or -1
+  // if the triangle has to go through ClipTriangle.  Their color is left to
+  // the caller.  Without varyings of the current draw, varyings and
+  // varyingSetups may be null; otherwise varyings[i] belongs to vertex i and
+  // one VaryingSetup is written per triangle.  Culled and rejected triangles
+  // are counted in statistics unless it is null.
+  // ClipTriangle writes to the start of the vectors and grows them as needed.
+  int SetupTriangle(const TransformedVertex& v0,
+                    const TransformedVertex& v1,
+                    const TransformedVertex& v2,
+                    const float* const* varyings,
+                    TriangleSetup* triangles,
+                    VaryingSetup* varyingSetups,
+                    PipelineStatistics* statistics = nullptr);
+  int ClipTriangle(const Eigen::Vector4f& clip0,
+                   const Eigen::Vector4f& clip1,
+                   const Eigen::Vector4f& clip2,
+                   const float* const* varyings,
+                   std::vector<TriangleSetup>* triangles,
+                   std::vector<VaryingSetup>* varyingSetups);
+  int SetupScreenTriangle(const TransformedVertex& v0,
+                          const TransformedVertex& v1,
+                          const TransformedVertex& v2,
+                          const float* const* varyings,
+                          TriangleSetup* triangle,
+                          VaryingSetup* varyingSetup,
+                          PipelineStatistics* statistics = nullptr);
+  void SetupVaryings(const TransformedVertex* const* v,
+                     const float* const* varyings,
+                     VaryingSetup* setup) const;
+
+  // Float copy of one tile of the render target.  Triangles are rasterized
+  // into it, and it is converted from and to the pixel formats of the
+  // surfaces once per draw.
+  struct Tile {
+    Eigen::AlignedBox<int, 2> rect;
+    Eigen::Vector4f color[kTileSize*kTileSize];
+    float depth[kTileSize*kTileSize];
+    // Counted by rasterizers with statistics since the tile was loaded
+    PipelineStatistics statistics;
+  };
+
+  // Scratch tile of the calling thread
+  static Tile& GetTile();
+  void LoadTile(const Eigen::AlignedBox<int, 2>& rect, Tile* tile);
+  void StoreTile(const Tile& tile);
+
+  // Shades count quads and writes the colors of their masked fragments
+  typedef void (*QuadShader)(const void* fragmentShader,
+                             const FragmentQuad* quads, int count, Tile* tile);
+  template<class FragmentShader>
+  static void ShadeQuads(const void* fragmentShader,
+                         const FragmentQuad* quads, int count, Tile* tile);
+
+  // Rasterizes the part of the triangle inside the tile.  Without Shade,
+  // covered pixels get the flat color of the triangle; with Shade, quads
+  // passing the depth test go through the quad shader of the current draw.
+  // Varyings are only read if Shade is set.  With Statistics, the work is
+  // counted in the statistics of the tile.
+  template<bool DepthTest, bool DepthWrite, bool ColorWrite, bool Shade,
+           bool Statistics>
+  void RasterizeTriangle(const TriangleSetup& triangle,
+                         const VaryingSetup* varyings, Tile* tile);
+  void UpdateHiZ(const Tile& tile, int blockX, int blockY);
+
+  // Occlusion queries against the given surfaces of the render target
+  bool IsRectVisible(const IDepthSurface& zBuffer, const RenderSurface1f& hiZ,
+                     const Eigen::AlignedBox<int, 2>& rect, float minZ) const;
+  bool IsBoxVisible(const IDepthSurface& zBuffer, const RenderSurface1f& hiZ,
+                    const Eigen::AlignedBox3f& box) const;
+
+  typedef void (RastaManRenderer::*Rasterizer)(
+    const TriangleSetup& triangle, const VaryingSetup* varyings, Tile* tile);
+  Rasterizer GetRasterizer() const;
+
+  void SetVertexAttributes(const VertexAttributes& attributes);
+
+  // Adds to the statistics of the renderer from any thread
+  void AddStatistics(const PipelineStatistics& statistics);
+
+  // Brackets the work of a stage on the calling thread.  BeginStage returns
+  // the counts to pass to EndStage, which adds the difference to the stage.
+  PerfCounts BeginStage() const;
+  void EndStage(PipelineStage stage, const PerfCounts& begin);
+
+  // Stages of a draw.  BeginDraw returns the number of vertices, and the
+  // vertex stage in between fills the post-transform buffers.
+  int BeginDraw(const int* indices, int count, int varyingCount,
+                QuadShader quadShader, const void* fragmentShader);
+  void ForEachVertexBatch(int vertexCount,
+                          const std::function<void(int, int)>& task);
+  void SetupTriangles(const int* indices, int count);
+  void RasterizeTiles();
 
  private:
   Eigen::Matrix4f modelViewMatrix_;
@@ -50,9 +329,94 @@ class RastaManRenderer : public boost::noncopyable, public IRenderer {
   Eigen::AlignedBox<int, 2> viewport_;
   Eigen::Vector3f viewportScale_;
   Eigen::Vector3f viewportBias_;
+  Eigen::Vector4f clipPlanes_[5];  // Near plane and guard band
 
   std::shared_ptr<RenderTarget> renderTarget_;
+
+  PipelineState state_;
+
+  bool statisticsEnabled_;
+  PipelineStatistics statistics_;
+  bool perfCountersEnabled_;
+  PerfCounts perfCounts_[STAGE_COUNT];
+  // Guards statistics_ and perfCounts_
+  mutable std::mutex statisticsMutex_;
+
+  // Attributes of the current draw and their offsets in the varyings, -1 if
+  // absent
+  VertexAttributes attributes_;
+  int varyingCount_;
+  int normalOffset_;
+  int texCoordOffset_;
+  int colorOffset_;
+
+  // Fragment stage of the current draw, null for flat face colors
+  QuadShader quadShader_;
+  const void* fragmentShader_;
+
+  // Positions of the current draw, if drawn without a vertex shader
+  const Eigen::Vector3f* positions_;
+
+  ThreadPool threadPool_;
+
+  // Post-transform vertex buffer
+  std::vector<TransformedVertex,
+              Eigen::aligned_allocator<TransformedVertex>> transformedVertices_;
+  std::vector<float> vertexVaryings_;
+  std::vector<Eigen::Vector4f,
+              Eigen::aligned_allocator<Eigen::Vector4f>> clipPositions_;
+
+  // Per geometry batch: set up triangles and, for every tile, the indices of
+  // the triangles overlapping it in submission order.
+  std::vector<std::vector<TriangleSetup>> batchTriangles_;
+  std::vector<std::vector<VaryingSetup>> batchVaryings_;
+  std::vector<std::vector<std::vector<int>>> batchBins_;
 };
 
-#endif
+template<class VertexShader, class FragmentShader>
+void RastaManRenderer::Draw(const VertexShader& vertexShader,
+                            const FragmentShader& fragmentShader,
+                            const int* indices,
+                            int count) {
+  const int varyingCount = VertexShader::kVaryingCount;
+  static_assert(varyingCount <= kMaxVaryings, "Too many varyings");
+  TraceScope scope("Draw");
 
+  SetVertexAttributes(VertexAttributes());
+  positions_ = nullptr;
+  const int vertexCount = BeginDraw(indices, count, varyingCount,
+                                    &ShadeQuads<FragmentShader>,
+                                    &fragmentShader);
+  clipPositions_.resize(vertexCount);
+  ForEachVertexBatch(vertexCount, [&] (int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      clipPositions_[i] =
+        vertexShader(i, vertexVaryings_.data() + i*varyingCount);
+      transformedVertices_[i] = TransformClipVertex(clipPositions_[i]);
+    }
+  });
+  SetupTriangles(indices, count);
+  RasterizeTiles();
+}
+
+template<class FragmentShader>
+void RastaManRenderer::ShadeQuads(const void* fragmentShader,
+                                  const FragmentQuad* quads, int count,
+                                  Tile* tile) {
+  const FragmentShader& shader =
+    *static_cast<const FragmentShader*>(fragmentShader);
+  for (int i = 0; i < count; ++i) {
+    const FragmentQuad& quad = quads[i];
+    Eigen::Vector4f colors[4];
+    shader(quad, colors);
+    Eigen::Vector4f* row = &tile->color[(quad.y - tile->rect.min().y())
+      * kTileSize + quad.x - tile->rect.min().x()];
+    for (int j = 0; j < 4; ++j) {
+      if (quad.mask & (1u << j)) {
+        row[(j >> 1)*kTileSize + (j & 1)] = colors[j];
+      }
+    }
+  }
+}
+
+#endif
@@ -1,14 +1,71 @@
 #include "RenderSurface.hpp"
 
+#include "CpuDispatch.hpp"
+#include "SurfaceAllocator.hpp"
+
 #include <algorithm>
+#include <new>
+#include <type_traits>
+
+namespace {
+// Fills and row conversions with the kernels of the CPU where there are any
+template<typename T>
+void FillPixels(T* pixels, const T& value, int count) {
+  GetCpuKernels().fill(pixels, &value, sizeof(T), count);
+}
+
+template<typename Component>
+void EncodeRow(const typename PixelTraits<Component>::ValueType* values,
+               Component* pixels, int count) {
+  for (int i = 0; i < count; ++i) {
+    pixels[i] = PixelTraits<Component>::Encode(values[i]);
+  }
+}
+
+void EncodeRow(const Eigen::Vector4f* values, PixelRGBA8* pixels, int count) {
+  GetCpuKernels().encodeRgba8(values->data(), pixels->c, count);
+}
+
+template<typename Component>
+void DecodeRow(const Component* pixels,
+               typename PixelTraits<Component>::ValueType* values,
+               int count) {
+  for (int i = 0; i < count; ++i) {
+    values[i] = PixelTraits<Component>::Decode(pixels[i]);
+  }
+}
+
+void DecodeRow(const PixelRGBA8* pixels, Eigen::Vector4f* values, int count) {
+  GetCpuKernels().decodeRgba8(pixels->c, values->data(), count);
+}
+}
+
+template<typename Component>
+const int RenderSurface<Component>::kClearTileSize;
 
 template<typename Component>
 RenderSurface<Component>::RenderSurface(int width, int height)
-    : width_(width), height_(height), pixels_(new Component[width*height]) {
+    : width_(width), height_(height), pixelCount_(width*height),
+      tilesX_((width + kClearTileSize - 1) / kClearTileSize),
+      pixels_(static_cast<Component*>(SurfaceAllocator::GetDefault().Allocate(
+        pixelCount_ * sizeof(Component)))),
+      clearedTiles_(tilesX_ *
+                    ((height + kClearTileSize - 1) / kClearTileSize)) {
+  static_assert(std::is_trivially_destructible<Component>::value,
+                "Pixels are never destroyed");
+  for (int i = 0; i < pixelCount_; ++i) {
+    new (&pixels_[i]) Component;
+  }
 }
 
 template<typename Component>
 RenderSurface<Component>::~RenderSurface() {
+  SurfaceAllocator::GetDefault().Free(pixels_);
+}
+
+template<typename Component>
+PixelFormat RenderSurface<Component>::GetFormat() const {
+  return PixelTraits<Component>::kFormat;
 }
 
 template<typename Component>
@@ -23,26 +80,145 @@ int RenderSurface<Component>::GetHeight() const {
 
 template<typename Component>
 void RenderSurface<Component>::Clear(const Component& clearColor) {
-  std::fill(&pixels_[0], &pixels_[width_*height_], clearColor);
+  clearValue_ = clearColor;
+  std::fill(clearedTiles_.begin(), clearedTiles_.end(), 1);
+}
+
+template<typename Component>
+void RenderSurface<Component>::Fill(const Component& value) {
+  FillPixels(pixels_, value, pixelCount_);
+  std::fill(clearedTiles_.begin(), clearedTiles_.end(), 0);
 }
 
 template<typename Component>
 const Component* RenderSurface<Component>::GetPixels() const {
-  return pixels_.get();
+  for (int tile = 0; tile < static_cast<int>(clearedTiles_.size()); ++tile) {
+    ResolveTile(tile);
+  }
+  return pixels_;
+}
+
+template<typename Component>
+const void* RenderSurface<Component>::GetData() const {
+  return GetPixels();
 }
 
 template<typename Component>
 const Component& RenderSurface<Component>::operator()(int x, int y) const {
-  return pixels_[width_*y+x];
+  if (clearedTiles_[GetTileIndex(x, y)]) {
+    return clearValue_;
+  }
+  return pixels_[GetOffset(x, y)];
 }
 
 template<typename Component>
 Component& RenderSurface<Component>::operator()(int x, int y) {
-  return pixels_[width_*y+x];
+  ResolveTile(GetTileIndex(x, y));
+  return pixels_[GetOffset(x, y)];
+}
+
+template<typename Component>
+int RenderSurface<Component>::GetOffset(int x, int y) const {
+  return width_*y+x;
+}
+
+template<typename Component>
+int RenderSurface<Component>::GetTileIndex(int x, int y) const {
+  return (y / kClearTileSize)*tilesX_ + x / kClearTileSize;
+}
+
+template<typename Component>
+Eigen::AlignedBox<int, 2> RenderSurface<Component>::GetTileRect(
+    int tile) const {
+  const Eigen::Vector2i min(tile % tilesX_ * kClearTileSize,
+                            tile / tilesX_ * kClearTileSize);
+  const Eigen::Vector2i max(std::min(min.x() + kClearTileSize, width_) - 1,
+                            std::min(min.y() + kClearTileSize, height_) - 1);
+  return Eigen::AlignedBox<int, 2>(min, max);
+}
+
+template<typename Component>
+void RenderSurface<Component>::ResolveTile(int tile) const {
+  if (!clearedTiles_[tile]) {
+    return;
+  }
+  clearedTiles_[tile] = 0;
+
+  const Eigen::AlignedBox<int, 2> rect = GetTileRect(tile);
+  for (int y = rect.min().y(); y <= rect.max().y(); ++y) {
+    FillPixels(&pixels_[GetOffset(rect.min().x(), y)], clearValue_,
+               rect.sizes().x() + 1);
+  }
+}
+
+template<typename Component>
+void RenderSurface<Component>::ClearValue(const ValueType& value) {
+  Clear(PixelTraits<Component>::Encode(value));
+}
+
+template<typename Component>
+typename RenderSurface<Component>::ValueType
+RenderSurface<Component>::ReadValue(int x, int y) const {
+  return PixelTraits<Component>::Decode((*this)(x, y));
+}
+
+template<typename Component>
+void RenderSurface<Component>::ReadRect(const Eigen::AlignedBox<int, 2>& rect,
+                                        ValueType* values, int stride) const {
+  const ValueType clearValue = PixelTraits<Component>::Decode(clearValue_);
+  for (int ty = rect.min().y() / kClearTileSize;
+       ty <= rect.max().y() / kClearTileSize; ++ty) {
+    for (int tx = rect.min().x() / kClearTileSize;
+         tx <= rect.max().x() / kClearTileSize; ++tx) {
+      const int tile = ty*tilesX_ + tx;
+      const Eigen::AlignedBox<int, 2> part =
+        rect.intersection(GetTileRect(tile));
+      for (int y = part.min().y(); y <= part.max().y(); ++y) {
+        ValueType* dst = values + (y - rect.min().y())*stride
+          + (part.min().x() - rect.min().x());
+        if (clearedTiles_[tile]) {
+          FillPixels(dst, clearValue, part.sizes().x() + 1);
+        } else {
+          DecodeRow(&pixels_[GetOffset(part.min().x(), y)], dst,
+                    part.sizes().x() + 1);
+        }
+      }
+    }
+  }
+}
+
+template<typename Component>
+void RenderSurface<Component>::WriteRect(const Eigen::AlignedBox<int, 2>& rect,
+                                         const ValueType* values, int stride) {
+  for (int ty = rect.min().y() / kClearTileSize;
+       ty <= rect.max().y() / kClearTileSize; ++ty) {
+    for (int tx = rect.min().x() / kClearTileSize;
+         tx <= rect.max().x() / kClearTileSize; ++tx) {
+      const int tile = ty*tilesX_ + tx;
+      const Eigen::AlignedBox<int, 2> tileRect = GetTileRect(tile);
+      const Eigen::AlignedBox<int, 2> part = rect.intersection(tileRect);
+      // A pending clear is dropped if the whole tile is overwritten
+      if (part.min() == tileRect.min() && part.max() == tileRect.max()) {
+        clearedTiles_[tile] = 0;
+      } else {
+        ResolveTile(tile);
+      }
+
+      for (int y = part.min().y(); y <= part.max().y(); ++y) {
+        const ValueType* src = values + (y - rect.min().y())*stride
+          + (part.min().x() - rect.min().x());
+        EncodeRow(src, &pixels_[GetOffset(part.min().x(), y)],
+                  part.sizes().x() + 1);
+      }
+    }
+  }
 }
 
 // Explicit template instantiations
 template class RenderSurface<float>;
-template class RenderSurface<Eigen::Vector2f>;
-template class RenderSurface<Eigen::Vector3f>;
 template class RenderSurface<Eigen::Vector4f>;
+template class RenderSurface<PixelRGBA16F>;
+template class RenderSurface<PixelRGB10A2>;
+template class RenderSurface<PixelRGBA8>;
+template class RenderSurface<PixelD24>;
+template class RenderSurface<PixelD16>;
@@ -1,39 +1,105 @@
 #ifndef RENDERSURFACE_HPP
 #define RENDERSURFACE_HPP
 
+#include "PixelFormat.hpp"
+
 #include "Eigen/Core"
+#include "Eigen/Geometry"
 
 #include "boost/noncopyable.hpp"
-#include "boost/scoped_array.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Format-independent access to a surface.  Values are converted from and to
+// the pixel format of the surface on every read and write.
+template<typename Value>
+class IRenderSurface {
+ public:
+  virtual ~IRenderSurface() {}
+
+  virtual PixelFormat GetFormat() const = 0;
+  virtual int GetWidth() const = 0;
+  virtual int GetHeight() const = 0;
+
+  // Row-major packed pixels in the layout given by the format, e.g. for
+  // display
+  virtual const void* GetData() const = 0;
+
+  virtual void ClearValue(const Value& value) = 0;
+  virtual Value ReadValue(int x, int y) const = 0;
+
+  // Copy the pixels in rect from or to a row-major array with stride
+  // values per row.
+  virtual void ReadRect(const Eigen::AlignedBox<int, 2>& rect,
+                        Value* values, int stride) const = 0;
+  virtual void WriteRect(const Eigen::AlignedBox<int, 2>& rect,
+                         const Value* values, int stride) = 0;
+};
+
+typedef IRenderSurface<Eigen::Vector4f> IColorSurface;
+typedef IRenderSurface<float> IDepthSurface;
 
 template<typename Component>
-class RenderSurface : public boost::noncopyable {
+class RenderSurface
+    : public boost::noncopyable,
+      public IRenderSurface<typename PixelTraits<Component>::ValueType> {
  public:
   typedef Component ComponentType;
+  typedef typename PixelTraits<Component>::ValueType ValueType;
+
+  // Edge length of the tiles cleared lazily.  Clear only records the clear
+  // value; a tile is filled with it when it is first accessed, or when the
+  // whole surface is read back.  Different tiles may be accessed from
+  // different threads concurrently.
+  static const int kClearTileSize = 64;
 
   RenderSurface(int width, int height);
   ~RenderSurface();
 
+  PixelFormat GetFormat() const;
   int GetWidth() const;
   int GetHeight() const;
 
   void Clear(const Component& clearColor);
+  // Clears all pixels immediately, so that there are no pending clears
+  void Fill(const Component& value);
 
   const Component* GetPixels() const;
+  const void* GetData() const;
 
   const Component& operator()(int x, int y) const;
   Component& operator()(int x, int y);
 
+  void ClearValue(const ValueType& value);
+  ValueType ReadValue(int x, int y) const;
+  void ReadRect(const Eigen::AlignedBox<int, 2>& rect,
+                ValueType* values, int stride) const;
+  void WriteRect(const Eigen::AlignedBox<int, 2>& rect,
+                 const ValueType* values, int stride);
+
  private:
+  int GetOffset(int x, int y) const;
+  int GetTileIndex(int x, int y) const;
+  Eigen::AlignedBox<int, 2> GetTileRect(int tile) const;
+  // Fills a tile with the clear value if its clear is still pending
+  void ResolveTile(int tile) const;
+
   int width_;
   int height_;
-  boost::scoped_array<Component> pixels_;
+  int pixelCount_;
+  int tilesX_;
+  Component* pixels_;  // From SurfaceAllocator
+  Component clearValue_;
+  mutable std::vector<uint8_t> clearedTiles_;
 };
 
 typedef RenderSurface<float> RenderSurface1f;
-typedef RenderSurface<Eigen::Vector2f> RenderSurface2f;
-typedef RenderSurface<Eigen::Vector3f> RenderSurface3f;
 typedef RenderSurface<Eigen::Vector4f> RenderSurface4f;
+typedef RenderSurface<PixelRGBA16F> RenderSurfaceRGBA16F;
+typedef RenderSurface<PixelRGB10A2> RenderSurfaceRGB10A2;
+typedef RenderSurface<PixelRGBA8> RenderSurfaceRGBA8;
+typedef RenderSurface<PixelD24> RenderSurfaceD24;
+typedef RenderSurface<PixelD16> RenderSurfaceD16;
 
 #endif
-
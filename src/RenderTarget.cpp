@@ -2,25 +2,87 @@
 
 #include <cassert>
 
-RenderTarget::RenderTarget(std::shared_ptr<RenderSurface4f> backBuffer,
-                           std::shared_ptr<RenderSurface1f> zBuffer)
-    : backBuffer_(backBuffer), zBuffer_(zBuffer) {
+namespace {
+// Surface memory is not initialized, and low values left in it would reject
+// geometry drawn before the first clear, so the Hi-Z buffer starts out at
+// the farthest depth
+std::shared_ptr<RenderSurface1f> CreateHiZBuffer(int width, int height) {
+  const int size = RenderTarget::kHiZBlockSize;
+  const auto hiZBuffer = std::make_shared<RenderSurface1f>(
+    (width + size - 1) / size, (height + size - 1) / size);
+  hiZBuffer->Fill(1.f);
+  return hiZBuffer;
+}
+
+std::shared_ptr<IColorSurface> CreateColorSurface(int width, int height,
+                                                  PixelFormat format) {
+  switch (format) {
+    case PIXEL_RGBA16F:
+      return std::make_shared<RenderSurfaceRGBA16F>(width, height);
+    case PIXEL_RGB10A2:
+      return std::make_shared<RenderSurfaceRGB10A2>(width, height);
+    case PIXEL_RGBA8:
+      return std::make_shared<RenderSurfaceRGBA8>(width, height);
+    default:
+      assert(format == PIXEL_RGBA32F);
+      return std::make_shared<RenderSurface4f>(width, height);
+  }
+}
+
+std::shared_ptr<IDepthSurface> CreateDepthSurface(int width, int height,
+                                                  PixelFormat format) {
+  switch (format) {
+    case PIXEL_D24:
+      return std::make_shared<RenderSurfaceD24>(width, height);
+    case PIXEL_D16:
+      return std::make_shared<RenderSurfaceD16>(width, height);
+    default:
+      assert(format == PIXEL_D32F);
+      return std::make_shared<RenderSurface1f>(width, height);
+  }
+}
+}
+
+const int RenderTarget::kHiZBlockSize;
+
+RenderTarget::RenderTarget(std::shared_ptr<IColorSurface> backBuffer,
+                           std::shared_ptr<IDepthSurface> zBuffer)
+    : backBuffer_(backBuffer), zBuffer_(zBuffer),
+      hiZBuffer_(CreateHiZBuffer(zBuffer->GetWidth(), zBuffer->GetHeight())) {
   assert(backBuffer_->GetWidth() == zBuffer_->GetWidth());
   assert(backBuffer_->GetHeight() == zBuffer_->GetHeight());
 }
 
-RenderTarget::RenderTarget(int width, int height)
-  : backBuffer_(new RenderSurface4f(width, height)),
-    zBuffer_(new RenderSurface1f(width, height)) {
+RenderTarget::RenderTarget(int width, int height, PixelFormat colorFormat,
+                           PixelFormat depthFormat)
+  : backBuffer_(CreateColorSurface(width, height, colorFormat)),
+    zBuffer_(CreateDepthSurface(width, height, depthFormat)),
+    hiZBuffer_(CreateHiZBuffer(width, height)) {
 }
 
 RenderTarget::~RenderTarget() {
 }
 
-std::shared_ptr<RenderSurface4f> RenderTarget::GetBackBuffer() {
+void RenderTarget::Resize(int width, int height) {
+  const PixelFormat colorFormat = backBuffer_->GetFormat();
+  const PixelFormat depthFormat = zBuffer_->GetFormat();
+
+  backBuffer_.reset();
+  zBuffer_.reset();
+  hiZBuffer_.reset();
+  backBuffer_ = CreateColorSurface(width, height, colorFormat);
+  zBuffer_ = CreateDepthSurface(width, height, depthFormat);
+  hiZBuffer_ = CreateHiZBuffer(width, height);
+}
+
+std::shared_ptr<IColorSurface> RenderTarget::GetBackBuffer() {
   return backBuffer_;
 }
 
-std::shared_ptr<RenderSurface1f> RenderTarget::GetZBuffer() {
+std::shared_ptr<IDepthSurface> RenderTarget::GetZBuffer() {
   return zBuffer_;
 }
+
+std::shared_ptr<RenderSurface1f> RenderTarget::GetHiZBuffer() {
+  return hiZBuffer_;
+}
@@ -7,18 +7,31 @@
 
 class RenderTarget {
  public:
-  RenderTarget(std::shared_ptr<RenderSurface4f> backBuffer,
-               std::shared_ptr<RenderSurface1f> zBuffer);
-  RenderTarget(int width, int height);
+  // Edge length of the pixel blocks summarized by one Hi-Z entry.
+  static const int kHiZBlockSize = 8;
+
+  RenderTarget(std::shared_ptr<IColorSurface> backBuffer,
+               std::shared_ptr<IDepthSurface> zBuffer);
+  RenderTarget(int width, int height,
+               PixelFormat colorFormat = PIXEL_RGBA32F,
+               PixelFormat depthFormat = PIXEL_D32F);
   ~RenderTarget();
 
-  std::shared_ptr<RenderSurface4f> GetBackBuffer();
-  std::shared_ptr<RenderSurface1f> GetZBuffer();
+  // Replaces all surfaces by ones of the new size with the same formats.
+  // The old surfaces are released first, so their memory can be reused.
+  void Resize(int width, int height);
+
+  std::shared_ptr<IColorSurface> GetBackBuffer();
+  std::shared_ptr<IDepthSurface> GetZBuffer();
+  // Farthest depth per kHiZBlockSize^2 block of the z-buffer.  Maintained by
+  // the renderer as a conservative maximum: it must not be nearer than any
+  // depth in its block, as triangles no nearer than it are rejected.
+  std::shared_ptr<RenderSurface1f> GetHiZBuffer();
 
  private:
-  std::shared_ptr<RenderSurface4f> backBuffer_;
-  std::shared_ptr<RenderSurface1f> zBuffer_;
+  std::shared_ptr<IColorSurface> backBuffer_;
+  std::shared_ptr<IDepthSurface> zBuffer_;
+  std::shared_ptr<RenderSurface1f> hiZBuffer_;
 };
 
 #endif
-
@@ -0,0 +1,47 @@
+#ifndef SHADER_HPP
+#define SHADER_HPP
+
+#include <cstdint>
+
+// Shaders are function objects passed to RastaManRenderer::Draw as template
+// arguments, so that they are inlined into the pipeline.  They are called
+// concurrently from all threads of the renderer.
+//
+// A vertex shader returns the clip-space position of a vertex and writes its
+// varyings:
+//
+//   struct VertexShader {
+//     static const int kVaryingCount = ...;  // At most kMaxVaryings
+//     Eigen::Vector4f operator()(int index, float* varyings) const;
+//   };
+//
+// A fragment shader computes the colors of the four fragments of a quad:
+//
+//   struct FragmentShader {
+//     void operator()(const FragmentQuad& quad, Eigen::Vector4f* colors) const;
+//   };
+
+// Floats interpolated across triangles
+const int kMaxVaryings = 9;
+
+// 2x2 fragments with fragment i at (x + (i & 1), y + (i >> 1)).  Quads are
+// aligned to even coordinates.  Fragments outside the triangle get varyings
+// extrapolated from its plane equations, so that differences within the quad
+// are screen-space derivatives; only the colors of fragments in mask are
+// written.
+struct FragmentQuad {
+  int x;
+  int y;
+  uint32_t mask;
+  float z[4];
+  float varyings[kMaxVaryings][4];  // Varying i of fragment j at [i][j]
+
+  float Ddx(int varying) const {
+    return varyings[varying][1] - varyings[varying][0];
+  }
+  float Ddy(int varying) const {
+    return varyings[varying][2] - varyings[varying][0];
+  }
+};
+
+#endif
@@ -0,0 +1,386 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+// Thin wrappers around the widest integer/float vector registers available to
+// the compiler: AVX-512 (16 lanes), AVX2 (8 lanes), SSE2 (4 lanes) or a scalar
+// fallback (1 lane).  SSE4.1 is used for blends and byte conversions when
+// the compiler targets it.  Lane masks convert to plain bit masks with lane i
+// in bit i.  Byte loads and stores convert between unsigned bytes and lanes,
+// and stored lanes must be in [0, 255].  Half loads and stores take the lower
+// kSimdWidth / 2 lanes from one address and the others from another.  Masked
+// stores may rewrite the unselected lanes with the values they hold.
+
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+
+// Translation units compiled for different instruction sets (see
+// CpuDispatch.hpp) must not share these inline functions, so every
+// instruction set gets a namespace of its own.
+#if defined(__AVX512F__)
+#define SIMD_NAMESPACE SimdAvx512
+#elif defined(__AVX2__)
+#define SIMD_NAMESPACE SimdAvx2
+#elif defined(__SSE4_2__)
+#define SIMD_NAMESPACE SimdSse42
+#elif defined(__SSE2__)
+#define SIMD_NAMESPACE SimdSse2
+#else
+#define SIMD_NAMESPACE SimdScalar
+#endif
+
+namespace SIMD_NAMESPACE {
+
+#if defined(__AVX512F__)
+
+struct SimdInt { __m512i v; };
+struct SimdFloat { __m512 v; };
+struct SimdMask { __mmask16 v; };
+
+const int kSimdWidth = 16;
+
+inline SimdInt SimdSet(int32_t a) { return { _mm512_set1_epi32(a) }; }
+inline SimdInt SimdLoad(const int32_t* p) {
+  return { _mm512_loadu_si512(p) };
+}
+inline SimdInt operator+(SimdInt a, SimdInt b) {
+  return { _mm512_add_epi32(a.v, b.v) };
+}
+inline SimdInt operator|(SimdInt a, SimdInt b) {
+  return { _mm512_or_si512(a.v, b.v) };
+}
+inline SimdMask operator>=(SimdInt a, SimdInt b) {
+  return { _mm512_cmpge_epi32_mask(a.v, b.v) };
+}
+inline void SimdStore(int32_t* p, SimdInt a) { _mm512_storeu_si512(p, a.v); }
+inline SimdInt SimdSelect(SimdMask m, SimdInt a, SimdInt b) {
+  return { _mm512_mask_blend_epi32(m.v, b.v, a.v) };
+}
+inline SimdInt SimdLoadBytes(const uint8_t* p) {
+  return { _mm512_cvtepu8_epi32(
+    _mm_loadu_si128(reinterpret_cast<const __m128i*>(p))) };
+}
+inline void SimdStoreBytes(uint8_t* p, SimdInt a) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm512_cvtepi32_epi8(a.v));
+}
+
+inline SimdFloat SimdSet(float a) { return { _mm512_set1_ps(a) }; }
+inline SimdFloat SimdLoad(const float* p) { return { _mm512_loadu_ps(p) }; }
+inline SimdFloat SimdToFloat(SimdInt a) { return { _mm512_cvtepi32_ps(a.v) }; }
+inline SimdInt SimdTruncate(SimdFloat a) {
+  return { _mm512_cvttps_epi32(a.v) };
+}
+inline void SimdStore(float* p, SimdFloat a) { _mm512_storeu_ps(p, a.v); }
+inline SimdFloat SimdLoadHalves(const float* low, const float* high) {
+  return { _mm512_insertf32x8(_mm512_castps256_ps512(_mm256_loadu_ps(low)),
+                              _mm256_loadu_ps(high), 1) };
+}
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) {
+  return { _mm512_add_ps(a.v, b.v) };
+}
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) {
+  return { _mm512_sub_ps(a.v, b.v) };
+}
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) {
+  return { _mm512_mul_ps(a.v, b.v) };
+}
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) {
+  return { _mm512_div_ps(a.v, b.v) };
+}
+inline SimdMask operator<(SimdFloat a, SimdFloat b) {
+  return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) };
+}
+inline SimdMask operator>=(SimdFloat a, SimdFloat b) {
+  return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ) };
+}
+inline SimdFloat SimdSelect(SimdMask m, SimdFloat a, SimdFloat b) {
+  return { _mm512_mask_blend_ps(m.v, b.v, a.v) };
+}
+
+inline SimdMask operator&(SimdMask a, SimdMask b) {
+  return { static_cast<__mmask16>(a.v & b.v) };
+}
+inline uint32_t SimdBits(SimdMask a) { return a.v; }
+inline SimdMask SimdLanes(uint32_t bits) {
+  return { static_cast<__mmask16>(bits) };
+}
+inline void SimdStore(float* p, SimdFloat a, SimdMask m) {
+  _mm512_mask_storeu_ps(p, m.v, a.v);
+}
+inline void SimdStoreHalves(float* low, float* high, SimdFloat a,
+                            SimdMask m) {
+  _mm256_mask_storeu_ps(low, static_cast<__mmask8>(m.v),
+                        _mm512_castps512_ps256(a.v));
+  _mm256_mask_storeu_ps(high, static_cast<__mmask8>(m.v >> 8),
+                        _mm512_extractf32x8_ps(a.v, 1));
+}
+
+#elif defined(__AVX2__)
+
+struct SimdInt { __m256i v; };
+struct SimdFloat { __m256 v; };
+struct SimdMask { __m256i v; };
+
+const int kSimdWidth = 8;
+
+inline SimdInt SimdSet(int32_t a) { return { _mm256_set1_epi32(a) }; }
+inline SimdInt SimdLoad(const int32_t* p) {
+  return { _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)) };
+}
+inline SimdInt operator+(SimdInt a, SimdInt b) {
+  return { _mm256_add_epi32(a.v, b.v) };
+}
+inline SimdInt operator|(SimdInt a, SimdInt b) {
+  return { _mm256_or_si256(a.v, b.v) };
+}
+inline SimdMask operator>=(SimdInt a, SimdInt b) {
+  return { _mm256_xor_si256(_mm256_cmpgt_epi32(b.v, a.v),
+                            _mm256_set1_epi32(-1)) };
+}
+inline void SimdStore(int32_t* p, SimdInt a) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a.v);
+}
+inline SimdInt SimdSelect(SimdMask m, SimdInt a, SimdInt b) {
+  return { _mm256_blendv_epi8(b.v, a.v, m.v) };
+}
+inline SimdInt SimdLoadBytes(const uint8_t* p) {
+  return { _mm256_cvtepu8_epi32(
+    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))) };
+}
+inline void SimdStoreBytes(uint8_t* p, SimdInt a) {
+  const __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(a.v),
+                                         _mm256_extracti128_si256(a.v, 1));
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(p),
+                   _mm_packus_epi16(words, words));
+}
+
+inline SimdFloat SimdSet(float a) { return { _mm256_set1_ps(a) }; }
+inline SimdFloat SimdLoad(const float* p) { return { _mm256_loadu_ps(p) }; }
+inline SimdFloat SimdToFloat(SimdInt a) { return { _mm256_cvtepi32_ps(a.v) }; }
+inline SimdInt SimdTruncate(SimdFloat a) {
+  return { _mm256_cvttps_epi32(a.v) };
+}
+inline void SimdStore(float* p, SimdFloat a) { _mm256_storeu_ps(p, a.v); }
+inline SimdFloat SimdLoadHalves(const float* low, const float* high) {
+  return { _mm256_loadu2_m128(high, low) };
+}
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) {
+  return { _mm256_add_ps(a.v, b.v) };
+}
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) {
+  return { _mm256_sub_ps(a.v, b.v) };
+}
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) {
+  return { _mm256_mul_ps(a.v, b.v) };
+}
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) {
+  return { _mm256_div_ps(a.v, b.v) };
+}
+inline SimdMask operator<(SimdFloat a, SimdFloat b) {
+  return { _mm256_castps_si256(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)) };
+}
+inline SimdMask operator>=(SimdFloat a, SimdFloat b) {
+  return { _mm256_castps_si256(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)) };
+}
+inline SimdFloat SimdSelect(SimdMask m, SimdFloat a, SimdFloat b) {
+  return { _mm256_blendv_ps(b.v, a.v, _mm256_castsi256_ps(m.v)) };
+}
+
+inline SimdMask operator&(SimdMask a, SimdMask b) {
+  return { _mm256_and_si256(a.v, b.v) };
+}
+inline uint32_t SimdBits(SimdMask a) {
+  return _mm256_movemask_ps(_mm256_castsi256_ps(a.v));
+}
+inline SimdMask SimdLanes(uint32_t bits) {
+  const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  return { _mm256_cmpeq_epi32(
+    _mm256_and_si256(_mm256_set1_epi32(static_cast<int32_t>(bits)), laneBits),
+    laneBits) };
+}
+inline void SimdStore(float* p, SimdFloat a, SimdMask m) {
+  _mm256_maskstore_ps(p, m.v, a.v);
+}
+inline void SimdStoreHalves(float* low, float* high, SimdFloat a,
+                            SimdMask m) {
+  _mm_maskstore_ps(low, _mm256_castsi256_si128(m.v),
+                   _mm256_castps256_ps128(a.v));
+  _mm_maskstore_ps(high, _mm256_extracti128_si256(m.v, 1),
+                   _mm256_extractf128_ps(a.v, 1));
+}
+
+#elif defined(__SSE2__)
+
+struct SimdInt { __m128i v; };
+struct SimdFloat { __m128 v; };
+struct SimdMask { __m128i v; };
+
+const int kSimdWidth = 4;
+
+inline SimdInt SimdSet(int32_t a) { return { _mm_set1_epi32(a) }; }
+inline SimdInt SimdLoad(const int32_t* p) {
+  return { _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)) };
+}
+inline SimdInt operator+(SimdInt a, SimdInt b) {
+  return { _mm_add_epi32(a.v, b.v) };
+}
+inline SimdInt operator|(SimdInt a, SimdInt b) {
+  return { _mm_or_si128(a.v, b.v) };
+}
+inline SimdMask operator>=(SimdInt a, SimdInt b) {
+  return { _mm_xor_si128(_mm_cmpgt_epi32(b.v, a.v), _mm_set1_epi32(-1)) };
+}
+inline void SimdStore(int32_t* p, SimdInt a) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a.v);
+}
+#ifdef __SSE4_1__
+inline SimdInt SimdSelect(SimdMask m, SimdInt a, SimdInt b) {
+  return { _mm_blendv_epi8(b.v, a.v, m.v) };
+}
+#else
+inline SimdInt SimdSelect(SimdMask m, SimdInt a, SimdInt b) {
+  return { _mm_or_si128(_mm_and_si128(m.v, a.v), _mm_andnot_si128(m.v, b.v)) };
+}
+#endif
+inline SimdInt SimdLoadBytes(const uint8_t* p) {
+  int32_t bytes;
+  std::memcpy(&bytes, p, sizeof(bytes));
+  const __m128i packed = _mm_cvtsi32_si128(bytes);
+#ifdef __SSE4_1__
+  return { _mm_cvtepu8_epi32(packed) };
+#else
+  const __m128i zero = _mm_setzero_si128();
+  return { _mm_unpacklo_epi16(_mm_unpacklo_epi8(packed, zero), zero) };
+#endif
+}
+inline void SimdStoreBytes(uint8_t* p, SimdInt a) {
+  const __m128i words = _mm_packs_epi32(a.v, a.v);
+  const int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+  std::memcpy(p, &bytes, sizeof(bytes));
+}
+
+inline SimdFloat SimdSet(float a) { return { _mm_set1_ps(a) }; }
+inline SimdFloat SimdLoad(const float* p) { return { _mm_loadu_ps(p) }; }
+inline SimdFloat SimdToFloat(SimdInt a) { return { _mm_cvtepi32_ps(a.v) }; }
+inline SimdInt SimdTruncate(SimdFloat a) { return { _mm_cvttps_epi32(a.v) }; }
+inline void SimdStore(float* p, SimdFloat a) { _mm_storeu_ps(p, a.v); }
+inline SimdFloat SimdLoadHalves(const float* low, const float* high) {
+  return { _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(),
+                                     reinterpret_cast<const __m64*>(low)),
+                        reinterpret_cast<const __m64*>(high)) };
+}
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) {
+  return { _mm_add_ps(a.v, b.v) };
+}
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) {
+  return { _mm_sub_ps(a.v, b.v) };
+}
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) {
+  return { _mm_mul_ps(a.v, b.v) };
+}
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) {
+  return { _mm_div_ps(a.v, b.v) };
+}
+inline SimdMask operator<(SimdFloat a, SimdFloat b) {
+  return { _mm_castps_si128(_mm_cmplt_ps(a.v, b.v)) };
+}
+inline SimdMask operator>=(SimdFloat a, SimdFloat b) {
+  return { _mm_castps_si128(_mm_cmpge_ps(a.v, b.v)) };
+}
+inline SimdFloat SimdSelect(SimdMask m, SimdFloat a, SimdFloat b) {
+  const __m128 mask = _mm_castsi128_ps(m.v);
+#ifdef __SSE4_1__
+  return { _mm_blendv_ps(b.v, a.v, mask) };
+#else
+  return { _mm_or_ps(_mm_and_ps(mask, a.v), _mm_andnot_ps(mask, b.v)) };
+#endif
+}
+
+inline SimdMask operator&(SimdMask a, SimdMask b) {
+  return { _mm_and_si128(a.v, b.v) };
+}
+inline uint32_t SimdBits(SimdMask a) {
+  return _mm_movemask_ps(_mm_castsi128_ps(a.v));
+}
+inline SimdMask SimdLanes(uint32_t bits) {
+  const __m128i laneBits = _mm_setr_epi32(1, 2, 4, 8);
+  return { _mm_cmpeq_epi32(
+    _mm_and_si128(_mm_set1_epi32(static_cast<int32_t>(bits)), laneBits),
+    laneBits) };
+}
+inline void SimdStore(float* p, SimdFloat a, SimdMask m) {
+  SimdStore(p, SimdSelect(m, a, SimdLoad(p)));
+}
+inline void SimdStoreHalves(float* low, float* high, SimdFloat a,
+                            SimdMask m) {
+  const SimdFloat b = SimdSelect(m, a, SimdLoadHalves(low, high));
+  _mm_storel_pi(reinterpret_cast<__m64*>(low), b.v);
+  _mm_storeh_pi(reinterpret_cast<__m64*>(high), b.v);
+}
+
+#else
+
+struct SimdInt { int32_t v; };
+struct SimdFloat { float v; };
+struct SimdMask { bool v; };
+
+const int kSimdWidth = 1;
+
+inline SimdInt SimdSet(int32_t a) { return { a }; }
+inline SimdInt SimdLoad(const int32_t* p) { return { *p }; }
+inline SimdInt operator+(SimdInt a, SimdInt b) { return { a.v + b.v }; }
+inline SimdInt operator|(SimdInt a, SimdInt b) { return { a.v | b.v }; }
+inline SimdMask operator>=(SimdInt a, SimdInt b) { return { a.v >= b.v }; }
+inline void SimdStore(int32_t* p, SimdInt a) { *p = a.v; }
+inline SimdInt SimdSelect(SimdMask m, SimdInt a, SimdInt b) {
+  return m.v ? a : b;
+}
+inline SimdInt SimdLoadBytes(const uint8_t* p) { return { *p }; }
+inline void SimdStoreBytes(uint8_t* p, SimdInt a) {
+  *p = static_cast<uint8_t>(a.v);
+}
+
+inline SimdFloat SimdSet(float a) { return { a }; }
+inline SimdFloat SimdLoad(const float* p) { return { *p }; }
+inline SimdFloat SimdToFloat(SimdInt a) {
+  return { static_cast<float>(a.v) };
+}
+inline SimdInt SimdTruncate(SimdFloat a) {
+  return { static_cast<int32_t>(a.v) };
+}
+inline void SimdStore(float* p, SimdFloat a) { *p = a.v; }
+inline SimdFloat SimdLoadHalves(const float*, const float* high) {
+  return { *high };
+}
+inline SimdFloat operator+(SimdFloat a, SimdFloat b) { return { a.v + b.v }; }
+inline SimdFloat operator-(SimdFloat a, SimdFloat b) { return { a.v - b.v }; }
+inline SimdFloat operator*(SimdFloat a, SimdFloat b) { return { a.v * b.v }; }
+inline SimdFloat operator/(SimdFloat a, SimdFloat b) { return { a.v / b.v }; }
+inline SimdMask operator<(SimdFloat a, SimdFloat b) { return { a.v < b.v }; }
+inline SimdMask operator>=(SimdFloat a, SimdFloat b) { return { a.v >= b.v }; }
+inline SimdFloat SimdSelect(SimdMask m, SimdFloat a, SimdFloat b) {
+  return m.v ? a : b;
+}
+
+inline SimdMask operator&(SimdMask a, SimdMask b) { return { a.v && b.v }; }
+inline uint32_t SimdBits(SimdMask a) { return a.v ? 1 : 0; }
+inline SimdMask SimdLanes(uint32_t bits) { return { (bits & 1) != 0 }; }
+inline void SimdStore(float* p, SimdFloat a, SimdMask m) {
+  if (m.v) {
+    *p = a.v;
+  }
+}
+inline void SimdStoreHalves(float*, float* high, SimdFloat a, SimdMask m) {
+  SimdStore(high, a, m);
+}
+
+#endif
+
+}
+
+using namespace SIMD_NAMESPACE;
+
+#endif
@@ -0,0 +1,118 @@
+#include "SurfaceAllocator.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace {
+void* AlignedAlloc(std::size_t size, std::size_t alignment) {
+#ifdef _WIN32
+  return _aligned_malloc(size, alignment);
+#else
+  void* block = nullptr;
+  return posix_memalign(&block, alignment, size) == 0 ? block : nullptr;
+#endif
+}
+
+void AlignedFree(void* block) {
+#ifdef _WIN32
+  _aligned_free(block);
+#else
+  free(block);
+#endif
+}
+}
+
+const std::size_t SurfaceAllocator::kAlignment;
+const std::size_t SurfaceAllocator::kHugePageSize;
+const std::size_t SurfaceAllocator::kMaxPooledBytes;
+
+SurfaceAllocator::SurfaceAllocator()
+    : hugePagesEnabled_(true), pooledBytes_(0) {
+}
+
+SurfaceAllocator::~SurfaceAllocator() {
+  Trim();
+}
+
+SurfaceAllocator& SurfaceAllocator::GetDefault() {
+  // Never destroyed, as surfaces held by static objects may be freed during
+  // static destruction
+  static SurfaceAllocator* allocator = new SurfaceAllocator;
+  return *allocator;
+}
+
+void SurfaceAllocator::SetHugePagesEnabled(bool enabled) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  hugePagesEnabled_ = enabled;
+}
+
+void* SurfaceAllocator::Allocate(std::size_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // Best fit among the free blocks, wasting at most a quarter of the block
+  const auto it = freeBlocks_.lower_bound(size);
+  if (it != freeBlocks_.end() && it->first - it->first / 4 <= size) {
+    void* block = it->second;
+    pooledBytes_ -= it->first;
+    freeBlocks_.erase(it);
+    return block;
+  }
+
+  const bool huge = size >= kHugePageSize;
+  const std::size_t alignment = huge ? kHugePageSize : kAlignment;
+  const std::size_t capacity = (size + alignment - 1) / alignment * alignment;
+  void* block = AlignedAlloc(capacity, alignment);
+  if (!block) {
+    throw std::bad_alloc();
+  }
+#ifdef MADV_HUGEPAGE
+  if (huge && hugePagesEnabled_) {
+    // Only a hint; fails silently without transparent huge page support
+    madvise(block, capacity, MADV_HUGEPAGE);
+  }
+#endif
+  capacities_[block] = capacity;
+  return block;
+}
+
+void SurfaceAllocator::Free(void* block) {
+  if (!block) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  assert(capacities_.count(block));
+  const std::size_t capacity = capacities_[block];
+  freeBlocks_.insert(std::make_pair(capacity, block));
+  pooledBytes_ += capacity;
+
+  // Release the largest blocks first, they are the least likely to fit
+  while (pooledBytes_ > kMaxPooledBytes) {
+    const auto largest = --freeBlocks_.end();
+    pooledBytes_ -= largest->first;
+    ReleaseBlock(largest->second);
+    freeBlocks_.erase(largest);
+  }
+}
+
+void SurfaceAllocator::Trim() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& entry : freeBlocks_) {
+    ReleaseBlock(entry.second);
+  }
+  freeBlocks_.clear();
+  pooledBytes_ = 0;
+}
+
+void SurfaceAllocator::ReleaseBlock(void* block) {
+  capacities_.erase(block);
+  AlignedFree(block);
+}
@@ -0,0 +1,50 @@
+#ifndef SURFACEALLOCATOR_HPP
+#define SURFACEALLOCATOR_HPP
+
+#include "boost/noncopyable.hpp"
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+// Allocator for the pixel storage of render surfaces.  Blocks are aligned to
+// cache lines, large blocks are backed by transparent huge pages where the
+// platform supports it, and freed blocks are kept for reuse by later
+// surfaces of the same or a slightly smaller size.
+class SurfaceAllocator : public boost::noncopyable {
+ public:
+  // Alignment of all blocks, enough for cache lines and any SIMD load
+  static const std::size_t kAlignment = 64;
+  // Blocks at least this large are aligned to and backed by huge pages
+  static const std::size_t kHugePageSize = 2 << 20;
+  // Free blocks are released once the pool grows beyond this size
+  static const std::size_t kMaxPooledBytes = 256 << 20;
+
+  SurfaceAllocator();
+  ~SurfaceAllocator();
+
+  // Shared by all render surfaces
+  static SurfaceAllocator& GetDefault();
+
+  void SetHugePagesEnabled(bool enabled);
+
+  void* Allocate(std::size_t size);
+  void Free(void* block);
+
+  // Releases all free blocks
+  void Trim();
+
+ private:
+  void ReleaseBlock(void* block);
+
+  std::mutex mutex_;
+  bool hugePagesEnabled_;
+  // Capacity of every block handed out and not yet released
+  std::unordered_map<void*, std::size_t> capacities_;
+  // Free blocks by capacity
+  std::multimap<std::size_t, void*> freeBlocks_;
+  std::size_t pooledBytes_;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "Telemetry.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+namespace {
+int GetHighestBit(uint64_t value) {
+  int bit = 0;
+  while (value >>= 1) {
+    ++bit;
+  }
+  return bit;
+}
+
+// Percentiles reported by Write and WriteSummary
+const struct {
+  const char* name;
+  double percentage;
+} kPercentiles[] = {
+  { "p50", 50.0 },
+  { "p99", 99.0 },
+  { "p99.9", 99.9 }
+};
+}
+
+const int LatencyHistogram::kSubBucketBits;
+const int LatencyHistogram::kSubBucketCount;
+const int LatencyHistogram::kMaxExponent;
+
+LatencyHistogram::LatencyHistogram()
+    : counts_((kMaxExponent - kSubBucketBits + 3) * kSubBucketCount / 2) {
+  Clear();
+}
+
+void LatencyHistogram::Record(uint64_t microseconds) {
+  const int index = std::min(GetBucketIndex(microseconds),
+                             static_cast<int>(counts_.size()) - 1);
+  ++counts_[index];
+  ++count_;
+  min_ = std::min(min_, microseconds);
+  max_ = std::max(max_, microseconds);
+  sum_ += microseconds;
+}
+
+void LatencyHistogram::Clear() {
+  std::fill(counts_.begin(), counts_.end(), 0);
+  count_ = 0;
+  min_ = std::numeric_limits<uint64_t>::max();
+  max_ = 0;
+  sum_ = 0;
+}
+
+uint64_t LatencyHistogram::GetCount() const {
+  return count_;
+}
+
+uint64_t LatencyHistogram::GetMin() const {
+  return count_ ? min_ : 0;
+}
+
+uint64_t LatencyHistogram::GetMax() const {
+  return max_;
+}
+
+double LatencyHistogram::GetMean() const {
+  return count_ ? static_cast<double>(sum_) / count_ : 0.0;
+}
+
+uint64_t LatencyHistogram::GetPercentile(double percentage) const {
+  if (!count_) {
+    return 0;
+  }
+  // Rank of the value, at least the first
+  const uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(
+    std::ceil(percentage / 100 * count_)), 1);
+  // The last bucket also holds the larger values, up to the maximum
+  uint64_t seen = 0;
+  for (std::size_t i = 0; i + 1 < counts_.size(); ++i) {
+    seen += counts_[i];
+    if (seen >= rank) {
+      return std::min(GetBucketMax(static_cast<int>(i)), max_);
+    }
+  }
+  return max_;
+}
+
+void LatencyHistogram::GetBuckets(
+    std::vector<std::pair<uint64_t, uint64_t>>* buckets) const {
+  buckets->clear();
+  for (std::size_t i = 0; i < counts_.size(); ++i) {
+    if (counts_[i]) {
+      buckets->push_back(std::make_pair(
+        GetBucketMin(static_cast<int>(i)), counts_[i]));
+    }
+  }
+}
+
+int LatencyHistogram::GetBucketIndex(uint64_t value) {
+  if (value < kSubBucketCount) {
+    return static_cast<int>(value);
+  }
+  // Values in [2^(e + kSubBucketBits - 1), 2^(e + kSubBucketBits)) in steps
+  // of 2^e, after the exact values
+  const int exponent = GetHighestBit(value) - (kSubBucketBits - 1);
+  return exponent * (kSubBucketCount / 2)
+    + static_cast<int>(value >> exponent);
+}
+
+uint64_t LatencyHistogram::GetBucketMin(int index) {
+  if (index < kSubBucketCount) {
+    return index;
+  }
+  const int exponent = index / (kSubBucketCount / 2) - 1;
+  return static_cast<uint64_t>(index - exponent * (kSubBucketCount / 2))
+    << exponent;
+}
+
+uint64_t LatencyHistogram::GetBucketMax(int index) {
+  if (index < kSubBucketCount) {
+    return index;
+  }
+  const int exponent = index / (kSubBucketCount / 2) - 1;
+  return GetBucketMin(index) + (uint64_t(1) << exponent) - 1;
+}
+
+Telemetry::Telemetry()
+    : enabled_(false) {
+}
+
+Telemetry::~Telemetry() {
+}
+
+Telemetry& Telemetry::GetDefault() {
+  // Never destroyed, as worker threads may still record during static
+  // destruction
+  static Telemetry* telemetry = new Telemetry;
+  return *telemetry;
+}
+
+void Telemetry::SetEnabled(bool enabled) {
+  enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void Telemetry::Record(const std::string& name, uint64_t microseconds) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  histograms_[name].Record(microseconds);
+}
+
+LatencyHistogram Telemetry::GetHistogram(const std::string& name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = histograms_.find(name);
+  return it != histograms_.end() ? it->second : LatencyHistogram();
+}
+
+void Telemetry::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  histograms_.clear();
+}
+
+void Telemetry::Write(std::ostream& os) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::pair<uint64_t, uint64_t>> buckets;
+  os << "{\"unit\":\"us\",\"histograms\":{";
+  const char* separator = "";
+  for (const auto& entry : histograms_) {
+    const LatencyHistogram& histogram = entry.second;
+    os << separator << "\n\"" << entry.first << "\":{"
+       << "\"count\":" << histogram.GetCount()
+       << ",\"min\":" << histogram.GetMin()
+       << ",\"mean\":" << histogram.GetMean();
+    for (const auto& percentile : kPercentiles) {
+      os << ",\"" << percentile.name << "\":"
+         << histogram.GetPercentile(percentile.percentage);
+    }
+    os << ",\"max\":" << histogram.GetMax() << ",\"buckets\":[";
+    histogram.GetBuckets(&buckets);
+    for (std::size_t i = 0; i < buckets.size(); ++i) {
+      os << (i ? "," : "") << "[" << buckets[i].first << ","
+         << buckets[i].second << "]";
+    }
+    os << "]}";
+    separator = ",";
+  }
+  os << "\n}}\n";
+}
+
+bool Telemetry::Write(const std::string& filename) const {
+  std::ofstream ofs(filename.c_str());
+  Write(ofs);
+  return static_cast<bool>(ofs);
+}
+
+void Telemetry::WriteSummary(std::ostream& os) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& entry : histograms_) {
+    const LatencyHistogram& histogram = entry.second;
+    os << entry.first << ": " << histogram.GetCount() << " samples";
+    for (const auto& percentile : kPercentiles) {
+      os << ", " << percentile.name << " "
+         << histogram.GetPercentile(percentile.percentage) << " us";
+    }
+    os << ", max " << histogram.GetMax() << " us" << std::endl;
+  }
+}
@@ -0,0 +1,118 @@
+#ifndef TELEMETRY_HPP
+#define TELEMETRY_HPP
+
+#include "boost/noncopyable.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Histogram of durations in microseconds with a relative error below 1/64
+// over the whole range, in the manner of HdrHistogram.  Values below
+// kSubBucketCount are exact, and every further power of two is split into
+// kSubBucketCount/2 linear buckets.
+class LatencyHistogram {
+ public:
+  static const int kSubBucketBits = 7;
+  static const int kSubBucketCount = 1 << kSubBucketBits;
+  // Largest power of two with buckets of its own, about 19 hours
+  static const int kMaxExponent = 36;
+
+  LatencyHistogram();
+
+  // Larger values are recorded as the largest one
+  void Record(uint64_t microseconds);
+  void Clear();
+
+  uint64_t GetCount() const;
+  uint64_t GetMin() const;
+  uint64_t GetMax() const;
+  double GetMean() const;
+  // Smallest recorded value at least the given percentage of values are
+  // equal to or below, up to the bucket size.  Reported as the upper end of
+  // its bucket, so that tail latencies are never understated.
+  uint64_t GetPercentile(double percentage) const;
+
+  // Counts of the non-empty buckets with the lowest value of each
+  void GetBuckets(std::vector<std::pair<uint64_t, uint64_t>>* buckets) const;
+
+ private:
+  static int GetBucketIndex(uint64_t value);
+  static uint64_t GetBucketMin(int index);
+  static uint64_t GetBucketMax(int index);
+
+  std::vector<uint64_t> counts_;
+  uint64_t count_;
+  uint64_t min_;
+  uint64_t max_;
+  uint64_t sum_;
+};
+
+// Named latency histograms of the renderer and the applications, such as
+// frame times and the durations of the pipeline stages.  Recording takes a
+// lock, as it happens a few times per frame.
+class Telemetry : public boost::noncopyable {
+ public:
+  Telemetry();
+  ~Telemetry();
+
+  // Shared by the renderer and the applications
+  static Telemetry& GetDefault();
+
+  // Scopes are only recorded while enabled, and cost a relaxed load
+  // otherwise
+  void SetEnabled(bool enabled);
+  bool IsEnabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  void Record(const std::string& name, uint64_t microseconds);
+  // Copy of a histogram, empty if nothing was recorded under the name
+  LatencyHistogram GetHistogram(const std::string& name) const;
+  void Clear();
+
+  // Writes count, minimum, mean, p50, p99, p99.9, maximum and the non-empty
+  // buckets of every histogram as JSON
+  void Write(std::ostream& os) const;
+  bool Write(const std::string& filename) const;
+  // Writes one line of percentiles per histogram
+  void WriteSummary(std::ostream& os) const;
+
+ private:
+  std::atomic<bool> enabled_;
+  mutable std::mutex mutex_;
+  std::map<std::string, LatencyHistogram> histograms_;
+};
+
+// Records the time from construction to destruction in a histogram of the
+// default telemetry
+class TelemetryScope : public boost::noncopyable {
+ public:
+  // Name must outlive the scope
+  explicit TelemetryScope(const char* name)
+    : name_(Telemetry::GetDefault().IsEnabled() ? name : nullptr) {
+    if (name_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~TelemetryScope() {
+    if (name_) {
+      Telemetry::GetDefault().Record(name_,
+        std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start_).count());
+    }
+  }
+
+ private:
+  const char* name_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#endif
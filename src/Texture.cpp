@@ -0,0 +1,417 @@
+#include "Texture.hpp"
+
+#include "Simd.hpp"
+#include "SurfaceAllocator.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace Eigen;
+
+namespace {
+const float kTexelScale = 1.0f / 255;
+
+// Components of a texel in [0, 255].  Filtering works on these and scales
+// the result once.
+inline Vector4f UnpackTexel(const PixelRGBA8& texel) {
+#if defined(__SSE2__)
+  uint32_t bits;
+  std::memcpy(&bits, texel.c, sizeof(bits));
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), zero);
+  Vector4f value;
+  _mm_storeu_ps(value.data(),
+                _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero)));
+  return value;
+#else
+  return Vector4f(texel.c[0], texel.c[1], texel.c[2], texel.c[3]);
+#endif
+}
+
+inline Vector4f Lerp(const Vector4f& a, const Vector4f& b, float t) {
+  return a + (b - a) * t;
+}
+
+// The fragments of a quad are sampled in whole SIMD groups of lanes, with
+// the lanes past the fourth unused
+const int kQuadSize = 4;
+const int kQuadLanes = kSimdWidth > kQuadSize ? kSimdWidth : kQuadSize;
+
+inline SimdFloat SimdLerp(SimdFloat a, SimdFloat b, SimdFloat t) {
+  return a + (b - a) * t;
+}
+
+// Same as std::floor.  Floats of at least 2^23 in magnitude are integers,
+// and smaller ones are truncated exactly.
+inline SimdFloat SimdFloor(SimdFloat a) {
+  const SimdFloat limit = SimdSet(8388608.0f);
+  const SimdFloat truncated = SimdToFloat(SimdTruncate(a));
+  const SimdFloat floor = SimdSelect(a < truncated,
+                                     truncated - SimdSet(1.0f), truncated);
+  return SimdSelect((a < limit) & (SimdSet(-8388608.0f) < a), floor, a);
+}
+
+// Same as std::min(std::max(a, 0.0f), 1.0f)
+inline SimdFloat SimdSaturate(SimdFloat a) {
+  const SimdFloat zero = SimdSet(0.0f);
+  const SimdFloat one = SimdSet(1.0f);
+  a = SimdSelect(a < zero, zero, a);
+  return SimdSelect(one < a, one, a);
+}
+
+// Texel coordinates of a bilinear footprint with the first one in [-1, size]
+inline void WrapPair(int first, int size, TextureWrap wrap, int* a, int* b) {
+  if (wrap == WRAP_REPEAT) {
+    *a = first < 0 ? first + size : first;
+    *b = first + 1 >= size ? first + 1 - size : first + 1;
+  } else {
+    *a = std::max(first, 0);
+    *b = std::min(first + 1, size - 1);
+  }
+}
+
+int GetBlockCount(int size) {
+  return (size + Texture::kBlockSize - 1) / Texture::kBlockSize;
+}
+}
+
+const int Texture::kBlockSize;
+
+Texture::Texture(int width, int height, const PixelRGBA8* texels)
+    : width_(width), height_(height), filter_(FILTER_TRILINEAR),
+      wrap_(WRAP_REPEAT), texels_(nullptr) {
+  // All levels share one allocation.  Blocks are 64 bytes, so every level
+  // starts at a cache line.
+  std::vector<int> offsets;
+  int texelCount = 0;
+  int w = width;
+  int h = height;
+  for (;;) {
+    Level level = { w, h, GetBlockCount(w), nullptr };
+    levels_.push_back(level);
+    offsets.push_back(texelCount);
+    texelCount += level.blocksX * GetBlockCount(h) * kBlockSize*kBlockSize;
+    if (w == 1 && h == 1) {
+      break;
+    }
+    w = std::max(w/2, 1);
+    h = std::max(h/2, 1);
+  }
+  texels_ = static_cast<PixelRGBA8*>(SurfaceAllocator::GetDefault().Allocate(
+    texelCount * sizeof(PixelRGBA8)));
+  std::memset(texels_, 0, texelCount * sizeof(PixelRGBA8));
+  for (std::size_t i = 0; i < levels_.size(); ++i) {
+    levels_[i].texels = texels_ + offsets[i];
+  }
+
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      levels_[0].texels[GetTexelOffset(levels_[0], x, y)] =
+        texels[y*width + x];
+    }
+  }
+  GenerateMips();
+}
+
+Texture::~Texture() {
+  SurfaceAllocator::GetDefault().Free(texels_);
+}
+
+int Texture::GetWidth() const {
+  return width_;
+}
+
+int Texture::GetHeight() const {
+  return height_;
+}
+
+int Texture::GetLevelCount() const {
+  return static_cast<int>(levels_.size());
+}
+
+TextureFilter Texture::GetFilter() const {
+  return filter_;
+}
+
+void Texture::SetFilter(TextureFilter filter) {
+  filter_ = filter;
+}
+
+TextureWrap Texture::GetWrap() const {
+  return wrap_;
+}
+
+void Texture::SetWrap(TextureWrap wrap) {
+  wrap_ = wrap;
+}
+
+Vector4f Texture::Fetch(int level, int x, int y) const {
+  const Level& l = levels_[std::min(std::max(level, 0), GetLevelCount() - 1)];
+  return FetchRaw(l, WrapCoordinate(x, l.width), WrapCoordinate(y, l.height))
+    * kTexelScale;
+}
+
+Vector4f Texture::Sample(float u, float v, float lod) const {
+  // Also catches NaN
+  if (!(lod > 0)) {
+    lod = 0;
+  }
+  const int maxLevel = GetLevelCount() - 1;
+  Vector4f value;
+  switch (filter_) {
+    case FILTER_NEAREST: {
+      const int level = std::min(static_cast<int>(lod + .5f), maxLevel);
+      value = SampleNearest(levels_[level], u, v);
+      break;
+    }
+    case FILTER_BILINEAR: {
+      const int level = std::min(static_cast<int>(lod + .5f), maxLevel);
+      value = SampleBilinear(levels_[level], u, v);
+      break;
+    }
+    default: {
+      assert(filter_ == FILTER_TRILINEAR);
+      const int level = std::min(static_cast<int>(lod), maxLevel);
+      const float fraction = lod - level;
+      value = SampleBilinear(levels_[level], u, v);
+      if (level < maxLevel && fraction > 0) {
+        value = Lerp(value, SampleBilinear(levels_[level + 1], u, v),
+                     fraction);
+      }
+      break;
+    }
+  }
+  return value * kTexelScale;
+}
+
+void Texture::SampleQuad(const FragmentQuad& quad, int texCoordVarying,
+                         Vector4f* colors) const {
+  float lod = GetLod(quad, texCoordVarying);
+  float u[kQuadLanes] = {};
+  float v[kQuadLanes] = {};
+  std::copy_n(quad.varyings[texCoordVarying], kQuadSize, u);
+  std::copy_n(quad.varyings[texCoordVarying + 1], kQuadSize, v);
+
+  // Level selection as in Sample
+  if (!(lod > 0)) {
+    lod = 0;
+  }
+  const int maxLevel = GetLevelCount() - 1;
+  float values[4*kQuadLanes];
+  switch (filter_) {
+    case FILTER_NEAREST:
+    case FILTER_BILINEAR: {
+      const int level = std::min(static_cast<int>(lod + .5f), maxLevel);
+      SampleLanes(levels_[level], filter_ == FILTER_BILINEAR, u, v, values);
+      break;
+    }
+    default: {
+      assert(filter_ == FILTER_TRILINEAR);
+      const int level = std::min(static_cast<int>(lod), maxLevel);
+      const float fraction = lod - level;
+      SampleLanes(levels_[level], true, u, v, values);
+      if (level < maxLevel && fraction > 0) {
+        float next[4*kQuadLanes];
+        SampleLanes(levels_[level + 1], true, u, v, next);
+        for (int i = 0; i < 4*kQuadLanes; i += kSimdWidth) {
+          SimdStore(values + i, SimdLerp(SimdLoad(values + i),
+                                         SimdLoad(next + i),
+                                         SimdSet(fraction)));
+        }
+      }
+      break;
+    }
+  }
+
+  for (int i = 0; i < 4*kQuadLanes; i += kSimdWidth) {
+    SimdStore(values + i, SimdLoad(values + i) * SimdSet(kTexelScale));
+  }
+  for (int i = 0; i < kQuadSize; ++i) {
+    if (quad.mask & (1u << i)) {
+      colors[i] = Vector4f(values[i], values[kQuadLanes + i],
+                           values[2*kQuadLanes + i],
+                           values[3*kQuadLanes + i]);
+    }
+  }
+}
+
+float Texture::GetLod(const FragmentQuad& quad, int texCoordVarying) const {
+  // Longer of the footprints of a pixel step in x and in y, in texels
+  const float dudx = quad.Ddx(texCoordVarying) * width_;
+  const float dvdx = quad.Ddx(texCoordVarying + 1) * height_;
+  const float dudy = quad.Ddy(texCoordVarying) * width_;
+  const float dvdy = quad.Ddy(texCoordVarying + 1) * height_;
+  const float rho2 =
+    std::max(dudx*dudx + dvdx*dvdx, dudy*dudy + dvdy*dvdy);
+  return .5f * std::log2(rho2);
+}
+
+Vector4f Texture::FetchRaw(const Level& level, int x, int y) const {
+  return UnpackTexel(level.texels[GetTexelOffset(level, x, y)]);
+}
+
+int Texture::GetTexelOffset(const Level& level, int x, int y) {
+  return ((y/kBlockSize)*level.blocksX + x/kBlockSize) * kBlockSize*kBlockSize
+    + (y%kBlockSize)*kBlockSize + x%kBlockSize;
+}
+
+Vector4f Texture::SampleNearest(const Level& level, float u, float v) const {
+  if (wrap_ == WRAP_REPEAT) {
+    u -= std::floor(u);
+    v -= std::floor(v);
+  }
+  // Clamps coordinates of WRAP_CLAMP as well as u == 1 after wrapping
+  const int x = std::min(std::max(static_cast<int>(u * level.width), 0),
+                         level.width - 1);
+  const int y = std::min(std::max(static_cast<int>(v * level.height), 0),
+                         level.height - 1);
+  return FetchRaw(level, x, y);
+}
+
+Vector4f Texture::SampleBilinear(const Level& level, float u, float v) const {
+  if (wrap_ == WRAP_REPEAT) {
+    u -= std::floor(u);
+    v -= std::floor(v);
+  } else {
+    u = std::min(std::max(u, 0.0f), 1.0f);
+    v = std::min(std::max(v, 0.0f), 1.0f);
+  }
+  // Texel centers are at half-integer coordinates
+  const float x = u * level.width - .5f;
+  const float y = v * level.height - .5f;
+  const float left = std::floor(x);
+  const float top = std::floor(y);
+  int x0, x1, y0, y1;
+  WrapPair(static_cast<int>(left), level.width, wrap_, &x0, &x1);
+  WrapPair(static_cast<int>(top), level.height, wrap_, &y0, &y1);
+  const float fx = x - left;
+  return Lerp(Lerp(FetchRaw(level, x0, y0), FetchRaw(level, x1, y0), fx),
+              Lerp(FetchRaw(level, x0, y1), FetchRaw(level, x1, y1), fx),
+              y - top);
+}
+
+void Texture::SampleLanes(const Level& level, bool bilinear, const float* u,
+                          const float* v, float* values) const {
+  // Texel coordinates in SIMD, as in SampleNearest and SampleBilinear
+  float x[kQuadLanes];
+  float y[kQuadLanes];
+  const SimdFloat width = SimdSet(static_cast<float>(level.width));
+  const SimdFloat height = SimdSet(static_cast<float>(level.height));
+  const SimdFloat half = SimdSet(.5f);
+  for (int i = 0; i < kQuadLanes; i += kSimdWidth) {
+    SimdFloat lu = SimdLoad(u + i);
+    SimdFloat lv = SimdLoad(v + i);
+    if (wrap_ == WRAP_REPEAT) {
+      lu = lu - SimdFloor(lu);
+      lv = lv - SimdFloor(lv);
+    } else if (bilinear) {
+      lu = SimdSaturate(lu);
+      lv = SimdSaturate(lv);
+    }
+    if (bilinear) {
+      SimdStore(x + i, lu * width - half);
+      SimdStore(y + i, lv * height - half);
+    } else {
+      SimdStore(x + i, lu * width);
+      SimdStore(y + i, lv * height);
+    }
+  }
+
+  if (!bilinear) {
+    for (int i = 0; i < kQuadSize; ++i) {
+      const int tx = std::min(std::max(static_cast<int>(x[i]), 0),
+                              level.width - 1);
+      const int ty = std::min(std::max(static_cast<int>(y[i]), 0),
+                              level.height - 1);
+      const PixelRGBA8& texel = level.texels[GetTexelOffset(level, tx, ty)];
+      for (int c = 0; c < 4; ++c) {
+        values[c*kQuadLanes + i] = texel.c[c];
+      }
+    }
+    return;
+  }
+
+  // Texels of the 2x2 footprints component by component, gathered lane by
+  // lane.  The left and top texel coordinates are clamped to [-1, size],
+  // which only matters for coordinates that are not finite.  Unused lanes
+  // are zero.
+  float fx[kQuadLanes];
+  float fy[kQuadLanes];
+  float texels[4][4*kQuadLanes] = {};
+  for (int i = 0; i < kQuadLanes; i += kSimdWidth) {
+    const SimdFloat lx = SimdLoad(x + i);
+    const SimdFloat ly = SimdLoad(y + i);
+    const SimdFloat left = SimdFloor(lx);
+    const SimdFloat top = SimdFloor(ly);
+    SimdStore(fx + i, lx - left);
+    SimdStore(fy + i, ly - top);
+    SimdStore(x + i, left);
+    SimdStore(y + i, top);
+  }
+  for (int i = 0; i < kQuadSize; ++i) {
+    int x0, x1, y0, y1;
+    WrapPair(std::min(std::max(static_cast<int>(x[i]), -1), level.width),
+             level.width, wrap_, &x0, &x1);
+    WrapPair(std::min(std::max(static_cast<int>(y[i]), -1), level.height),
+             level.height, wrap_, &y0, &y1);
+    const int offsets[4] = {
+      GetTexelOffset(level, x0, y0), GetTexelOffset(level, x1, y0),
+      GetTexelOffset(level, x0, y1), GetTexelOffset(level, x1, y1)
+    };
+    for (int j = 0; j < 4; ++j) {
+      const PixelRGBA8& texel = level.texels[offsets[j]];
+      for (int c = 0; c < 4; ++c) {
+        texels[j][c*kQuadLanes + i] = texel.c[c];
+      }
+    }
+  }
+
+  for (int c = 0; c < 4; ++c) {
+    for (int i = 0; i < kQuadLanes; i += kSimdWidth) {
+      const int lane = c*kQuadLanes + i;
+      const SimdFloat tx = SimdLoad(fx + i);
+      const SimdFloat upper = SimdLerp(SimdLoad(texels[0] + lane),
+                                       SimdLoad(texels[1] + lane), tx);
+      const SimdFloat lower = SimdLerp(SimdLoad(texels[2] + lane),
+                                       SimdLoad(texels[3] + lane), tx);
+      SimdStore(values + lane, SimdLerp(upper, lower, SimdLoad(fy + i)));
+    }
+  }
+}
+
+int Texture::WrapCoordinate(int coordinate, int size) const {
+  if (wrap_ == WRAP_CLAMP) {
+    return std::min(std::max(coordinate, 0), size - 1);
+  }
+  coordinate %= size;
+  return coordinate < 0 ? coordinate + size : coordinate;
+}
+
+void Texture::GenerateMips() {
+  for (std::size_t i = 1; i < levels_.size(); ++i) {
+    const Level& source = levels_[i - 1];
+    const Level& level = levels_[i];
+    for (int y = 0; y < level.height; ++y) {
+      // The last row and column of odd-sized levels are dropped, and levels
+      // of size 1 are repeated
+      const int y0 = std::min(2*y, source.height - 1);
+      const int y1 = std::min(2*y + 1, source.height - 1);
+      for (int x = 0; x < level.width; ++x) {
+        const int x0 = std::min(2*x, source.width - 1);
+        const int x1 = std::min(2*x + 1, source.width - 1);
+        const Vector4f sum = FetchRaw(source, x0, y0) + FetchRaw(source, x1, y0)
+          + FetchRaw(source, x0, y1) + FetchRaw(source, x1, y1);
+        PixelRGBA8& texel = level.texels[GetTexelOffset(level, x, y)];
+        for (int c = 0; c < 4; ++c) {
+          texel.c[c] = static_cast<uint8_t>(sum[c] * .25f + .5f);
+        }
+      }
+    }
+  }
+}
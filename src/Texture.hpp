@@ -0,0 +1,100 @@
+#ifndef TEXTURE_HPP
+#define TEXTURE_HPP
+
+#include "PixelFormat.hpp"
+#include "Shader.hpp"
+
+#include "Eigen/Core"
+
+#include "boost/noncopyable.hpp"
+
+#include <vector>
+
+enum TextureFilter {
+  // Nearest texel of the nearest mip level
+  FILTER_NEAREST,
+  // Bilinear filtering within the nearest mip level
+  FILTER_BILINEAR,
+  // Bilinear filtering within the two nearest mip levels, blended by the
+  // fraction of the level of detail
+  FILTER_TRILINEAR
+};
+
+enum TextureWrap {
+  WRAP_REPEAT,
+  WRAP_CLAMP
+};
+
+// RGBA8 texture with a full mip chain, sampled from fragment shaders.
+//
+// Texels of every mip level are stored in row-major 4x4 blocks of 64 bytes,
+// aligned to cache lines, with the texels of a block in row-major order.
+// The 2x2 footprint of a bilinear sample thus touches a single cache line in
+// 9 of 16 positions and never more than four, independent of the direction
+// in which the texture is traversed.
+class Texture : public boost::noncopyable {
+ public:
+  // Texels per block side
+  static const int kBlockSize = 4;
+
+  // Copies width*height row-major texels and generates the mip chain down to
+  // 1x1 with a box filter
+  Texture(int width, int height, const PixelRGBA8* texels);
+  ~Texture();
+
+  int GetWidth() const;
+  int GetHeight() const;
+  int GetLevelCount() const;
+
+  TextureFilter GetFilter() const;
+  void SetFilter(TextureFilter filter);
+  TextureWrap GetWrap() const;
+  void SetWrap(TextureWrap wrap);
+
+  // Texel of a mip level in [0, 1], coordinates wrapped
+  Eigen::Vector4f Fetch(int level, int x, int y) const;
+
+  // Samples at texture coordinates in [0, 1] with a level of detail, log2
+  // of the texels per pixel
+  Eigen::Vector4f Sample(float u, float v, float lod) const;
+
+  // Samples the four fragments of a quad at the texture coordinates in
+  // varyings texCoordVarying and texCoordVarying + 1, with one level of
+  // detail for the quad from their screen-space derivatives.  The fragments
+  // are filtered in SIMD lanes and give the same results as Sample.
+  void SampleQuad(const FragmentQuad& quad, int texCoordVarying,
+                  Eigen::Vector4f* colors) const;
+
+  // Level of detail of a quad, from the derivatives of the texture
+  // coordinates in varyings texCoordVarying and texCoordVarying + 1
+  float GetLod(const FragmentQuad& quad, int texCoordVarying) const;
+
+ private:
+  struct Level {
+    int width;
+    int height;
+    int blocksX;
+    PixelRGBA8* texels;
+  };
+
+  // Texel value in [0, 255] of in-range coordinates
+  Eigen::Vector4f FetchRaw(const Level& level, int x, int y) const;
+  static int GetTexelOffset(const Level& level, int x, int y);
+  Eigen::Vector4f SampleNearest(const Level& level, float u, float v) const;
+  Eigen::Vector4f SampleBilinear(const Level& level, float u, float v) const;
+  // Samples the lanes of a quad, see kQuadLanes in Texture.cpp, and writes
+  // the texel values in [0, 255] component by component to values
+  void SampleLanes(const Level& level, bool bilinear, const float* u,
+                   const float* v, float* values) const;
+  int WrapCoordinate(int coordinate, int size) const;
+  void GenerateMips();
+
+  int width_;
+  int height_;
+  TextureFilter filter_;
+  TextureWrap wrap_;
+  std::vector<Level> levels_;
+  PixelRGBA8* texels_;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "ThreadPool.hpp"
+
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <string>
+
+ThreadPool::ThreadPool(int threadCount)
+    : generation_(0), activeWorkers_(0), quit_(false), task_(nullptr),
+      taskCount_(0), nextTask_(0) {
+  if (threadCount <= 0) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (int i = 1; i < threadCount; ++i) {
+    workers_.push_back(std::thread(&ThreadPool::WorkerMain, this, i));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  wakeCondition_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+int ThreadPool::GetThreadCount() const {
+  return static_cast<int>(workers_.size()) + 1;
+}
+
+void ThreadPool::ParallelFor(int count,
+                             const std::function<void(int)>& task) {
+  if (workers_.empty() || count <= 1) {
+    for (int i = 0; i < count; ++i) {
+      task(i);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    task_ = &task;
+    taskCount_ = count;
+    nextTask_ = 0;
+    activeWorkers_ = static_cast<int>(workers_.size());
+    ++generation_;
+  }
+  wakeCondition_.notify_all();
+
+  RunTasks();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  doneCondition_.wait(lock, [this] { return activeWorkers_ == 0; });
+  task_ = nullptr;
+}
+
+void ThreadPool::WorkerMain(int index) {
+  Tracer::GetDefault().SetThreadName("Worker " + std::to_string(index));
+  uint64_t generation = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wakeCondition_.wait(lock, [&] {
+        return quit_ || generation_ != generation;
+      });
+      if (quit_) {
+        return;
+      }
+      generation = generation_;
+    }
+
+    RunTasks();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--activeWorkers_ == 0) {
+      doneCondition_.notify_one();
+    }
+  }
+}
+
+void ThreadPool::RunTasks() {
+  for (int i = nextTask_++; i < taskCount_; i = nextTask_++) {
+    (*task_)(i);
+  }
+}
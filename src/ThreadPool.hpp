@@ -0,0 +1,45 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include "boost/noncopyable.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool : public boost::noncopyable {
+ public:
+  // A thread count of 0 uses one thread per hardware thread.  The calling
+  // thread takes part in the work, so threadCount - 1 workers are spawned.
+  explicit ThreadPool(int threadCount = 0);
+  ~ThreadPool();
+
+  int GetThreadCount() const;
+
+  // Runs task(i) for every i in [0, count) and blocks until all are done.
+  // Indices are handed out in increasing order.
+  void ParallelFor(int count, const std::function<void(int)>& task);
+
+ private:
+  void WorkerMain(int index);
+  void RunTasks();
+
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable wakeCondition_;
+  std::condition_variable doneCondition_;
+  uint64_t generation_;
+  int activeWorkers_;
+  bool quit_;
+
+  const std::function<void(int)>* task_;
+  int taskCount_;
+  std::atomic<int> nextTask_;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+namespace {
+int64_t GetClockTime() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Buffer of the calling thread in the one tracer that has used it, and the
+// name for buffers still to be created
+thread_local void* threadBuffer = nullptr;
+thread_local const Tracer* threadTracer = nullptr;
+thread_local std::string threadName;
+
+// Microseconds with nanosecond precision, as trace event timestamps
+void WriteMicroseconds(std::ostream& os, int64_t nanoseconds) {
+  os << nanoseconds / 1000 << '.';
+  const int64_t fraction = nanoseconds % 1000;
+  os << static_cast<char>('0' + fraction / 100)
+     << static_cast<char>('0' + fraction / 10 % 10)
+     << static_cast<char>('0' + fraction % 10);
+}
+}
+
+const int Tracer::kBufferCapacity;
+
+Tracer::Tracer()
+    : enabled_(false), epoch_(GetClockTime()) {
+}
+
+Tracer::~Tracer() {
+}
+
+Tracer& Tracer::GetDefault() {
+  // Never destroyed, as worker threads may still trace during static
+  // destruction
+  static Tracer* tracer = new Tracer;
+  return *tracer;
+}
+
+int64_t Tracer::GetTime() const {
+  return GetClockTime() - epoch_;
+}
+
+void Tracer::SetEnabled(bool enabled) {
+  enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void Tracer::SetThreadName(const std::string& name) {
+  threadName = name;
+  if (threadTracer == this) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    static_cast<ThreadBuffer*>(threadBuffer)->name = name;
+  }
+}
+
+void Tracer::AddEvent(const char* name, int64_t begin, int64_t end) {
+  ThreadBuffer* buffer = GetThreadBuffer();
+  const uint64_t head = buffer->head.load(std::memory_order_relaxed);
+  // A Write that sees any part of the event also sees this head, and thus
+  // knows the slot is being overwritten
+  std::atomic_thread_fence(std::memory_order_release);
+  EventSlot& slot = buffer->events[head % kBufferCapacity];
+  slot.name.store(name, std::memory_order_relaxed);
+  slot.begin.store(begin, std::memory_order_relaxed);
+  slot.end.store(end, std::memory_order_relaxed);
+  // Publishes the event to Write
+  buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void Tracer::Write(std::ostream& os) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  os << "{\"traceEvents\":[";
+  bool first = true;
+  std::vector<Event> events;
+  for (const auto& buffer : buffers_) {
+    os << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\","
+       << "\"pid\":1,\"tid\":" << buffer->threadId
+       << ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+    first = false;
+
+    // Copy the events, then drop those the thread may have overwritten in
+    // the meantime, including the one it may be writing
+    const uint64_t head = buffer->head.load(std::memory_order_acquire);
+    const uint64_t count = std::min<uint64_t>(head, kBufferCapacity);
+    events.resize(count);
+    for (uint64_t i = 0; i < count; ++i) {
+      const EventSlot& slot =
+        buffer->events[(head - count + i) % kBufferCapacity];
+      events[i].name = slot.name.load(std::memory_order_relaxed);
+      events[i].begin = slot.begin.load(std::memory_order_relaxed);
+      events[i].end = slot.end.load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t newHead = buffer->head.load(std::memory_order_relaxed);
+    const uint64_t oldest =
+      newHead >= kBufferCapacity ? newHead + 1 - kBufferCapacity : 0;
+    const uint64_t start = head - count;
+    const uint64_t overwritten =
+      oldest > start ? std::min(oldest - start, count) : 0;
+
+    for (uint64_t i = overwritten; i < count; ++i) {
+      const Event& event = events[i];
+      os << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"ts\":";
+      WriteMicroseconds(os, event.begin);
+      os << ",\"dur\":";
+      WriteMicroseconds(os, event.end - event.begin);
+      os << ",\"pid\":1,\"tid\":" << buffer->threadId << "}";
+    }
+  }
+  os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+bool Tracer::Write(const std::string& filename) const {
+  std::ofstream ofs(filename.c_str());
+  Write(ofs);
+  return static_cast<bool>(ofs);
+}
+
+Tracer::ThreadBuffer* Tracer::GetThreadBuffer() {
+  if (threadTracer == this) {
+    return static_cast<ThreadBuffer*>(threadBuffer);
+  }
+
+  // Buffers live as long as the tracer, so that events of threads that have
+  // exited are still written
+  std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer);
+  buffer->head.store(0, std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock(mutex_);
+  buffer->threadId = static_cast<int>(buffers_.size()) + 1;
+  if (threadName.empty()) {
+    std::ostringstream name;
+    name << "Thread " << buffer->threadId;
+    buffer->name = name.str();
+  } else {
+    buffer->name = threadName;
+  }
+  threadBuffer = buffer.get();
+  threadTracer = this;
+  buffers_.push_back(std::move(buffer));
+  return static_cast<ThreadBuffer*>(threadBuffer);
+}
@@ -0,0 +1,107 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include "boost/noncopyable.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Timeline of scoped events on all threads, written in the trace event
+// format of chrome://tracing and Perfetto.
+//
+// Every thread records into its own ring buffer without locks, which keeps
+// the last kBufferCapacity events.  The buffer of a thread is allocated on
+// its first event, so threads that never trace cost nothing.
+class Tracer : public boost::noncopyable {
+ public:
+  // Events kept per thread
+  static const int kBufferCapacity = 1 << 16;
+
+  Tracer();
+  ~Tracer();
+
+  // Shared by the renderer and the applications
+  static Tracer& GetDefault();
+
+  // Nanoseconds since the tracer was created
+  int64_t GetTime() const;
+
+  // Scopes are only recorded while enabled, and cost a relaxed load
+  // otherwise
+  void SetEnabled(bool enabled);
+  bool IsEnabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // Name of the calling thread in the timeline.  Names and event names are
+  // written as they are, and must not need escaping in JSON.
+  void SetThreadName(const std::string& name);
+
+  // Event name must outlive the tracer, usually a string literal
+  void AddEvent(const char* name, int64_t begin, int64_t end);
+
+  // Writes the buffered events of all threads.  Events that threads
+  // overwrite while they are copied are dropped, so dumping in the middle of
+  // a frame loses at most the oldest events.
+  void Write(std::ostream& os) const;
+  bool Write(const std::string& filename) const;
+
+ private:
+  struct Event {
+    const char* name;
+    int64_t begin;
+    int64_t end;
+  };
+
+  // Atomic, as Write may read a slot while its thread overwrites it.
+  // Relaxed accesses compile to plain loads and stores.
+  struct EventSlot {
+    std::atomic<const char*> name;
+    std::atomic<int64_t> begin;
+    std::atomic<int64_t> end;
+  };
+
+  struct ThreadBuffer {
+    int threadId;
+    std::string name;
+    // Number of events ever recorded, only written by the owning thread
+    std::atomic<uint64_t> head;
+    EventSlot events[kBufferCapacity];
+  };
+
+  ThreadBuffer* GetThreadBuffer();
+
+  std::atomic<bool> enabled_;
+  const int64_t epoch_;
+  // Guards the list of buffers and the thread names
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+};
+
+// Records the time from construction to destruction as an event of the
+// default tracer
+class TraceScope : public boost::noncopyable {
+ public:
+  explicit TraceScope(const char* name)
+    : name_(Tracer::GetDefault().IsEnabled() ? name : nullptr),
+      begin_(name_ ? Tracer::GetDefault().GetTime() : 0) {
+  }
+
+  ~TraceScope() {
+    if (name_) {
+      Tracer& tracer = Tracer::GetDefault();
+      tracer.AddEvent(name_, begin_, tracer.GetTime());
+    }
+  }
+
+ private:
+  const char* name_;
+  int64_t begin_;
+};
+
+#endif
@@ -0,0 +1,207 @@
+#define BOOST_TEST_MODULE Clipping
+#include <boost/test/included/unit_test.hpp>
+
+#include "RastaManRenderer.hpp"
+#include "RenderTarget.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+using namespace Eigen;
+
+// Triangles clipped at the near plane or the guard band, or split for the
+// fixed point edge functions, must give the same image as unclipped
+// triangles covering the same part of the viewport.
+
+namespace {
+const float kPi = 3.14159265f;
+
+// Triangles with vertex colors
+struct Geometry {
+  void AddVertex(const Vector3f& position, const Vector4f& color) {
+    positions.push_back(position);
+    colors.insert(colors.end(), color.data(), color.data() + 4);
+  }
+  void AddTriangle(int a, int b, int c) {
+    indices.push_back(a);
+    indices.push_back(b);
+    indices.push_back(c);
+  }
+
+  std::vector<Vector3f> positions;
+  std::vector<float> colors;
+  std::vector<int> indices;
+};
+
+struct Image {
+  std::vector<Vector4f> colors;
+  std::vector<float> depths;
+  uint64_t trianglesClipped;
+};
+
+Matrix4f GetPerspectiveMatrix(float fieldOfView, float aspect, float zNear,
+                              float zFar) {
+  const float f = 1.f/std::tan(fieldOfView/180.f * kPi * .5f);
+  return (Matrix4f() <<
+    f/aspect, 0, 0, 0,
+    0, f, 0, 0,
+    0, 0, (zFar + zNear)/(zNear - zFar), 2*zFar*zNear/(zNear - zFar),
+    0, 0, -1, 0).finished();
+}
+
+Image Render(int width, int height, const Matrix4f& projectionMatrix,
+             const Geometry& geometry) {
+  const auto renderTarget = std::make_shared<RenderTarget>(width, height);
+  RastaManRenderer renderer(renderTarget);
+  renderer.SetViewport(0, 0, width, height);
+  renderer.SetProjectionMatrix(projectionMatrix);
+  renderer.SetModelViewMatrix(Matrix4f::Identity());
+  renderer.SetStatisticsEnabled(true);
+  const float clearColor[4] = { 0, 0, 0, 0 };
+  renderer.Clear(clearColor);
+  VertexAttributes attributes;
+  attributes.colors = &geometry.colors[0];
+  renderer.DrawTriangles(&geometry.positions[0], attributes,
+                         &geometry.indices[0],
+                         static_cast<int>(geometry.indices.size()));
+
+  Image image;
+  const auto backBuffer = renderTarget->GetBackBuffer();
+  const auto zBuffer = renderTarget->GetZBuffer();
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      image.colors.push_back(backBuffer->ReadValue(x, y));
+      image.depths.push_back(zBuffer->ReadValue(x, y));
+    }
+  }
+  image.trianglesClipped = renderer.GetStatistics().trianglesClipped;
+  return image;
+}
+
+// Pixels of two images must be covered alike, and their colors and depths
+// may only differ by interpolation rounding
+void CheckSameImage(const Image& image, const Image& reference) {
+  int coverageDifferences = 0;
+  int colorDifferences = 0;
+  int depthDifferences = 0;
+  int covered = 0;
+  for (std::size_t i = 0; i < image.colors.size(); ++i) {
+    const bool imageCovered = image.colors[i].w() > 0;
+    const bool referenceCovered = reference.colors[i].w() > 0;
+    if (imageCovered != referenceCovered) {
+      ++coverageDifferences;
+    } else if (imageCovered) {
+      ++covered;
+      if ((image.colors[i] - reference.colors[i]).cwiseAbs().maxCoeff()
+          > 1e-3f) {
+        ++colorDifferences;
+      }
+      if (std::abs(image.depths[i] - reference.depths[i]) > 1e-5f) {
+        ++depthDifferences;
+      }
+    }
+  }
+  BOOST_CHECK_GT(covered, 0);
+  BOOST_CHECK_EQUAL(coverageDifferences, 0);
+  BOOST_CHECK_EQUAL(colorDifferences, 0);
+  BOOST_CHECK_EQUAL(depthDifferences, 0);
+}
+
+// Color and depth of a plane, linear in normalized device coordinates
+Vector4f GetPlaneColor(float x, float y) {
+  return Vector4f(.5f + .25f*x, .5f - .25f*y, .25f + .125f*(x + y), 1);
+}
+
+Vector3f GetPlanePosition(float x, float y) {
+  return Vector3f(x, y, .25f*x - .125f*y);
+}
+
+// Orthographic view of a triangle of a plane, which covers the viewport and
+// reaches far beyond the guard band, against a grid of quads that covers
+// just the viewport, with cells small enough to need no clipping
+void CheckFullscreenTriangle(int width, int height, int cells) {
+  Geometry triangle;
+  const float corners[3][2] = { { -1, -1 }, { 400, -1 }, { -1, 400 } };
+  for (const auto& corner : corners) {
+    triangle.AddVertex(GetPlanePosition(corner[0], corner[1]),
+                       GetPlaneColor(corner[0], corner[1]));
+  }
+  triangle.AddTriangle(0, 1, 2);
+
+  Geometry grid;
+  for (int j = 0; j <= cells; ++j) {
+    for (int i = 0; i <= cells; ++i) {
+      const float x = -1 + 2.0f * i / cells;
+      const float y = -1 + 2.0f * j / cells;
+      grid.AddVertex(GetPlanePosition(x, y), GetPlaneColor(x, y));
+    }
+  }
+  for (int j = 0; j < cells; ++j) {
+    for (int i = 0; i < cells; ++i) {
+      const int first = j*(cells + 1) + i;
+      grid.AddTriangle(first, first + 1, first + cells + 2);
+      grid.AddTriangle(first, first + cells + 2, first + cells + 1);
+    }
+  }
+
+  const Image image = Render(width, height, Matrix4f::Identity(), triangle);
+  const Image reference = Render(width, height, Matrix4f::Identity(), grid);
+  BOOST_CHECK_GT(image.trianglesClipped, 0u);
+  BOOST_CHECK_EQUAL(reference.trianglesClipped, 0u);
+  CheckSameImage(image, reference);
+  const auto uncovered = std::count_if(
+    image.colors.begin(), image.colors.end(),
+    [] (const Vector4f& color) { return !(color.w() > 0); });
+  BOOST_CHECK_EQUAL(uncovered, 0);
+}
+}
+
+BOOST_AUTO_TEST_CASE(GuardBand) {
+  CheckFullscreenTriangle(256, 256, 1);
+}
+
+// Viewports wide enough that the triangles clipped to them are too large for
+// the fixed point edge functions
+BOOST_AUTO_TEST_CASE(GuardBandSplit) {
+  CheckFullscreenTriangle(4096, 2160, 4);
+}
+
+// Perspective view of a floor triangle with two vertices behind the camera
+// against the same triangle cut in front of the near plane.  The cut off
+// part lies below the viewport.
+BOOST_AUTO_TEST_CASE(NearPlane) {
+  const Vector3f positions[3] = {
+    Vector3f(-1, -1, 1), Vector3f(1, -1, 1), Vector3f(0, -1, -20)
+  };
+  const Vector4f colors[3] = {
+    Vector4f(1, 0, 0, 1), Vector4f(0, 1, 0, 1), Vector4f(0, 0, 1, 1)
+  };
+  Geometry triangle;
+  for (int i = 0; i < 3; ++i) {
+    triangle.AddVertex(positions[i], colors[i]);
+  }
+  triangle.AddTriangle(0, 1, 2);
+
+  // Cut at z = -0.5, which is projected to y = -2 in normalized device
+  // coordinates
+  const float cut = -.5f;
+  Geometry cutTriangle;
+  for (int i = 0; i < 2; ++i) {
+    const float t = (cut - positions[i].z()) / (positions[2].z()
+                                                - positions[i].z());
+    cutTriangle.AddVertex(positions[i] + (positions[2] - positions[i]) * t,
+                          colors[i] + (colors[2] - colors[i]) * t);
+  }
+  cutTriangle.AddVertex(positions[2], colors[2]);
+  cutTriangle.AddTriangle(0, 1, 2);
+
+  const Matrix4f projectionMatrix =
+    GetPerspectiveMatrix(90.0f, 1.0f, 0.1f, 100.0f);
+  const Image image = Render(256, 256, projectionMatrix, triangle);
+  const Image reference = Render(256, 256, projectionMatrix, cutTriangle);
+  BOOST_CHECK_GT(image.trianglesClipped, 0u);
+  BOOST_CHECK_EQUAL(reference.trianglesClipped, 0u);
+  CheckSameImage(image, reference);
+}
@@ -0,0 +1,201 @@
+#define BOOST_TEST_MODULE Mesh
+#include <boost/test/included/unit_test.hpp>
+
+#include "Mesh.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace Eigen;
+
+// Mesh caches that are truncated, whose headers are corrupt or whose indices
+// are out of range must be rejected, and the model parsed again.
+
+namespace {
+// Byte offsets of the fields of the cache header, as written by
+// Mesh::WriteCache
+const std::streamoff kMagicOffset = 0;
+const std::streamoff kVersionOffset = 4;
+const std::streamoff kVertexCountOffset = 24;
+const std::streamoff kIndexCountOffset = 28;
+const std::streamoff kVertexOffsetOffset = 56;
+const std::streamoff kIndexOffsetOffset = 64;
+const std::streamoff kAttributeOffsetsOffset = 72;
+
+// A model in a directory of its own, removed afterwards
+class ModelFixture {
+ public:
+  ModelFixture()
+      : directory_(std::filesystem::temp_directory_path()
+                   / "RastaManMeshTest") {
+    std::filesystem::remove_all(directory_);
+    std::filesystem::create_directory(directory_);
+    modelName_ = (directory_ / "quads.obj").string();
+    cacheName_ = modelName_ + ".rmesh";
+    std::ofstream ofs(modelName_.c_str());
+    ofs << "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 2 0 1\nv 2 1 1\n"
+        << "f 1 2 3\nf 1 3 4\nf 2 5 6\nf 2 6 3\n";
+  }
+  ~ModelFixture() {
+    std::error_code error;
+    std::filesystem::remove_all(directory_, error);
+  }
+
+  const char* GetModelName() const { return modelName_.c_str(); }
+  const std::string& GetCacheName() const { return cacheName_; }
+
+  template<typename T>
+  T Read(std::streamoff offset) const {
+    std::ifstream ifs(cacheName_.c_str(), std::ios::binary);
+    T value;
+    ifs.seekg(offset);
+    ifs.read(reinterpret_cast<char*>(&value), sizeof(value));
+    return value;
+  }
+
+  // Overwrites bytes of the cache
+  template<typename T>
+  void Patch(std::streamoff offset, T value) const {
+    std::fstream fs(cacheName_.c_str(),
+                    std::ios::in | std::ios::out | std::ios::binary);
+    fs.seekp(offset);
+    fs.write(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  // Sets the first coordinate of the first vertex in the cache, so that
+  // loads that use the cache can be told apart from loads that parse
+  void MarkVertices() const {
+    Patch(static_cast<std::streamoff>(Read<uint64_t>(kVertexOffsetOffset)),
+          kMarker);
+  }
+
+  static const float kMarker;
+
+ private:
+  std::filesystem::path directory_;
+  std::string modelName_;
+  std::string cacheName_;
+};
+
+const float ModelFixture::kMarker = 42.0f;
+
+// Writes a cache with marked vertices, corrupts it and checks that loading
+// parses the model again, and writes a valid cache once more
+template<typename Corrupt>
+void CheckRejected(Corrupt corrupt) {
+  ModelFixture model;
+  Mesh parsed;
+  BOOST_REQUIRE(parsed.Load(model.GetModelName()));
+  BOOST_REQUIRE(std::filesystem::exists(model.GetCacheName()));
+  model.MarkVertices();
+  corrupt(model);
+
+  Mesh mesh;
+  BOOST_REQUIRE(mesh.Load(model.GetModelName()));
+  BOOST_REQUIRE_EQUAL(mesh.GetVertexCount(), parsed.GetVertexCount());
+  BOOST_REQUIRE_EQUAL(mesh.GetIndexCount(), parsed.GetIndexCount());
+  for (int i = 0; i < mesh.GetVertexCount(); ++i) {
+    BOOST_CHECK(mesh.GetVertices()[i] == parsed.GetVertices()[i]);
+  }
+  for (int i = 0; i < mesh.GetIndexCount(); ++i) {
+    BOOST_CHECK_EQUAL(mesh.GetIndices()[i], parsed.GetIndices()[i]);
+  }
+
+  Mesh cached;
+  BOOST_REQUIRE(cached.Load(model.GetModelName()));
+  BOOST_CHECK_EQUAL(cached.GetVertexCount(), parsed.GetVertexCount());
+}
+
+void Truncate(const ModelFixture& model, uint64_t size) {
+  std::filesystem::resize_file(model.GetCacheName(), size);
+}
+}
+
+BOOST_AUTO_TEST_CASE(ValidCacheIsUsed) {
+  ModelFixture model;
+  Mesh parsed;
+  BOOST_REQUIRE(parsed.Load(model.GetModelName()));
+  model.MarkVertices();
+  Mesh cached;
+  BOOST_REQUIRE(cached.Load(model.GetModelName()));
+  BOOST_REQUIRE_EQUAL(cached.GetVertexCount(), parsed.GetVertexCount());
+  BOOST_CHECK_EQUAL(cached.GetVertices()[0].x(), ModelFixture::kMarker);
+  BOOST_CHECK(cached.GetAttribute(MESH_NORMAL));
+}
+
+BOOST_AUTO_TEST_CASE(TruncatedHeader) {
+  CheckRejected([] (const ModelFixture& model) { Truncate(model, 16); });
+  CheckRejected([] (const ModelFixture& model) { Truncate(model, 0); });
+}
+
+// Caches are padded at the end, so the arrays are cut into
+BOOST_AUTO_TEST_CASE(TruncatedArrays) {
+  CheckRejected([] (const ModelFixture& model) {
+    Truncate(model, model.Read<uint64_t>(kVertexOffsetOffset) + 4);
+  });
+  CheckRejected([] (const ModelFixture& model) {
+    const uint64_t normalsEnd = model.Read<uint64_t>(kAttributeOffsetsOffset)
+      + model.Read<uint32_t>(kVertexCountOffset) * 3 * sizeof(float);
+    Truncate(model, normalsEnd - 4);
+  });
+}
+
+BOOST_AUTO_TEST_CASE(WrongMagic) {
+  CheckRejected([] (const ModelFixture& model) {
+    model.Patch(kMagicOffset, 'X');
+  });
+}
+
+BOOST_AUTO_TEST_CASE(WrongVersion) {
+  CheckRejected([] (const ModelFixture& model) {
+    model.Patch(kVersionOffset, uint32_t(1));
+  });
+}
+
+BOOST_AUTO_TEST_CASE(CountsBeyondFile) {
+  CheckRejected([] (const ModelFixture& model) {
+    model.Patch(kVertexCountOffset, uint32_t(0x7fffffff));
+  });
+  CheckRejected([] (const ModelFixture& model) {
+    model.Patch(kIndexCountOffset, uint32_t(0xffffffff));
+  });
+}
+
+// Offsets so large that offset plus size wraps around
+BOOST_AUTO_TEST_CASE(OffsetsWrappingAround) {
+  CheckRejected([] (const ModelFixture& model) {
+    model.Patch(kVertexOffsetOffset, ~uint64_t(63));
+  });
+  CheckRejected([] (const ModelFixture& model) {
+    model.Patch(kIndexOffsetOffset, ~uint64_t(63));
+  });
+  CheckRejected([] (const ModelFixture& model) {
+    model.Patch(kAttributeOffsetsOffset, ~uint64_t(63));
+  });
+}
+
+// Indices the renderer would use to read beyond the vertex arrays
+BOOST_AUTO_TEST_CASE(IndicesOutOfRange) {
+  CheckRejected([] (const ModelFixture& model) {
+    model.Patch(static_cast<std::streamoff>(
+                  model.Read<uint64_t>(kIndexOffsetOffset)) + 5 * 4,
+                static_cast<int>(model.Read<uint32_t>(kVertexCountOffset)));
+  });
+  CheckRejected([] (const ModelFixture& model) {
+    model.Patch(static_cast<std::streamoff>(
+                  model.Read<uint64_t>(kIndexOffsetOffset)) + 11 * 4,
+                -1);
+  });
+}
+
+BOOST_AUTO_TEST_CASE(MisalignedOffsets) {
+  CheckRejected([] (const ModelFixture& model) {
+    model.Patch(kVertexOffsetOffset, uint64_t(68));
+  });
+  CheckRejected([] (const ModelFixture& model) {
+    model.Patch(kAttributeOffsetsOffset, uint64_t(4));
+  });
+}
@@ -0,0 +1,191 @@
+#define BOOST_TEST_MODULE ObjLoader
+#include <boost/test/included/unit_test.hpp>
+
+#include "ObjLoader.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace Eigen;
+
+// LoadSimpleObj must give the same geometry as the stream-based parser it
+// replaced for well-formed files, including the corner cases of its
+// tokenization and files split into several chunks.
+
+namespace {
+struct ObjGeometry {
+  std::vector<Vector3f> vertices;
+  std::vector<int> indices;
+  Vector3f min = Vector3f::Zero();
+  Vector3f max = Vector3f::Zero();
+};
+
+// The previous parser, which read the file line by line with operator>>
+ObjGeometry LoadWithStreams(const std::string& filename) {
+  ObjGeometry geometry;
+  std::ifstream ifs(filename.c_str());
+  std::string line;
+  while (std::getline(ifs, line)) {
+    if (line[0] == '#') continue;
+    std::stringstream ss(line);
+    std::string keyword;
+    ss >> keyword;
+    if (keyword == "v") {
+      Vector3f vec;
+      ss >> vec.x() >> vec.y() >> vec.z();
+      if (geometry.vertices.empty()) {
+        geometry.min = geometry.max = vec;
+      } else {
+        geometry.min = geometry.min.cwiseMin(vec);
+        geometry.max = geometry.max.cwiseMax(vec);
+      }
+      geometry.vertices.push_back(vec);
+    } else if (keyword == "f") {
+      int idx[3];
+      for (int i = 0; i < 3; ++i) {
+        ss >> idx[i];
+        ss.ignore(1000, ' ');
+        geometry.indices.push_back(idx[i] - 1);
+      }
+      idx[1] = idx[2];
+      while (ss >> idx[2]) {
+        ss.ignore(1000, ' ');
+        geometry.indices.push_back(idx[0] - 1);
+        geometry.indices.push_back(idx[1] - 1);
+        geometry.indices.push_back(idx[2] - 1);
+        idx[1] = idx[2];
+      }
+    }
+  }
+  return geometry;
+}
+
+// Writes an OBJ file, removed afterwards
+class ObjFile {
+ public:
+  explicit ObjFile(const std::string& contents)
+      : name_((std::filesystem::temp_directory_path()
+               / "RastaManObjLoaderTest.obj").string()) {
+    std::ofstream ofs(name_.c_str(), std::ios::binary);
+    ofs << contents;
+  }
+  ~ObjFile() {
+    std::remove(name_.c_str());
+  }
+
+  const std::string& GetName() const { return name_; }
+
+ private:
+  std::string name_;
+};
+
+void CheckSameGeometry(const std::string& contents) {
+  const ObjFile file(contents);
+  ObjGeometry geometry;
+  BOOST_REQUIRE(LoadSimpleObj(file.GetName().c_str(), geometry.vertices,
+                              geometry.indices, geometry.min, geometry.max));
+  const ObjGeometry reference = LoadWithStreams(file.GetName());
+
+  BOOST_REQUIRE_EQUAL(geometry.vertices.size(), reference.vertices.size());
+  int vertexDifferences = 0;
+  for (std::size_t i = 0; i < geometry.vertices.size(); ++i) {
+    vertexDifferences += geometry.vertices[i] != reference.vertices[i];
+  }
+  BOOST_CHECK_EQUAL(vertexDifferences, 0);
+  BOOST_CHECK(geometry.indices == reference.indices);
+  if (!reference.vertices.empty()) {
+    BOOST_CHECK(geometry.min == reference.min);
+    BOOST_CHECK(geometry.max == reference.max);
+  }
+}
+
+const char* const kCornerCases =
+  "# comment\n"
+  "v 0 0 0\n"
+  "v 1.5 -2.25 3e-2\n"
+  "v +1 +0.5 -.75\n"
+  "\tv\t2 \t 3\t4\n"
+  "v 1e10 -1E-10 0.1\n"
+  "   v   5   6   7   \n"
+  "\n"
+  "o object\n"
+  "vn 0 0 1\n"
+  "vt 0.5 0.5\n"
+  "f 1 2 3\n"
+  "f 1/1/1 2/1/1 3/1/1 4/1/1\n"
+  "f 2//1 3//1 4//1\n"
+  "f +1 +2 +3\n"
+  "f 1 2 3 4 5 6\n"
+  "  f 4 5 6\n"
+  "fo 1 2 3\n"
+  "#f 1 2 3\n";
+}
+
+BOOST_AUTO_TEST_CASE(CornerCases) {
+  CheckSameGeometry(kCornerCases);
+}
+
+BOOST_AUTO_TEST_CASE(CarriageReturns) {
+  std::string contents;
+  for (const char* c = kCornerCases; *c; ++c) {
+    if (*c == '\n') {
+      contents += '\r';
+    }
+    contents += *c;
+  }
+  CheckSameGeometry(contents);
+}
+
+BOOST_AUTO_TEST_CASE(NoTrailingNewline) {
+  CheckSameGeometry("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3");
+  CheckSameGeometry("f 1 2 3\nv 0 0 0\nv 1 0 0\nv 0 1 2.5");
+}
+
+BOOST_AUTO_TEST_CASE(Empty) {
+  CheckSameGeometry("");
+  CheckSameGeometry("# nothing\n");
+}
+
+// Files of several MB are parsed in chunks, whose boundaries split lines at
+// arbitrary positions
+BOOST_AUTO_TEST_CASE(Chunks) {
+  std::ostringstream oss;
+  int vertexCount = 0;
+  for (int line = 0; oss.tellp() < (3 << 20) + 12345; ++line) {
+    switch (line % 7) {
+      case 0:
+        oss << "v " << line * 0.001f << " " << -line << " +" << line % 97
+            << ".125\n";
+        ++vertexCount;
+        break;
+      case 1:
+        oss << "\tv\t" << line << "e-3 " << line % 13 << " 1e5\r\n";
+        ++vertexCount;
+        break;
+      case 2:
+        oss << "f " << vertexCount << " " << vertexCount - 1 << " "
+            << vertexCount / 2 + 1 << "\n";
+        break;
+      case 3:
+        oss << "f " << vertexCount << "/1/1 " << vertexCount - 1 << "//2 "
+            << line % vertexCount + 1 << "/3 1/1/1\n";
+        break;
+      case 4:
+        oss << "# comment " << std::string(line % 50, 'x') << "\n";
+        break;
+      case 5:
+        oss << "vn 0 0 1\nvt " << line % 3 << " 0\n";
+        break;
+      default:
+        oss << "v " << -line * 0.5f << " " << line * 3 << " " << line % 5
+            << "\n";
+        ++vertexCount;
+        break;
+    }
+  }
+  CheckSameGeometry(oss.str());
+}
@@ -0,0 +1,136 @@
+#define BOOST_TEST_MODULE Occlusion
+#include <boost/test/included/unit_test.hpp>
+
+#include "RastaManRenderer.hpp"
+#include "RenderTarget.hpp"
+
+#include <memory>
+#include <vector>
+
+using namespace Eigen;
+
+// Occlusion queries against a known occluder: an orthographic triangle at
+// depth 0.5 that covers the pixel columns [0, kOccludedColumns) of the
+// viewport.
+// Its right edge lies inside a Hi-Z block, so queries near it are decided
+// pixel by pixel.
+
+namespace {
+const int kSize = 256;
+const int kOccludedColumns = 134;
+const float kOccluderDepth = 0.5f;
+
+AlignedBox<int, 2> GetRect(int x0, int y0, int x1, int y1) {
+  return AlignedBox<int, 2>(Vector2i(x0, y0), Vector2i(x1, y1));
+}
+
+// Box in normalized device coordinates, with depths in [0, 1]
+AlignedBox3f GetBox(float x0, float y0, float z0, float x1, float y1,
+                    float z1) {
+  return AlignedBox3f(Vector3f(x0, y0, 2*z0 - 1), Vector3f(x1, y1, 2*z1 - 1));
+}
+
+class OccluderFixture {
+ public:
+  explicit OccluderFixture(bool conservativeRaster)
+      : renderTarget_(std::make_shared<RenderTarget>(kSize, kSize)),
+        renderer_(renderTarget_) {
+    renderer_.SetViewport(0, 0, kSize, kSize);
+    renderer_.SetProjectionMatrix(Matrix4f::Identity());
+    renderer_.SetModelViewMatrix(Matrix4f::Identity());
+    PipelineState state;
+    state.colorWrite = false;
+    state.conservativeRaster = conservativeRaster;
+    state.cullMode = CULL_NONE;
+    renderer_.SetPipelineState(state);
+    const float clearColor[4] = { 0, 0, 0, 0 };
+    renderer_.Clear(clearColor);
+
+    // One triangle with its right edge at 134.4 pixels.  Conservative
+    // rasterization leaves pixels on edges shared by triangles empty.
+    const float right = 2.0f * (kOccludedColumns + .4f) / kSize - 1;
+    const float z = 2*kOccluderDepth - 1;
+    const Vector3f vertices[3] = {
+      Vector3f(right, -3, z), Vector3f(right, 3, z), Vector3f(-5, 0, z)
+    };
+    const int indices[3] = { 0, 1, 2 };
+    renderer_.DrawTriangles(vertices, indices, 3);
+  }
+
+  RastaManRenderer& GetRenderer() { return renderer_; }
+
+ private:
+  std::shared_ptr<RenderTarget> renderTarget_;
+  RastaManRenderer renderer_;
+};
+
+void CheckQueries(bool conservativeRaster) {
+  OccluderFixture fixture(conservativeRaster);
+  RastaManRenderer& renderer = fixture.GetRenderer();
+  const int last = kOccludedColumns - 1;
+
+  // Whole Hi-Z blocks behind and in front of the occluder
+  BOOST_CHECK(!renderer.IsVisible(GetRect(0, 0, 127, kSize - 1), .6f));
+  BOOST_CHECK(renderer.IsVisible(GetRect(0, 0, 127, kSize - 1), .4f));
+  // Up to the last occluded column, and one beyond it, within one block
+  BOOST_CHECK(!renderer.IsVisible(GetRect(128, 8, last, 15), .6f));
+  BOOST_CHECK(!renderer.IsVisible(GetRect(last, 100, last, 100), .6f));
+  BOOST_CHECK(renderer.IsVisible(GetRect(128, 8, last + 1, 15), .6f));
+  BOOST_CHECK(renderer.IsVisible(GetRect(last + 1, 100, last + 1, 100), .6f));
+  BOOST_CHECK(renderer.IsVisible(GetRect(200, 8, 220, 15), .99f));
+  // Pixels outside the render target are never visible
+  BOOST_CHECK(!renderer.IsVisible(GetRect(kSize, 0, kSize + 10, 10), .0f));
+  BOOST_CHECK(!renderer.IsVisible(GetRect(-10, -10, -1, -1), .0f));
+  BOOST_CHECK(!renderer.IsVisible(GetRect(-10, 0, 10, 10), .6f));
+  BOOST_CHECK(renderer.IsVisible(GetRect(-10, 0, kSize + 10, 10), .6f));
+
+  // Boxes, by their screen-space bounds and nearest depth
+  const std::vector<AlignedBox3f> boxes = {
+    GetBox(-.9f, -.5f, .6f, -.1f, .5f, .8f),   // Behind
+    GetBox(-.9f, -.5f, .3f, -.1f, .5f, .8f),   // Partly in front
+    GetBox(.2f, -.5f, .6f, .8f, .5f, .8f),     // Beside
+    GetBox(-.9f, -.5f, .6f, .1f, .5f, .8f),    // Behind and beside
+    GetBox(-.9f, -.5f, -1.f, -.1f, .5f, .8f),  // Across the near plane
+    GetBox(1.5f, -.5f, .1f, 1.9f, .5f, .2f)    // Outside the viewport
+  };
+  const bool expected[] = { false, true, true, true, true, false };
+  bool visible[6];
+  renderer.IsVisible(&boxes[0], 6, visible);
+  for (int i = 0; i < 6; ++i) {
+    BOOST_TEST_CONTEXT("box " << i) {
+      BOOST_CHECK_EQUAL(renderer.IsVisible(boxes[i]), expected[i]);
+      BOOST_CHECK_EQUAL(visible[i], expected[i]);
+    }
+  }
+}
+}
+
+BOOST_AUTO_TEST_CASE(Occluder) {
+  CheckQueries(false);
+}
+
+// The occluder's edge lies 0.4 pixels into a column, so conservative
+// rasterization covers the same pixels
+BOOST_AUTO_TEST_CASE(ConservativeOccluder) {
+  CheckQueries(true);
+}
+
+// Nothing is occluded before the first clear, after construction or resize.
+// Zeroed blocks of the Hi-Z buffers' sizes are left in the surface pool
+// beforehand, where the Hi-Z buffers are likely to find them.
+BOOST_AUTO_TEST_CASE(BeforeClear) {
+  const int blockSize = RenderTarget::kHiZBlockSize;
+  {
+    RenderSurface1f small(kSize / blockSize, kSize / blockSize);
+    RenderSurface1f large(2 * kSize / blockSize, kSize / blockSize);
+    small.Fill(0.0f);
+    large.Fill(0.0f);
+  }
+  const auto renderTarget = std::make_shared<RenderTarget>(kSize, kSize);
+  RastaManRenderer renderer(renderTarget);
+  renderer.SetViewport(0, 0, kSize, kSize);
+  BOOST_CHECK(renderer.IsVisible(GetRect(0, 0, kSize - 1, kSize - 1), .99f));
+  renderTarget->Resize(2 * kSize, kSize);
+  BOOST_CHECK(renderer.IsVisible(GetRect(0, 0, 2 * kSize - 1, kSize - 1),
+                                 .99f));
+}
@@ -0,0 +1,102 @@
+#define BOOST_TEST_MODULE PixelFormat
+#include <boost/test/included/unit_test.hpp>
+
+#include "PixelFormat.hpp"
+#include "RenderSurface.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Normalized depth formats must decode to depths that encode to the same
+// bits, and must never store a depth farther than the one written.
+
+namespace {
+template<typename Pixel>
+void CheckDepthRoundTrip(uint32_t max) {
+  typedef PixelTraits<Pixel> Traits;
+  uint32_t failures = 0;
+  for (uint32_t bits = 0; bits <= max; ++bits) {
+    Pixel pixel;
+    pixel.bits = bits;
+    if (Traits::Encode(Traits::Decode(pixel)).bits != bits) {
+      ++failures;
+    }
+  }
+  BOOST_CHECK_EQUAL(failures, 0u);
+}
+
+// Every 257th float in [0, 1], which includes all exponents
+template<typename Pixel>
+void CheckDepthNeverFarther() {
+  typedef PixelTraits<Pixel> Traits;
+  uint32_t failures = 0;
+  const uint32_t oneBits = detail::FloatBits(1.0f);
+  for (uint32_t bits = 0; bits <= oneBits; bits += 257) {
+    const float depth = detail::BitsFloat(bits);
+    if (Traits::Decode(Traits::Encode(depth)) > depth) {
+      ++failures;
+    }
+  }
+  BOOST_CHECK_EQUAL(failures, 0u);
+}
+
+template<typename Pixel>
+void CheckDepthSaturation(uint32_t max) {
+  typedef PixelTraits<Pixel> Traits;
+  BOOST_CHECK_EQUAL(Traits::Encode(0.0f).bits, 0u);
+  BOOST_CHECK_EQUAL(Traits::Encode(1.0f).bits, max);
+  BOOST_CHECK_EQUAL(Traits::Encode(-1.0f).bits, 0u);
+  BOOST_CHECK_EQUAL(Traits::Encode(2.0f).bits, max);
+  BOOST_CHECK_EQUAL(
+    Traits::Encode(std::numeric_limits<float>::quiet_NaN()).bits, 0u);
+  Pixel pixel;
+  pixel.bits = 0;
+  BOOST_CHECK_EQUAL(Traits::Decode(pixel), 0.0f);
+  pixel.bits = max;
+  BOOST_CHECK_EQUAL(Traits::Decode(pixel), 1.0f);
+}
+
+// Depths read back from a surface and written again must not change it
+template<typename Pixel>
+void CheckSurfaceRoundTrip() {
+  const int width = 256;
+  const int height = 64;
+  RenderSurface<Pixel> surface(width, height);
+  std::vector<float> depths(width * height);
+  for (int i = 0; i < width * height; ++i) {
+    depths[i] = std::sin(i * 0.001f) * 0.5f + 0.5f;
+  }
+  const Eigen::AlignedBox<int, 2> rect(Eigen::Vector2i(0, 0),
+                                       Eigen::Vector2i(width - 1, height - 1));
+  surface.WriteRect(rect, &depths[0], width);
+  std::vector<float> first(width * height);
+  surface.ReadRect(rect, &first[0], width);
+  surface.WriteRect(rect, &first[0], width);
+  std::vector<float> second(width * height);
+  surface.ReadRect(rect, &second[0], width);
+  int changed = 0;
+  int farther = 0;
+  for (int i = 0; i < width * height; ++i) {
+    changed += first[i] != second[i];
+    farther += first[i] > depths[i];
+  }
+  BOOST_CHECK_EQUAL(changed, 0);
+  BOOST_CHECK_EQUAL(farther, 0);
+}
+}
+
+BOOST_AUTO_TEST_CASE(D24RoundTrip) {
+  CheckDepthRoundTrip<PixelD24>(0xffffff);
+  CheckDepthNeverFarther<PixelD24>();
+  CheckDepthSaturation<PixelD24>(0xffffff);
+  CheckSurfaceRoundTrip<PixelD24>();
+}
+
+BOOST_AUTO_TEST_CASE(D16RoundTrip) {
+  CheckDepthRoundTrip<PixelD16>(0xffff);
+  CheckDepthNeverFarther<PixelD16>();
+  CheckDepthSaturation<PixelD16>(0xffff);
+  CheckSurfaceRoundTrip<PixelD16>();
+}
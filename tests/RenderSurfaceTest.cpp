@@ -0,0 +1,198 @@
+#define BOOST_TEST_MODULE RenderSurface
+#include <boost/test/included/unit_test.hpp>
+
+#include "RastaManRenderer.hpp"
+#include "RenderSurface.hpp"
+#include "RenderTarget.hpp"
+
+#include <memory>
+#include <vector>
+
+using namespace Eigen;
+
+// Clears only flag the tiles of a surface.  Every way of reading a surface
+// must see the clear value in tiles not written since, and the written
+// values elsewhere, also where rects cover parts of several tiles.
+
+namespace {
+// Not a multiple of the clear tile size, so the last tiles are partial
+const int kWidth = 200;
+const int kHeight = 150;
+const float kClearDepth = 0.75f;
+
+AlignedBox<int, 2> GetRect(int x0, int y0, int x1, int y1) {
+  return AlignedBox<int, 2>(Vector2i(x0, y0), Vector2i(x1, y1));
+}
+
+AlignedBox<int, 2> GetSurfaceRect() {
+  return GetRect(0, 0, kWidth - 1, kHeight - 1);
+}
+
+// Depth written to a pixel by WriteRegion
+float GetWrittenDepth(int x, int y) {
+  return (y * kWidth + x) * (0.5f / (kWidth * kHeight));
+}
+
+// Writes GetWrittenDepth to every pixel of rect
+void WriteRegion(RenderSurface1f& surface, const AlignedBox<int, 2>& rect) {
+  const Vector2i size = rect.sizes() + Vector2i::Ones();
+  std::vector<float> depths(size.x() * size.y());
+  for (int y = 0; y < size.y(); ++y) {
+    for (int x = 0; x < size.x(); ++x) {
+      depths[y * size.x() + x] =
+        GetWrittenDepth(rect.min().x() + x, rect.min().y() + y);
+    }
+  }
+  surface.WriteRect(rect, &depths[0], size.x());
+}
+
+// Reads the whole surface with ReadRect and checks every pixel against the
+// written rects, reading back the clear value elsewhere
+void CheckSurface(const RenderSurface1f& surface,
+                  const std::vector<AlignedBox<int, 2>>& written) {
+  std::vector<float> depths(kWidth * kHeight);
+  surface.ReadRect(GetSurfaceRect(), &depths[0], kWidth);
+  int differences = 0;
+  for (int y = 0; y < kHeight; ++y) {
+    for (int x = 0; x < kWidth; ++x) {
+      float expected = kClearDepth;
+      for (const auto& rect : written) {
+        if (rect.contains(Vector2i(x, y))) {
+          expected = GetWrittenDepth(x, y);
+        }
+      }
+      differences += depths[y * kWidth + x] != expected;
+      differences += surface.ReadValue(x, y) != expected;
+    }
+  }
+  BOOST_CHECK_EQUAL(differences, 0);
+}
+}
+
+BOOST_AUTO_TEST_CASE(ClearIsReadBack) {
+  RenderSurface1f surface(kWidth, kHeight);
+  surface.Fill(0.0f);
+  surface.ClearValue(kClearDepth);
+  CheckSurface(surface, {});
+
+  // A rect across the border of four tiles, with offset and stride
+  const int stride = 37;
+  std::vector<float> depths(stride * 20, -1.0f);
+  surface.ReadRect(GetRect(50, 55, 79, 74), &depths[0], stride);
+  int differences = 0;
+  for (int y = 0; y < 20; ++y) {
+    for (int x = 0; x < stride; ++x) {
+      differences += depths[y * stride + x] != (x < 30 ? kClearDepth : -1.0f);
+    }
+  }
+  BOOST_CHECK_EQUAL(differences, 0);
+}
+
+// Writes to parts of tiles must fill the rest of them with the clear value
+BOOST_AUTO_TEST_CASE(PartialWrites) {
+  RenderSurface1f surface(kWidth, kHeight);
+  surface.Fill(0.0f);
+  surface.ClearValue(kClearDepth);
+  const std::vector<AlignedBox<int, 2>> written = {
+    GetRect(60, 60, 70, 70),      // Across the corner of four tiles
+    GetRect(190, 140, 199, 149),  // In the partial tile at the corner
+    GetRect(5, 0, 5, 149)         // One column across a column of tiles
+  };
+  for (const auto& rect : written) {
+    WriteRegion(surface, rect);
+  }
+  CheckSurface(surface, written);
+}
+
+// Writes covering whole tiles drop their pending clears
+BOOST_AUTO_TEST_CASE(WholeTileWrites) {
+  const int tile = RenderSurface1f::kClearTileSize;
+  RenderSurface1f surface(kWidth, kHeight);
+  surface.Fill(0.0f);
+  surface.ClearValue(kClearDepth);
+  const std::vector<AlignedBox<int, 2>> written = {
+    GetRect(tile, 0, 2 * tile - 1, tile - 1),
+    GetRect(3 * tile, 2 * tile, kWidth - 1, kHeight - 1)
+  };
+  for (const auto& rect : written) {
+    WriteRegion(surface, rect);
+  }
+  CheckSurface(surface, written);
+
+  // A later clear applies to written tiles again
+  surface.ClearValue(kClearDepth);
+  CheckSurface(surface, {});
+}
+
+// GetPixels and the non-const accessor resolve pending clears
+BOOST_AUTO_TEST_CASE(ResolvedPixels) {
+  RenderSurface1f surface(kWidth, kHeight);
+  surface.Fill(0.0f);
+  surface.ClearValue(kClearDepth);
+  surface(10, 10) = 0.25f;
+  WriteRegion(surface, GetRect(100, 100, 120, 110));
+  const float* pixels = surface.GetPixels();
+  int differences = 0;
+  for (int y = 0; y < kHeight; ++y) {
+    for (int x = 0; x < kWidth; ++x) {
+      float expected = kClearDepth;
+      if (x == 10 && y == 10) {
+        expected = 0.25f;
+      } else if (GetRect(100, 100, 120, 110).contains(Vector2i(x, y))) {
+        expected = GetWrittenDepth(x, y);
+      }
+      differences += pixels[y * kWidth + x] != expected;
+    }
+  }
+  BOOST_CHECK_EQUAL(differences, 0);
+}
+
+// Pending clears of a packed format read back as the encoded clear value
+BOOST_AUTO_TEST_CASE(PackedClear) {
+  RenderSurfaceD16 surface(kWidth, kHeight);
+  surface.Fill(PixelTraits<PixelD16>::Encode(0.0f));
+  surface.ClearValue(kClearDepth);
+  const float expected =
+    PixelTraits<PixelD16>::Decode(PixelTraits<PixelD16>::Encode(kClearDepth));
+  std::vector<float> depths(kWidth * kHeight);
+  surface.ReadRect(GetSurfaceRect(), &depths[0], kWidth);
+  int differences = 0;
+  for (float depth : depths) {
+    differences += depth != expected;
+  }
+  BOOST_CHECK_EQUAL(differences, 0);
+}
+
+// The renderer's tiles read cleared tiles of the z-buffer, and write back
+// only what they drew
+BOOST_AUTO_TEST_CASE(ClearThenDraw) {
+  const auto renderTarget = std::make_shared<RenderTarget>(kWidth, kHeight);
+  RastaManRenderer renderer(renderTarget);
+  renderer.SetViewport(0, 0, kWidth, kHeight);
+  renderer.SetProjectionMatrix(Matrix4f::Identity());
+  renderer.SetModelViewMatrix(Matrix4f::Identity());
+  PipelineState state;
+  state.cullMode = CULL_NONE;
+  renderer.SetPipelineState(state);
+  const float clearColor[4] = { 0, 0, 0, 0 };
+  renderer.Clear(clearColor);
+  // A quad at depth 0.5 over pixels [50, 149] x [25, 124]
+  const Vector3f vertices[4] = {
+    Vector3f(-0.5f, -2.0f / 3, 0), Vector3f(0.5f, -2.0f / 3, 0),
+    Vector3f(0.5f, 2.0f / 3, 0), Vector3f(-0.5f, 2.0f / 3, 0)
+  };
+  const int indices[6] = { 0, 1, 2, 0, 2, 3 };
+  renderer.DrawTriangles(vertices, indices, 6);
+
+  std::vector<float> depths(kWidth * kHeight);
+  renderTarget->GetZBuffer()->ReadRect(GetSurfaceRect(), &depths[0], kWidth);
+  const AlignedBox<int, 2> quad = GetRect(50, 25, 149, 124);
+  int differences = 0;
+  for (int y = 0; y < kHeight; ++y) {
+    for (int x = 0; x < kWidth; ++x) {
+      const float expected = quad.contains(Vector2i(x, y)) ? 0.5f : 1.0f;
+      differences += depths[y * kWidth + x] != expected;
+    }
+  }
+  BOOST_CHECK_EQUAL(differences, 0);
+}
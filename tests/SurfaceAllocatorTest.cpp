@@ -0,0 +1,71 @@
+#define BOOST_TEST_MODULE SurfaceAllocator
+#include <boost/test/included/unit_test.hpp>
+
+#include "SurfaceAllocator.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+// Blocks must be aligned for SIMD loads and huge pages, and freed blocks must
+// be reused by allocations they fit without wasting much of them.
+
+namespace {
+bool IsAligned(const void* block, std::size_t alignment) {
+  return reinterpret_cast<std::uintptr_t>(block) % alignment == 0;
+}
+}
+
+BOOST_AUTO_TEST_CASE(Alignment) {
+  SurfaceAllocator allocator;
+  allocator.SetHugePagesEnabled(false);
+  for (std::size_t size : { 1, 3, 64, 100, 4099, 1 << 20 }) {
+    BOOST_TEST_CONTEXT("size " << size) {
+      void* block = allocator.Allocate(size);
+      BOOST_CHECK(IsAligned(block, SurfaceAllocator::kAlignment));
+      // The whole size must be writable
+      std::memset(block, 0xff, size);
+      allocator.Free(block);
+    }
+  }
+  void* huge = allocator.Allocate(SurfaceAllocator::kHugePageSize + 1);
+  BOOST_CHECK(IsAligned(huge, SurfaceAllocator::kHugePageSize));
+  allocator.Free(huge);
+}
+
+BOOST_AUTO_TEST_CASE(Reuse) {
+  SurfaceAllocator allocator;
+  void* block = allocator.Allocate(1000);
+  allocator.Free(block);
+  // The same size, and a size wasting less than a quarter of the block
+  void* same = allocator.Allocate(1000);
+  BOOST_CHECK_EQUAL(same, block);
+  allocator.Free(same);
+  void* smaller = allocator.Allocate(800);
+  BOOST_CHECK_EQUAL(smaller, block);
+  allocator.Free(smaller);
+
+  // Too small or too large for the free block
+  void* small = allocator.Allocate(700);
+  void* large = allocator.Allocate(1100);
+  BOOST_CHECK_NE(small, block);
+  BOOST_CHECK_NE(large, block);
+  allocator.Free(small);
+  allocator.Free(large);
+}
+
+// Among several free blocks, the smallest one that fits is reused
+BOOST_AUTO_TEST_CASE(BestFit) {
+  SurfaceAllocator allocator;
+  void* large = allocator.Allocate(4000);
+  void* medium = allocator.Allocate(2000);
+  void* small = allocator.Allocate(1000);
+  allocator.Free(large);
+  allocator.Free(medium);
+  allocator.Free(small);
+  BOOST_CHECK_EQUAL(allocator.Allocate(1900), medium);
+  BOOST_CHECK_EQUAL(allocator.Allocate(3500), large);
+  BOOST_CHECK_EQUAL(allocator.Allocate(1000), small);
+  allocator.Free(large);
+  allocator.Free(medium);
+  allocator.Free(small);
+}
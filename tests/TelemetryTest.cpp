@@ -0,0 +1,124 @@
+#define BOOST_TEST_MODULE Telemetry
+#include <boost/test/included/unit_test.hpp>
+
+#include "Telemetry.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Bucket boundaries of LatencyHistogram: values below kSubBucketCount have
+// buckets of their own, and larger ones share buckets of a width relative to
+// their power of two.
+
+namespace {
+const uint64_t kLargest = std::numeric_limits<uint64_t>::max();
+// Largest value with a bucket of its own
+const uint64_t kLastValue =
+  (uint64_t(1) << (LatencyHistogram::kMaxExponent + 1)) - 1;
+
+// Width of the bucket a value below 2^(kMaxExponent + 1) is recorded in
+uint64_t GetBucketWidth(uint64_t value) {
+  uint64_t width = 1;
+  while (value >= LatencyHistogram::kSubBucketCount * width) {
+    width *= 2;
+  }
+  return width;
+}
+
+// Lowest value of the bucket of a value, from GetBuckets
+uint64_t GetBucketMin(uint64_t value) {
+  LatencyHistogram histogram;
+  histogram.Record(value);
+  std::vector<std::pair<uint64_t, uint64_t>> buckets;
+  histogram.GetBuckets(&buckets);
+  BOOST_REQUIRE_EQUAL(buckets.size(), 1u);
+  BOOST_CHECK_EQUAL(buckets[0].second, 1u);
+  return buckets[0].first;
+}
+
+// Highest value of the bucket of a value.  Percentiles report the upper end
+// of their bucket, unless that is above the largest recorded value.
+uint64_t GetBucketMax(uint64_t value) {
+  LatencyHistogram histogram;
+  histogram.Record(value);
+  histogram.Record(kLastValue);
+  return histogram.GetPercentile(50);
+}
+
+void CheckBucket(uint64_t value) {
+  const uint64_t width = GetBucketWidth(value);
+  const uint64_t min = GetBucketMin(value);
+  const uint64_t max = GetBucketMax(value);
+  BOOST_TEST_CONTEXT("value " << value) {
+    BOOST_CHECK_EQUAL(min, value / width * width);
+    BOOST_CHECK_EQUAL(max, min + width - 1);
+    // Buckets are at most 1/64 of their lowest value wide
+    BOOST_CHECK(width == 1
+                || width * (LatencyHistogram::kSubBucketCount / 2) <= min);
+  }
+}
+}
+
+BOOST_AUTO_TEST_CASE(ExactBuckets) {
+  for (uint64_t value = 0; value < LatencyHistogram::kSubBucketCount;
+       ++value) {
+    BOOST_CHECK_EQUAL(GetBucketMin(value), value);
+    BOOST_CHECK_EQUAL(GetBucketMax(value), value);
+  }
+}
+
+// Values around every power of two, where the bucket width doubles
+BOOST_AUTO_TEST_CASE(BucketBoundaries) {
+  for (int exponent = LatencyHistogram::kSubBucketBits;
+       exponent <= LatencyHistogram::kMaxExponent; ++exponent) {
+    const uint64_t power = uint64_t(1) << exponent;
+    const uint64_t width = GetBucketWidth(power);
+    for (uint64_t value : { power - width / 2 - 1, power - width / 2,
+                            power - 1, power, power + 1, power + width - 1,
+                            power + width, 2*power - 1 }) {
+      CheckBucket(value);
+    }
+    // Adjacent buckets leave no gaps
+    BOOST_CHECK_EQUAL(GetBucketMax(power - 1) + 1, GetBucketMin(power));
+    BOOST_CHECK_EQUAL(GetBucketMax(power) + 1, GetBucketMin(power + width));
+  }
+}
+
+// Values beyond the last bucket are recorded in it, and reported as the
+// largest value rather than the end of the bucket
+BOOST_AUTO_TEST_CASE(LargestBucket) {
+  const uint64_t lastMin = GetBucketMin(kLastValue);
+  BOOST_CHECK_EQUAL(GetBucketMax(kLastValue), kLastValue);
+  for (uint64_t value : { kLastValue + 1, uint64_t(1) << 50, kLargest }) {
+    BOOST_TEST_CONTEXT("value " << value) {
+      BOOST_CHECK_EQUAL(GetBucketMin(value), lastMin);
+      LatencyHistogram histogram;
+      histogram.Record(1);
+      histogram.Record(value);
+      BOOST_CHECK_EQUAL(histogram.GetPercentile(100), value);
+      BOOST_CHECK_EQUAL(histogram.GetMax(), value);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(Statistics) {
+  LatencyHistogram histogram;
+  BOOST_CHECK_EQUAL(histogram.GetCount(), 0u);
+  BOOST_CHECK_EQUAL(histogram.GetMin(), 0u);
+  BOOST_CHECK_EQUAL(histogram.GetPercentile(50), 0u);
+  for (uint64_t value = 1; value <= 1000; ++value) {
+    histogram.Record(value);
+  }
+  BOOST_CHECK_EQUAL(histogram.GetCount(), 1000u);
+  BOOST_CHECK_EQUAL(histogram.GetMin(), 1u);
+  BOOST_CHECK_EQUAL(histogram.GetMax(), 1000u);
+  BOOST_CHECK_EQUAL(histogram.GetMean(), 500.5);
+  // 500 is in [500, 503], 990 in [984, 991]
+  BOOST_CHECK_EQUAL(histogram.GetPercentile(50), 503u);
+  BOOST_CHECK_EQUAL(histogram.GetPercentile(99), 991u);
+  BOOST_CHECK_EQUAL(histogram.GetPercentile(100), 1000u);
+  histogram.Clear();
+  BOOST_CHECK_EQUAL(histogram.GetCount(), 0u);
+}